@@ -0,0 +1,257 @@
+#include "approximate_counter.h"
+#include "dictionary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+const size_t CApproximateCounter::MAX_LETTERS;
+const uint32_t CApproximateCounter::NONE;
+
+namespace {
+
+// FNV-1a of the letters from the last one back, so all substrings ending at a letter are hashed in one pass
+const uint64_t HASH_START = 14695981039346656037ULL;
+
+inline uint64_t extendHash(uint64_t hash, char letter) {
+    return (hash ^ (unsigned char)letter) * 1099511628211ULL;
+}
+
+}
+
+CApproximateCounter::CApproximateCounter(size_t countersNumber_, BigInt minimalLength_)
+    : maximalCounters(countersNumber_), minimalLength(minimalLength_)
+{
+    // Words are cut at bytes of non-letters
+    if (symbolClasses().isUtf8()) {
+        throw std::runtime_error("UTF-8 letters are counted by the suffix tree only, not approximately!");
+    }
+    if (maximalCounters == 0 || maximalCounters >= NONE / 2) {
+        throw std::runtime_error("Number of approximate counters has to be from 1 to " + std::to_string(NONE / 2 - 1) + "!");
+    }
+    if (minimalLength < 1) {
+        minimalLength = 1;
+    }
+    if (minimalLength > (BigInt)MAX_LETTERS) {
+        throw std::runtime_error("Approximate counters count substrings of " + std::to_string(MAX_LETTERS) + " letters at most!");
+    }
+    counters.reserve(maximalCounters);
+    heap.reserve(maximalCounters);
+    // Half of the slots are empty at least, so probes stay short
+    size_t slotsNumber = 1;
+    while (slotsNumber < 2 * maximalCounters) {
+        slotsNumber *= 2;
+    }
+    slots.assign(slotsNumber, NONE);
+    slotMask = slotsNumber - 1;
+}
+
+// A counter takes its heap entry and up to 4 slots, there are twice as many of them as counters at least
+size_t CApproximateCounter::countersFor(size_t memoryBytes) {
+    return std::max((size_t)1, memoryBytes / (sizeof(CCounter) + 5 * sizeof(uint32_t)));
+}
+
+void CApproximateCounter::append(const char *letters, size_t size) {
+    checkDictionary(letters, size);
+    charactersRead += size;
+    const CSymbolClasses &classes = symbolClasses();
+    for (size_t index = 0; index < size; ++index) {
+        if (classes.isLetter(letters[index])) {
+            countLetter(letters[index]);
+        } else {
+            finish();
+        }
+    }
+}
+
+void CApproximateCounter::finish() {
+    tailSize = 0;
+    wordLength = 0;
+}
+
+void CApproximateCounter::countLetter(char letter) {
+    if (tailSize == sizeof(tail)) {
+        memmove(tail, tail + tailSize - (MAX_LETTERS - 1), MAX_LETTERS - 1);
+        tailSize = MAX_LETTERS - 1;
+    }
+    tail[tailSize++] = letter;
+    ++wordLength;
+    if (wordLength < minimalLength) {
+        return;
+    }
+    // Substrings of all lengths are in the number, the ones of MAX_LETTERS at most get counters
+    substringsNumber += wordLength - minimalLength + 1;
+
+    const size_t longest = std::min((size_t)wordLength, MAX_LETTERS);
+    const char *end = tail + tailSize;
+    uint64_t hash = HASH_START;
+    for (size_t length = 1; length <= longest; ++length) {
+        hash = extendHash(hash, end[-(ptrdiff_t)length]);
+        if ((BigInt)length >= minimalLength) {
+            countSubstring(end - length, length, hash);
+        }
+    }
+}
+
+void CApproximateCounter::countSubstring(const char *letters, size_t size, uint64_t hash) {
+    size_t slot = findSlot(letters, size, hash);
+    if (slots[slot] != NONE) {
+        const uint32_t counter = slots[slot];
+        ++counters[counter].count;
+        siftDown(counters[counter].position);
+        return;
+    }
+
+    uint32_t counter;
+    if (counters.size() < maximalCounters) {
+        counter = counters.size();
+        counters.emplace_back();
+        counters.back().count = 1;
+        counters.back().error = 0;
+        heap.push_back(counter);
+        placeInHeap(heap.size() - 1, counter);
+        siftUp(heap.size() - 1);
+    } else {
+        // The substring takes the counter of the least count, which may be its own count at most
+        counter = heap[0];
+        CCounter &replaced = counters[counter];
+        removeSlot(findSlot(replaced.letters, replaced.length, replaced.hash));
+        replaced.error = replaced.count;
+        ++replaced.count;
+        siftDown(0);
+        // Slots moved back, the empty one may be another now
+        slot = findSlot(letters, size, hash);
+    }
+    CCounter &taken = counters[counter];
+    taken.hash = hash;
+    taken.length = size;
+    memcpy(taken.letters, letters, size);
+    slots[slot] = counter;
+}
+
+size_t CApproximateCounter::findSlot(const char *letters, size_t size, uint64_t hash) const {
+    size_t slot = hash & slotMask;
+    while (slots[slot] != NONE) {
+        const CCounter &counter = counters[slots[slot]];
+        if (counter.hash == hash && counter.length == size && memcmp(counter.letters, letters, size) == 0) {
+            break;
+        }
+        slot = (slot + 1) & slotMask;
+    }
+    return slot;
+}
+
+void CApproximateCounter::removeSlot(size_t slot) {
+    // A counter after the gap moves into it unless its own slot is cyclically after the gap
+    size_t next = slot;
+    while (true) {
+        next = (next + 1) & slotMask;
+        if (slots[next] == NONE) {
+            break;
+        }
+        const size_t home = counters[slots[next]].hash & slotMask;
+        const bool stays = (slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next);
+        if (!stays) {
+            slots[slot] = slots[next];
+            slot = next;
+        }
+    }
+    slots[slot] = NONE;
+}
+
+void CApproximateCounter::siftUp(size_t position) {
+    const uint32_t counter = heap[position];
+    while (position > 0) {
+        const size_t parent = (position - 1) / 2;
+        if (counters[heap[parent]].count <= counters[counter].count) {
+            break;
+        }
+        placeInHeap(position, heap[parent]);
+        position = parent;
+    }
+    placeInHeap(position, counter);
+}
+
+void CApproximateCounter::siftDown(size_t position) {
+    const uint32_t counter = heap[position];
+    while (true) {
+        size_t child = 2 * position + 1;
+        if (child >= heap.size()) {
+            break;
+        }
+        if (child + 1 < heap.size() && counters[heap[child + 1]].count < counters[heap[child]].count) {
+            ++child;
+        }
+        if (counters[counter].count <= counters[heap[child]].count) {
+            break;
+        }
+        placeInHeap(position, heap[child]);
+        position = child;
+    }
+    placeInHeap(position, counter);
+}
+
+// Counters are chosen by their numbers, strings are made for the ones taken only
+std::vector<CApproximateEntry> CApproximateCounter::getTopEntries(size_t takeTopN) const {
+    std::vector<uint32_t> chosen(counters.size());
+    for (size_t index = 0; index < chosen.size(); ++index) {
+        chosen[index] = index;
+    }
+    // More occurrences go first, equal ones in lexicographical order
+    auto better = [this](uint32_t a, uint32_t b) {
+        const CCounter &first = counters[a];
+        const CCounter &second = counters[b];
+        if (first.count != second.count) {
+            return first.count > second.count;
+        }
+        const int order = memcmp(first.letters, second.letters, std::min(first.length, second.length));
+        return order < 0 || (order == 0 && first.length < second.length);
+    };
+    if (takeTopN > 0 && takeTopN < chosen.size()) {
+        std::partial_sort(chosen.begin(), chosen.begin() + takeTopN, chosen.end(), better);
+        chosen.resize(takeTopN);
+    } else {
+        std::sort(chosen.begin(), chosen.end(), better);
+    }
+
+    std::vector<CApproximateEntry> entries;
+    for (auto index: chosen) {
+        const CCounter &counter = counters[index];
+        entries.push_back({ std::string(counter.letters, counter.length), counter.count, counter.error });
+    }
+    return entries;
+}
+
+void CApproximateCounter::checkLength(BigInt minimalLength_) const {
+    if (std::max((BigInt)1, minimalLength_) != minimalLength) {
+        throw std::runtime_error("Approximate counters count substrings of " + std::to_string(minimalLength)
+                                 + " letters at least, not of " + std::to_string(minimalLength_) + "!");
+    }
+}
+
+CFrequencyInfo CApproximateCounter::getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength_) {
+    checkLength(minimalLength_);
+    CFrequencyInfo result;
+    for (const auto &entry: getTopEntries(takeTopN)) {
+        result.emplace_back(entry.substring, 100 * entry.count / (double)substringsNumber);
+    }
+    return result;
+}
+
+BigInt CApproximateCounter::getNumbetOfSubstringsLongerThan(BigInt minimalLength_) {
+    checkLength(minimalLength_);
+    return substringsNumber;
+}
+
+// Errors are counts of the least counter when it was replaced, and counts only grow
+BigInt CApproximateCounter::maximalError() const {
+    return (counters.size() < maximalCounters) ? 0 : counters[heap[0]].count;
+}
+
+size_t CApproximateCounter::bytesUsed() const {
+    return sizeof(*this) + counters.capacity() * sizeof(CCounter) + heap.capacity() * sizeof(uint32_t) + slots.capacity() * sizeof(uint32_t);
+}
+
+double CApproximateCounter::bytesPerCharacter() const {
+    return bytesUsed() / (double)std::max((size_t)1, charactersRead);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "print.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Substring with its estimated number of occurrences, it occurs from count - error to count times
+struct CApproximateEntry {
+    std::string substring;
+    BigInt count;
+    BigInt error;
+};
+
+//---------------------------------------------------
+// Approximate counter of frequent substrings of a stream in fixed memory (Space-Saving).
+//
+// Every occurrence of a substring within a word of minimalLength to MAX_LETTERS letters goes
+// to a counter of a fixed number of them. A substring without a counter takes the one of
+// the least count c, so it starts from c + 1 with error c. Counts are never below true ones,
+// and they are over by their errors at most, which are below occurrences / counters.
+// A substring occurring more than that has a counter for sure.
+// Numbers of substrings are counted exactly for all lengths, so percentages are of the same
+// numbers as percentages of the suffix tree. A longer substring occurs as often as its first
+// MAX_LETTERS letters at most, which are counted.
+// Letters are counted as they come, only the last MAX_LETTERS of a word are kept:
+// memory doesn't depend on the stream, and a letter takes MAX_LETTERS counts at most.
+class CApproximateCounter {
+public:
+    CApproximateCounter(size_t countersNumber_, BigInt minimalLength_);
+
+    // Counters fitting into the memory with their hash slots and heap
+    static size_t countersFor(size_t memoryBytes);
+
+    // Counts substrings of the next chunk of the stream, a word cut by its end goes on in the next one.
+    // Checks the chunk like the engines do, throws std::runtime_error if it is wrong.
+    void append(const char *letters, size_t size);
+    // Ends the word the stream ends with
+    void finish();
+
+    // Best counters by count, equal ones in lexicographical order
+    std::vector<CApproximateEntry> getTopEntries(size_t takeTopN) const;
+
+    // Top N of the minimal length counted, percentages of counts of getTopEntries()
+    CFrequencyInfo getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength);
+
+    // Exact number of substrings of the minimal length counted
+    BigInt getNumbetOfSubstringsLongerThan(BigInt minimalLength);
+
+    // Error every counter is within, 0 until all counters are taken
+    BigInt maximalError() const;
+
+    size_t countersNumber() const { return maximalCounters; }
+    // Memory of the counter, fixed when it is made
+    size_t bytesUsed() const;
+    double bytesPerCharacter() const;
+
+    // Longest substrings counted
+    static const size_t MAX_LETTERS = 32;
+
+private:
+    struct CCounter {
+        uint64_t hash;
+        BigInt count;
+        BigInt error;
+        // Position in the heap
+        uint32_t position;
+        uint8_t length;
+        char letters[MAX_LETTERS];
+    };
+
+    size_t maximalCounters;
+    BigInt minimalLength;
+    std::vector<CCounter> counters;
+    // Min-heap of counters by count, the root is replaced by a new substring
+    std::vector<uint32_t> heap;
+    // Open addressing with linear probing: counter of every slot, NONE in empty ones
+    std::vector<uint32_t> slots;
+    size_t slotMask;
+
+    // Last letters of the current word, moved back when the buffer is full, and its length
+    char tail[2 * MAX_LETTERS];
+    size_t tailSize = 0;
+    BigInt wordLength = 0;
+    BigInt substringsNumber = 0;
+    size_t charactersRead = 0;
+
+    static const uint32_t NONE = 0xFFFFFFFFu;
+
+    void checkLength(BigInt minimalLength_) const;
+
+    // Counts the substrings of the word ending with the letter
+    void countLetter(char letter);
+    void countSubstring(const char *letters, size_t size, uint64_t hash);
+
+    // Slot of the counter of the substring, or the empty slot it would take
+    size_t findSlot(const char *letters, size_t size, uint64_t hash) const;
+    // Empties the slot, moving back the counters probed past it
+    void removeSlot(size_t slot);
+
+    void siftUp(size_t position);
+    void siftDown(size_t position);
+    void placeInHeap(size_t position, uint32_t counter) {
+        heap[position] = counter;
+        counters[counter].position = position;
+    }
+};
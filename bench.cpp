@@ -0,0 +1,413 @@
+#include "suffix_tree.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+void printUsage() {
+    std::cerr << "Usage:" << std::endl
+              << "./bench [--max-mb M] [--micro-mb S] [--repeats R] [--baseline B] [--tolerance T]" << std::endl
+              << "  microbenchmarks of the hot paths of the suffix tree on S MB of Zipfian words (4 by default)" << std::endl
+              << "  and builds of random letters, repeated patterns and Zipfian words of 1, 4, 16 ... up to M MB" << std::endl
+              << "  (16 by default, 1024 needs about 30 GB of memory); corpora are the same on every run." << std::endl
+              << "  Prints JSON of throughputs in MB/s, times and bytes per character to the standard output," << std::endl
+              << "  the best of R runs (3 by default). Saved output given as the baseline B is compared with," << std::endl
+              << "  results worse by more than T (0.2 by default) are regressions and fail the run." << std::endl;
+}
+
+//---------------------------------------------------
+// Corpora, made by std::mt19937 with fixed seeds and no distributions,
+// whose results are up to the library, so they are the same everywhere
+
+// Words of random letters, 1 to 12 of them
+std::string randomLetters(size_t size) {
+    std::mt19937 random(1);
+    std::string text;
+    text.reserve(size + 16);
+    while (text.size() < size) {
+        const size_t length = 1 + random() % 12;
+        for (size_t index = 0; index < length; ++index) {
+            text += (char)('a' + random() % 26);
+        }
+        text += ' ';
+    }
+    text.resize(size);
+    return text;
+}
+
+// Words of generator2 shuffled over and over
+std::string repeatedPatterns(size_t size) {
+    std::mt19937 random(2);
+    std::vector<std::string> words = { "hall ", "feels ", "heels " };
+    std::string text;
+    text.reserve(size + 16);
+    while (text.size() < size) {
+        for (size_t index = words.size() - 1; index > 0; --index) {
+            std::swap(words[index], words[random() % (index + 1)]);
+        }
+        for (const auto &word: words) {
+            text += word;
+        }
+    }
+    text.resize(size);
+    return text;
+}
+
+// Words of a vocabulary of random ones, the word of rank k is taken with probability ~ 1/k
+std::string zipfWords(size_t size) {
+    std::mt19937 random(3);
+    const size_t vocabularySize = 1 << 16;
+    std::vector<std::string> vocabulary(vocabularySize);
+    std::vector<double> cumulative(vocabularySize);
+    double sum = 0;
+    for (size_t rank = 0; rank < vocabularySize; ++rank) {
+        const size_t length = 2 + random() % 9;
+        for (size_t index = 0; index < length; ++index) {
+            vocabulary[rank] += (char)('a' + random() % 26);
+        }
+        sum += 1.0 / (rank + 1);
+        cumulative[rank] = sum;
+    }
+
+    std::string text;
+    text.reserve(size + 16);
+    while (text.size() < size) {
+        const double value = random() / 4294967296.0 * sum;
+        const size_t rank = std::upper_bound(cumulative.begin(), cumulative.end(), value) - cumulative.begin();
+        text += vocabulary[std::min(rank, vocabularySize - 1)];
+        text += ' ';
+    }
+    text.resize(size);
+    return text;
+}
+
+typedef std::string (*TCorpusMaker)(size_t);
+
+const std::vector<std::pair<std::string, TCorpusMaker>> corpora = {
+    {"random_letters", randomLetters},
+    {"repeated_patterns", repeatedPatterns},
+    {"zipf_words", zipfWords},
+};
+
+//---------------------------------------------------
+
+const double MB = 1024 * 1024;
+
+template <typename TFunction>
+double secondsOf(TFunction function) {
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Results by names like "micro.get_next_point_ns", in the order they were first given
+typedef std::vector<std::pair<std::string, double>> CResults;
+
+CResults::iterator findResult(CResults &results, const std::string &name) {
+    return std::find_if(results.begin(), results.end(), [&](const std::pair<std::string, double> &result) {
+        return result.first == name;
+    });
+}
+
+// Keeps the best of runs: the greatest throughput, the least of anything else
+bool isThroughput(const std::string &name) {
+    const std::string suffix = "_mb_s";
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+void keepBest(CResults &results, const std::string &name, double value) {
+    auto found = findResult(results, name);
+    if (found == results.end()) {
+        results.emplace_back(name, value);
+    } else if (isThroughput(name) ? value > found->second : value < found->second) {
+        found->second = value;
+    }
+}
+
+// Descents from the root along substrings of the text, every letter is in the tree
+// already, so increaseOrSplit() only goes further as it does for repeats while building
+const size_t DESCENTS = 1 << 15;
+const size_t DESCENT_LETTERS = 32;
+
+void runMicro(const std::string &text, CResults &results) {
+    runStats().clear();
+    CSuffixTree tree(text);
+    tree.buildTree();
+    const char *letters = tree.sourceString.data();
+    const size_t size = tree.sourceString.size();
+
+    // increaseOrSplit() and getNextPoint() are the steps of extendTree(), it is timed as a whole too
+    keepBest(results, "micro.extend_mb_s", size / MB / runStats().phaseSeconds("build"));
+    keepBest(results, "micro.count_occurrences_mb_s", size / MB / runStats().phaseSeconds("count_occurrences"));
+
+    std::mt19937 random(4);
+    std::vector<size_t> starts(DESCENTS);
+    for (auto &start: starts) {
+        start = random() % (size - DESCENT_LETTERS);
+    }
+
+    std::vector<CPoint> points(DESCENTS, CPoint(&tree));
+    size_t steps = 0;
+    const double increaseSeconds = secondsOf([&]() {
+        for (size_t descent = 0; descent < DESCENTS; ++descent) {
+            CPoint point(&tree);
+            point.node = CSuffixTree::ROOT;
+            point.edge = CSuffixTree::NONE;
+            point.relativeIndex = 0;
+            NodeId node;
+            for (size_t index = 0; index < DESCENT_LETTERS; ++index) {
+                steps += point.increaseOrSplit(letters[starts[descent] + index], &node);
+            }
+            points[descent] = point;
+        }
+    });
+    if (steps != DESCENTS * DESCENT_LETTERS) {
+        throw std::runtime_error("Substrings of the text are not found in its tree!");
+    }
+    keepBest(results, "micro.increase_or_split_ns", increaseSeconds * 1e9 / steps);
+
+    // Points drop their first letters one by one down to the root, like the active point does
+    steps = 0;
+    const double nextSeconds = secondsOf([&]() {
+        for (CPoint point: points) {
+            while (point.edge != CSuffixTree::NONE) {
+                point = tree.getNextPoint(point);
+                ++steps;
+            }
+        }
+    });
+    keepBest(results, "micro.get_next_point_ns", nextSeconds * 1e9 / steps);
+
+    // Children by the letters following internal nodes, mostly small nodes deep in the tree
+    std::vector<std::pair<NodeId, char>> lookups;
+    for (size_t lookup = 0; lookup < DESCENTS * DESCENT_LETTERS; ++lookup) {
+        const NodeId node = random() % tree.arena.size();
+        const size_t next = tree.arena.position[node] + tree.arena.depth[node];
+        if (next < size) {
+            lookups.emplace_back(node, letters[next]);
+        }
+    }
+    size_t found = 0;
+    const double lookupSeconds = secondsOf([&]() {
+        for (const auto &lookup: lookups) {
+            found += tree.edgeFromLetter(lookup.first, lookup.second) != CSuffixTree::NONE;
+        }
+    });
+    if (found != lookups.size()) {
+        throw std::runtime_error("Children of the tree are not found!");
+    }
+    keepBest(results, "micro.edge_from_letter_ns", lookupSeconds * 1e9 / lookups.size());
+
+    keepBest(results, "micro.top_query_ms", 1e3 * secondsOf([&]() {
+        tree.getTopSuitableSubstrings(10, 4);
+    }));
+}
+
+void runScaling(const std::string &corpus, size_t megabytes, const std::string &text, CResults &results) {
+    const std::string prefix = "scaling." + corpus + "." + std::to_string(megabytes) + "mb.";
+    std::unique_ptr<CSuffixTree> tree;
+    const double buildSeconds = secondsOf([&]() {
+        tree.reset(new CSuffixTree(text));
+        tree->buildTree();
+    });
+    keepBest(results, prefix + "build_mb_s", text.size() / MB / buildSeconds);
+    keepBest(results, prefix + "bytes_per_character", tree->bytesPerCharacter());
+    keepBest(results, prefix + "top_query_ms", 1e3 * secondsOf([&]() {
+        tree->getTopSuitableSubstrings(10, 4);
+    }));
+}
+
+//---------------------------------------------------
+// JSON of the results, nested by the parts of their names
+
+std::string toJson(const CResults &results) {
+    std::ostringstream output;
+    std::vector<std::string> opened;
+    bool first = true;
+    for (const auto &result: results) {
+        std::vector<std::string> parts;
+        std::stringstream name(result.first);
+        std::string part;
+        while (std::getline(name, part, '.')) {
+            parts.push_back(part);
+        }
+        // Objects of the previous name not shared with this one are closed
+        size_t common = 0;
+        while (common < opened.size() && common + 1 < parts.size() && opened[common] == parts[common]) {
+            ++common;
+        }
+        while (opened.size() > common) {
+            opened.pop_back();
+            output << std::endl << std::string(2 * opened.size() + 2, ' ') << "}";
+        }
+        output << (first ? "{" : ",") << std::endl;
+        first = false;
+        while (opened.size() + 1 < parts.size()) {
+            output << std::string(2 * opened.size() + 2, ' ') << "\"" << parts[opened.size()] << "\": {" << std::endl;
+            opened.push_back(parts[opened.size()]);
+        }
+        output << std::string(2 * opened.size() + 2, ' ') << "\"" << parts.back() << "\": " << result.second;
+    }
+    while (!opened.empty()) {
+        opened.pop_back();
+        output << std::endl << std::string(2 * opened.size() + 2, ' ') << "}";
+    }
+    output << std::endl << "}" << std::endl;
+    return output.str();
+}
+
+// Numbers of the JSON printed by toJson() by their dotted names, throws std::runtime_error for anything else
+CResults fromJson(const std::string &json) {
+    CResults results;
+    std::vector<std::string> opened;
+    std::string key;
+    size_t position = 0;
+    auto fail = [&]() {
+        throw std::runtime_error("Baseline is not JSON of bench results at byte " + std::to_string(position) + "!");
+    };
+    while (position < json.size()) {
+        const char c = json[position];
+        if (c == '"') {
+            const size_t end = json.find('"', position + 1);
+            if (end == std::string::npos) {
+                fail();
+            }
+            key = json.substr(position + 1, end - position - 1);
+            position = end + 1;
+        } else if (c == '{') {
+            if (!key.empty()) {
+                opened.push_back(key);
+                key.clear();
+            }
+            ++position;
+        } else if (c == '}') {
+            if (!opened.empty()) {
+                opened.pop_back();
+            }
+            ++position;
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            char *end;
+            const double value = strtod(json.c_str() + position, &end);
+            if (key.empty()) {
+                fail();
+            }
+            std::string name;
+            for (const auto &part: opened) {
+                name += part + ".";
+            }
+            results.emplace_back(name + key, value);
+            key.clear();
+            position = end - json.c_str();
+        } else if (c == ':' || c == ',' || isspace((unsigned char)c)) {
+            ++position;
+        } else {
+            fail();
+        }
+    }
+    return results;
+}
+
+// Prints the results next to the baseline ones, returns number of regressions
+size_t compare(CResults &baseline, const CResults &results, double tolerance) {
+    size_t regressions = 0;
+    for (const auto &result: results) {
+        const auto base = findResult(baseline, result.first);
+        if (base == baseline.end() || base->second <= 0) {
+            continue;
+        }
+        const double change = result.second / base->second - 1;
+        const bool regressed = isThroughput(result.first) ? change < -tolerance : change > tolerance;
+        regressions += regressed;
+        std::cerr << (regressed ? "REGRESSION " : "           ") << result.first << ": " << base->second
+                  << " -> " << result.second << " (" << (change >= 0 ? "+" : "") << std::round(change * 1000) / 10 << "%)" << std::endl;
+    }
+    return regressions;
+}
+
+int main(int argc, char *argv[]) try {
+    size_t maxMegabytes = 16;
+    size_t microMegabytes = 4;
+    size_t repeats = 3;
+    double tolerance = 0.2;
+    std::string baselineFile;
+
+    for (int argIndex = 1; argIndex < argc; argIndex += 2) {
+        const std::string option = argv[argIndex];
+        if (option == "-h" || option == "--help" || argIndex + 1 >= argc) {
+            printUsage();
+            return (option == "-h" || option == "--help") ? 0 : 1;
+        }
+        const std::string value = argv[argIndex + 1];
+        if (option == "--max-mb") {
+            maxMegabytes = std::stoul(value);
+        } else if (option == "--micro-mb") {
+            microMegabytes = std::stoul(value);
+        } else if (option == "--repeats") {
+            repeats = std::max(1ul, std::stoul(value));
+        } else if (option == "--baseline") {
+            baselineFile = value;
+        } else if (option == "--tolerance") {
+            tolerance = std::stod(value);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    CResults baseline;
+    if (!baselineFile.empty()) {
+        std::ifstream input(baselineFile);
+        if (!input) {
+            throw std::runtime_error("Can't read baseline '" + baselineFile + "'!");
+        }
+        std::stringstream json;
+        json << input.rdbuf();
+        baseline = fromJson(json.str());
+    }
+
+    // Phases of the tree time what can't be called from here
+    runStats().enable();
+    CResults results;
+
+    const std::string microText = zipfWords((size_t)(microMegabytes * MB));
+    for (size_t repeat = 0; repeat < repeats; ++repeat) {
+        runMicro(microText, results);
+    }
+
+    for (const auto &corpus: corpora) {
+        for (size_t megabytes = 1; megabytes <= maxMegabytes; megabytes *= 4) {
+            const std::string text = corpus.second((size_t)(megabytes * MB));
+            // Big builds take long enough to be timed once
+            for (size_t repeat = 0; repeat < (megabytes <= 4 ? repeats : 1); ++repeat) {
+                runScaling(corpus.first, megabytes, text, results);
+            }
+        }
+    }
+
+    std::cout << toJson(results);
+
+    if (!baselineFile.empty()) {
+        const size_t regressions = compare(baseline, results, tolerance);
+        if (regressions > 0) {
+            std::cerr << regressions << " regressions against '" << baselineFile << "'!" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+} catch(std::exception &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+}
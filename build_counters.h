@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Counters are compiled in with -DTREE_COUNTERS (cmake -DTREE_COUNTERS=ON),
+// without it every counting call is an empty inline function and costs nothing
+#ifdef TREE_COUNTERS
+const bool treeCountersEnabled = true;
+#else
+const bool treeCountersEnabled = false;
+#endif
+
+//---------------------------------------------------
+// Histogram of powers of two: bucket 0 counts zeros, bucket k counts values from 2^(k-1) to 2^k - 1
+class CLogHistogram {
+public:
+    void add(uint64_t value) {
+        ++buckets[(value == 0) ? 0 : 64 - __builtin_clzll(value)];
+    }
+
+    // Counts up to the last bucket not empty
+    std::vector<uint64_t> counts() const {
+        size_t used = BUCKETS;
+        while (used > 0 && buckets[used - 1] == 0) {
+            --used;
+        }
+        return std::vector<uint64_t>(buckets, buckets + used);
+    }
+
+private:
+    static const size_t BUCKETS = 65;
+    uint64_t buckets[BUCKETS] = {};
+};
+
+//---------------------------------------------------
+// Events of Ukkonen's construction of a suffix tree, to tell which inputs make it slow.
+// A phase is the extension of the tree by one letter.
+class CBuildCounters {
+public:
+    // Edge split by a new node, which gets a new leaf too
+    void edgeSplit() { count(edgeSplits); }
+    // New leaf at a split or under an existing node
+    void leafCreation() { count(leafCreations); }
+    // getNextPoint() going to the suffix link of a node other than the root
+    void suffixLinkFollow() { count(suffixLinkFollows); }
+    // getNextPoint() skipping a whole edge by its length on the way down from the link
+    void skipCountHop() {
+        if (treeCountersEnabled) {
+            ++skipCountHops;
+            ++phaseHops;
+        }
+    }
+    // Phase stopped at the root with the same point as before
+    void samePointExit() { count(samePointExits); }
+    // Phase over, its hops go to the histogram
+    void phaseEnd() {
+        if (treeCountersEnabled) {
+            ++phases;
+            hopsPerPhase.add(phaseHops);
+            phaseHops = 0;
+        }
+    }
+
+    uint64_t phases = 0;
+    uint64_t edgeSplits = 0;
+    uint64_t leafCreations = 0;
+    uint64_t suffixLinkFollows = 0;
+    uint64_t skipCountHops = 0;
+    uint64_t samePointExits = 0;
+    CLogHistogram hopsPerPhase;
+
+private:
+    uint64_t phaseHops = 0;
+
+    static void count(uint64_t &counter) {
+        if (treeCountersEnabled) {
+            ++counter;
+        }
+    }
+};
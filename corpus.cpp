@@ -0,0 +1,106 @@
+#include "corpus.h"
+#include "thread_pool.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+const char CCorpus::SEPARATOR;
+
+namespace {
+
+// Regular files of the path, directories are walked recursively with entries sorted by name.
+// Symbolic links to directories are not followed, so there are no loops.
+void listFiles(const std::string &path, std::vector<std::string> &files, std::vector<off_t> &sizes, bool given) {
+    struct stat status;
+    if (lstat(path.c_str(), &status) != 0) {
+        throw std::runtime_error("Couldn't open file '" + path + "'");
+    }
+    if (S_ISDIR(status.st_mode)) {
+        DIR *directory = opendir(path.c_str());
+        if (directory == nullptr) {
+            throw std::runtime_error("Couldn't open directory '" + path + "'");
+        }
+        std::vector<std::string> names;
+        while (const dirent *entry = readdir(directory)) {
+            const std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                names.push_back(name);
+            }
+        }
+        closedir(directory);
+        std::sort(names.begin(), names.end());
+        for (const auto &name: names) {
+            listFiles(path + "/" + name, files, sizes, false);
+        }
+        return;
+    }
+    // Links given or found are read if they lead to files
+    if (S_ISLNK(status.st_mode) && stat(path.c_str(), &status) != 0) {
+        if (given) {
+            throw std::runtime_error("Couldn't open file '" + path + "'");
+        }
+        return;
+    }
+    if (S_ISREG(status.st_mode)) {
+        files.push_back(path);
+        sizes.push_back(status.st_size);
+    } else if (given) {
+        throw std::runtime_error("'" + path + "' is not a file or a directory");
+    }
+}
+
+}
+
+CCorpus::CCorpus(const std::vector<std::string> &paths, size_t threadsNumber) {
+    CStatsPhase phase("read");
+    std::vector<off_t> sizes;
+    for (const auto &path: paths) {
+        listFiles(path, fileNames, sizes, true);
+    }
+    if (fileNames.empty()) {
+        throw std::runtime_error("There are no files to read!");
+    }
+
+    // Every document is followed by a separator
+    uint64_t totalSize = 0;
+    for (const auto size: sizes) {
+        documentStart.push_back(totalSize);
+        totalSize += size + 1;
+        if (totalSize >= UINT32_MAX) {
+            throw std::runtime_error("Files are too long for one index!");
+        }
+    }
+    text.assign(totalSize, SEPARATOR);
+
+    // Places of documents don't overlap, so threads write into the text without locks
+    CThreadPool pool(threadsNumber);
+    for (size_t document = 0; document < fileNames.size(); ++document) {
+        pool.run([this, &sizes, document]() {
+            const std::string &fileName = fileNames[document];
+            const int file = open(fileName.c_str(), O_RDONLY);
+            if (file < 0) {
+                throw std::runtime_error("Couldn't open file '" + fileName + "'");
+            }
+            char *place = &text[ documentStart[document] ];
+            off_t done = 0;
+            while (done < sizes[document]) {
+                const ssize_t bytesRead = pread(file, place + done, sizes[document] - done, done);
+                if (bytesRead <= 0) {
+                    break;
+                }
+                done += bytesRead;
+            }
+            close(file);
+            if (done != sizes[document]) {
+                throw std::runtime_error("File '" + fileName + "' changed while it was read");
+            }
+        });
+    }
+    pool.wait();
+}
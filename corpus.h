@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//---------------------------------------------------
+// Text of many files indexed together, every file is a document followed by a separator.
+// Counted substrings never cross a non-letter, so a single separator symbol keeps documents apart
+// as well as unique ones would, and the alphabet of the tree stays the same.
+class CCorpus {
+public:
+    // Reads the files given and the files under the directories given, in the order of their names.
+    // Files are read by threadsNumber threads straight into their places in the text.
+    // Throws std::runtime_error if a file can't be read or there are no files.
+    CCorpus(const std::vector<std::string> &paths, size_t threadsNumber);
+
+    std::string text;
+    // Start of every document in the text, ascending
+    std::vector<uint32_t> documentStart;
+    std::vector<std::string> fileNames;
+
+    static const char SEPARATOR = '\n';
+};
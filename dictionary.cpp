@@ -0,0 +1,276 @@
+#include "dictionary.h"
+#include "unicode_letters.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Vocabulary the substring counters accept
+const std::string dictionaryLetters("ABCDEFGHIJKLMNOPQRSTUVWXYZ\t\n\r \"',.[]{}()-*&^%$#@!1?;:234567890_abcdefghijklmnopqrstuvwxyz");
+
+const uint8_t CSymbolClasses::ALLOWED;
+const uint8_t CSymbolClasses::LETTER;
+const uint8_t CSymbolClasses::VALID;
+
+namespace {
+
+const std::string AsciiLetters = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+const std::string Digits = "0123456789";
+
+// Limits of symbols compared one by one in a block check
+const size_t MAX_PRINTABLE_REFUSED = 16;
+const size_t MAX_CONTROL_ALLOWED = 4;
+
+CSymbolClasses &currentClasses() {
+    static CSymbolClasses classes = CSymbolClasses::asciiLetters();
+    return classes;
+}
+
+}
+
+CSymbolClasses::CSymbolClasses(const std::string &letters, bool utf8_)
+    : utf8(utf8_)
+{
+    std::fill(classes, classes + 256, 0);
+    for (const char c: dictionaryLetters) {
+        classes[(unsigned char)c] |= ALLOWED | VALID;
+    }
+    for (const char c: letters) {
+        classes[(unsigned char)c] |= ALLOWED | VALID | LETTER;
+    }
+    // '$' is in the dictionary, but texts of the old format ending with it are still refused
+    classes[(unsigned char)'$'] &= ~VALID;
+    // Bytes of longer code points are checked as sequences, leading bytes go up to 0xF4
+    if (utf8) {
+        for (size_t symbol = 0x80; symbol <= 0xF4; ++symbol) {
+            classes[symbol] |= ALLOWED;
+        }
+    }
+
+    rangeCheckable = true;
+    for (size_t symbol = 0; symbol < 256; ++symbol) {
+        const bool allowed = (classes[symbol] & VALID) != 0;
+        if (symbol >= 0x20 && symbol < 0x7F) {
+            if (!allowed) {
+                printableRefused.push_back(symbol);
+            }
+        } else if (allowed) {
+            controlAllowed.push_back(symbol);
+            rangeCheckable = rangeCheckable && symbol < 0x80;
+        }
+    }
+    rangeCheckable = rangeCheckable && printableRefused.size() <= MAX_PRINTABLE_REFUSED
+                     && controlAllowed.size() <= MAX_CONTROL_ALLOWED;
+}
+
+CSymbolClasses CSymbolClasses::asciiLetters() {
+    return CSymbolClasses(AsciiLetters);
+}
+
+CSymbolClasses CSymbolClasses::alphanumerics() {
+    return CSymbolClasses(AsciiLetters + Digits);
+}
+
+CSymbolClasses CSymbolClasses::custom(const std::string &letters) {
+    if (letters.empty()) {
+        throw std::runtime_error("Letters of substrings are not given!");
+    }
+    // Distinct words and documents are separated by whitespace
+    for (const char c: letters) {
+        if (c == '$' || c == ' ' || (c >= '\t' && c <= '\r') || c == '\0') {
+            throw std::runtime_error("Whitespace and '$' can't be letters of substrings!");
+        }
+    }
+    return CSymbolClasses(letters);
+}
+
+CSymbolClasses CSymbolClasses::utf8Letters() {
+    return CSymbolClasses(AsciiLetters, true);
+}
+
+CSymbolClasses CSymbolClasses::parse(const std::string &name) {
+    const std::string customPrefix = "custom:";
+    if (name == "ascii") {
+        return asciiLetters();
+    }
+    if (name == "alnum") {
+        return alphanumerics();
+    }
+    if (name == "utf8") {
+        return utf8Letters();
+    }
+    if (name.compare(0, customPrefix.size(), customPrefix) == 0) {
+        return custom(name.substr(customPrefix.size()));
+    }
+    throw std::runtime_error("Letters have to be 'ascii', 'alnum', 'utf8' or 'custom:<letters>', not '" + name + "'");
+}
+
+bool CSymbolClasses::isLetterCodePoint(uint32_t codePoint) const {
+    if (codePoint < 0x80) {
+        return isLetter((char)codePoint);
+    }
+    return utf8 && isUnicodeLetter(codePoint);
+}
+
+size_t CSymbolClasses::decodeUtf8(const char *letters, size_t size, uint32_t &codePoint) {
+    const unsigned char lead = letters[0];
+    size_t length;
+    uint32_t minimal;
+    if (lead < 0x80) {
+        codePoint = lead;
+        return 1;
+    } else if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+        minimal = 0x80;
+        codePoint = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        minimal = 0x800;
+        codePoint = lead & 0x0F;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        minimal = 0x10000;
+        codePoint = lead & 0x07;
+    } else {
+        return 0;
+    }
+    if (size < length) {
+        return 0;
+    }
+    for (size_t index = 1; index < length; ++index) {
+        if (!isUtf8Continuation(letters[index])) {
+            return 0;
+        }
+        codePoint = (codePoint << 6) | ((unsigned char)letters[index] & 0x3F);
+    }
+    // Overlong forms, surrogates and code points past Unicode
+    if (codePoint < minimal || (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF) {
+        return 0;
+    }
+    return length;
+}
+
+size_t CSymbolClasses::completeUtf8(const char *letters, size_t size) {
+    // The last leading byte and the continuations after it
+    size_t lead = size;
+    while (lead > 0 && size - lead < 4 && isUtf8Continuation(letters[lead - 1])) {
+        --lead;
+    }
+    if (lead == 0) {
+        return size;
+    }
+    const unsigned char c = letters[lead - 1];
+    const size_t length = (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : (c >= 0xC0) ? 2 : 1;
+    return (size - (lead - 1) < length) ? lead - 1 : size;
+}
+
+bool CSymbolClasses::isAscii(const char *letters, size_t size) {
+    // 8 symbols at a time, high bits of all of them in one test
+    size_t position = 0;
+    for (; position + 8 <= size; position += 8) {
+        uint64_t word;
+        memcpy(&word, letters + position, sizeof(word));
+        if ((word & 0x8080808080808080ull) != 0) {
+            return false;
+        }
+    }
+    for (; position < size; ++position) {
+        if ((unsigned char)letters[position] >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Code points of several bytes of UTF-8 texts are decoded whole, the last one may pass the end
+size_t CSymbolClasses::findRefused(const char *letters, size_t position, size_t end, size_t size) const {
+    while (position < end) {
+        const unsigned char c = letters[position];
+        if ((classes[c] & VALID) != 0) {
+            ++position;
+            continue;
+        }
+        uint32_t codePoint;
+        const size_t length = (utf8 && c >= 0x80) ? decodeUtf8(letters + position, size - position, codePoint) : 0;
+        if (length == 0) {
+            return position;
+        }
+        position += length;
+    }
+    return position;
+}
+
+// Blocks of 16 symbols are checked to be printable ASCII, with comparisons to the few symbols
+// refused among them and allowed out of them, so the check keeps up with reading memory
+size_t CSymbolClasses::findRefusedInBlocks(const char *letters, size_t size) const {
+    size_t position = 0;
+#ifdef __SSE2__
+    if (rangeCheckable) {
+        __m128i refused[MAX_PRINTABLE_REFUSED];
+        __m128i allowed[MAX_CONTROL_ALLOWED];
+        for (size_t index = 0; index < printableRefused.size(); ++index) {
+            refused[index] = _mm_set1_epi8(printableRefused[index]);
+        }
+        for (size_t index = 0; index < controlAllowed.size(); ++index) {
+            allowed[index] = _mm_set1_epi8(controlAllowed[index]);
+        }
+        const __m128i belowSpace = _mm_set1_epi8(0x1F);
+        const __m128i delete_ = _mm_set1_epi8(0x7F);
+
+        while (position + 16 <= size) {
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(letters + position));
+            // Bytes above 0x7F are negative, so they are out of the range as well
+            __m128i good = _mm_and_si128(_mm_cmpgt_epi8(block, belowSpace), _mm_cmplt_epi8(block, delete_));
+            for (size_t index = 0; index < printableRefused.size(); ++index) {
+                good = _mm_andnot_si128(_mm_cmpeq_epi8(block, refused[index]), good);
+            }
+            for (size_t index = 0; index < controlAllowed.size(); ++index) {
+                good = _mm_or_si128(good, _mm_cmpeq_epi8(block, allowed[index]));
+            }
+            if (_mm_movemask_epi8(good) == 0xFFFF) {
+                position += 16;
+                continue;
+            }
+            // The table checks the block, code points of several bytes go on after it
+            const size_t next = findRefused(letters, position, position + 16, size);
+            if (next < position + 16) {
+                return next;
+            }
+            position = next;
+        }
+    }
+#endif
+    return findRefused(letters, position, size, size);
+}
+
+void CSymbolClasses::check(const char *letters, size_t size) const {
+    CStatsPhase phase("validate");
+    const size_t position = findRefusedInBlocks(letters, size);
+    if (position == size) {
+        return;
+    }
+    const char c = letters[position];
+    if (utf8 && (unsigned char)c >= 0x80) {
+        throw std::runtime_error("String has an invalid UTF-8 sequence at byte " + std::to_string(position) + "!");
+    }
+    if (c == '$') {
+        throw std::runtime_error("There must be no symbol '$' in a string! It ended texts of the old input format and is still refused.");
+    }
+    std::string errorString = "String contains a symbol '";
+    errorString += c;
+    errorString += "' which is not in dictionary!";
+    throw std::runtime_error(errorString);
+}
+
+const CSymbolClasses &symbolClasses() {
+    return currentClasses();
+}
+
+void setSymbolClasses(const CSymbolClasses &classes) {
+    currentClasses() = classes;
+}
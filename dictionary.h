@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Symbols a source string may consist of
+extern const std::string dictionaryLetters;
+
+//---------------------------------------------------
+// Classes of symbols: the dictionary a text is checked against and the letters
+// of counted substrings, every other symbol of the dictionary cuts substrings.
+// A table of 256 entries answers both in one lookup, the same in any locale.
+class CSymbolClasses {
+public:
+    // Letters are a-z and A-Z, the default
+    static CSymbolClasses asciiLetters();
+    // Letters are a-z, A-Z and 0-9
+    static CSymbolClasses alphanumerics();
+    // Letters are the symbols given, they join the dictionary.
+    // Whitespace separates words and '$' is refused in texts, they can't be letters.
+    static CSymbolClasses custom(const std::string &letters);
+    // Texts are UTF-8, every code point above 0x7F joins the dictionary.
+    // Letters are a-z, A-Z and Unicode letters and marks, lengths of substrings are in code points.
+    static CSymbolClasses utf8Letters();
+
+    // Classes of "ascii", "alnum", "utf8" or "custom:<letters>",
+    // throws std::runtime_error for anything else
+    static CSymbolClasses parse(const std::string &name);
+
+    // Symbols of the alphabet, bytes of longer code points of UTF-8 texts too
+    bool isAllowed(char c) const { return (classes[(unsigned char)c] & ALLOWED) != 0; }
+    // Letters of one byte, see isLetterCodePoint() for longer ones
+    bool isLetter(char c) const { return (classes[(unsigned char)c] & LETTER) != 0; }
+    bool isUtf8() const { return utf8; }
+    bool isLetterCodePoint(uint32_t codePoint) const;
+
+    // Checks that the string has only symbols of the dictionary, 16 of them at once where SSE2 is there,
+    // and that its code points are valid UTF-8 for utf8Letters().
+    // Throws std::runtime_error naming the first symbol out of it.
+    void check(const char *letters, size_t size) const;
+
+    // Length of the valid UTF-8 sequence the letters start with and its code point, 0 if it is not valid
+    static size_t decodeUtf8(const char *letters, size_t size, uint32_t &codePoint);
+    // Length of the letters without an incomplete UTF-8 sequence at their end
+    static size_t completeUtf8(const char *letters, size_t size);
+    // Whether there are only symbols below 0x80, then bytes are code points
+    static bool isAscii(const char *letters, size_t size);
+
+private:
+    // In the alphabet
+    static const uint8_t ALLOWED = 1;
+    static const uint8_t LETTER = 2;
+    // Allowed on its own: not '$', refused for compatibility, and not a byte of a longer UTF-8 code point
+    static const uint8_t VALID = 4;
+
+    uint8_t classes[256];
+    // Printable ASCII symbols out of the dictionary and allowed control ones,
+    // so that a range check and a few comparisons check a block of symbols.
+    // Dictionaries that don't fit it are checked by the table only.
+    std::vector<char> printableRefused;
+    std::vector<char> controlAllowed;
+    bool rangeCheckable = false;
+    bool utf8 = false;
+
+    explicit CSymbolClasses(const std::string &letters, bool utf8_ = false);
+
+    // Position of the first symbol out of the dictionary or invalid UTF-8 sequence from the position on,
+    // the end or the end of the code point passing it if there is none
+    size_t findRefused(const char *letters, size_t position, size_t end, size_t size) const;
+    size_t findRefusedInBlocks(const char *letters, size_t size) const;
+};
+
+// Bytes after the first one of a UTF-8 code point
+inline bool isUtf8Continuation(char c) {
+    return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+// Classes every engine checks and cuts texts by, ASCII letters unless set before building
+const CSymbolClasses &symbolClasses();
+void setSymbolClasses(const CSymbolClasses &classes);
+
+// Checks that the string has only symbols from the dictionary.
+// Symbol '$' is in the dictionary, but it is refused: it ended texts of the old input format,
+// so such texts fail the same way, though no engine appends a terminator any more.
+// Throws std::runtime_error otherwise.
+inline void checkDictionary(const char *letters, size_t size) {
+    symbolClasses().check(letters, size);
+}
+
+inline void checkDictionary(const std::string &sourceString) {
+    checkDictionary(sourceString.data(), sourceString.size());
+}
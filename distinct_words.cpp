@@ -0,0 +1,52 @@
+#include "distinct_words.h"
+#include "dictionary.h"
+#include "stats.h"
+
+#include <stdexcept>
+#include <unordered_map>
+
+// Splits the text into runs of letters and counts every distinct one
+CDistinctWords::CDistinctWords(const CText &sourceString)
+    : originalSize(sourceString.size())
+{
+    // Words are cut at bytes of non-letters
+    if (symbolClasses().isUtf8()) {
+        throw std::runtime_error("UTF-8 letters are counted by the suffix tree only, without distinct words!");
+    }
+    checkDictionary(sourceString.data(), sourceString.size());
+    CStatsPhase phase("distinct_words");
+
+    // Weighted counts are kept in 32 bits, the same as plain ones
+    if (sourceString.size() >= 0xFFFFFFFFu) {
+        throw std::runtime_error("String is too long for counting distinct words!");
+    }
+
+    // Word => its number
+    std::unordered_map<std::string, uint32_t> wordNumber;
+
+    const CSymbolClasses &classes = symbolClasses();
+    size_t index = 0;
+    while (index < sourceString.size()) {
+        if (!classes.isLetter(sourceString[index])) {
+            ++index;
+            continue;
+        }
+        size_t end = index;
+        while (end < sourceString.size() && classes.isLetter(sourceString[end])) {
+            ++end;
+        }
+
+        auto inserted = wordNumber.emplace(sourceString.substr(index, end - index), (uint32_t)weights.wordStart.size());
+        if (inserted.second) {
+            if (!text.empty()) {
+                text += ' ';
+            }
+            weights.wordStart.push_back(text.size());
+            weights.multiplicity.push_back(1);
+            text += inserted.first->first;
+        } else {
+            ++weights.multiplicity[ inserted.first->second ];
+        }
+        index = end;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "print.h"
+#include "text.h"
+#include "storage.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+// Weights of suffixes of a text made of distinct words:
+// a suffix starting in a word occurs as many times as the word occurs in the original text.
+// Without words every suffix weighs 1.
+struct CLeafWeights {
+    // Start of every word in the text, ascending
+    CStorage<uint32_t> wordStart;
+    // Number of occurrences of every word in the original text
+    CStorage<uint32_t> multiplicity;
+
+    bool empty() const { return wordStart.empty(); }
+
+    // Weight of the suffix starting at the position,
+    // separators after a word get its weight, but no counted substring starts there
+    BigInt at(BigInt position) const {
+        if (wordStart.empty()) {
+            return 1;
+        }
+        const auto word = std::upper_bound(wordStart.begin(), wordStart.end(), (uint32_t)position) - wordStart.begin();
+        return (word == 0) ? 1 : multiplicity[word - 1];
+    }
+};
+
+// Distinct words of a text.
+// Counted substrings never cross a non-letter, so a text of every distinct word written once
+// with weights of words gives the same counts as the original text.
+class CDistinctWords {
+public:
+    // Distinct words in the order of their first occurrence, separated by spaces
+    std::string text;
+    CLeafWeights weights;
+    // Length of the original text
+    size_t originalSize = 0;
+
+    // Splits the text into runs of letters and counts every distinct one.
+    // Checks the text like the engines do, throws std::runtime_error if it is wrong.
+    CDistinctWords(const CText &sourceString);
+};
@@ -0,0 +1,57 @@
+#include "letter_index.h"
+#include "dictionary.h"
+
+#include <algorithm>
+
+const size_t CLetterIndex::BLOCK_SIZE;
+const uint32_t CLetterIndex::NONE;
+
+// Blocks without a non-letter up to the end are at the end of nextNonLetter,
+// a non-letter appended is the next one of those of them starting before it
+void CLetterIndex::extend(const char *letters, size_t size) {
+    // Nothing is written when nothing is new, queries of a finished tree run in parallel
+    if (size == length) {
+        return;
+    }
+    const size_t blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    nonLetters.resize(blocks, 0);
+    nextNonLetter.resize(blocks, NONE);
+
+    const CSymbolClasses &classes = symbolClasses();
+    // Bytes of a code point of a UTF-8 text are letters if it is one
+    size_t sequenceEnd = 0;
+    bool sequenceLetter = false;
+    for (size_t position = length; position < size; ++position) {
+        if (classes.isLetter(letters[position])) {
+            continue;
+        }
+        if (classes.isUtf8() && (unsigned char)letters[position] >= 0x80) {
+            if (position >= sequenceEnd) {
+                // The text may start in the middle of a code point, e.g. at the start of a window
+                size_t lead = position;
+                while (lead > 0 && position - lead < 3 && isUtf8Continuation(letters[lead])) {
+                    --lead;
+                }
+                uint32_t codePoint;
+                const size_t sequenceLength = CSymbolClasses::decodeUtf8(letters + lead, size - lead, codePoint);
+                sequenceEnd = std::max(position + 1, lead + sequenceLength);
+                sequenceLetter = sequenceLength > position - lead && classes.isLetterCodePoint(codePoint);
+            }
+            if (sequenceLetter) {
+                continue;
+            }
+        }
+        const size_t block = position / BLOCK_SIZE;
+        nonLetters[block] |= (uint64_t)1 << (position % BLOCK_SIZE);
+        for (size_t previous = block + 1; previous > 0 && nextNonLetter[previous - 1] == NONE; --previous) {
+            nextNonLetter[previous - 1] = position;
+        }
+    }
+    length = size;
+}
+
+void CLetterIndex::clear() {
+    nonLetters.clear();
+    nextNonLetter.clear();
+    length = 0;
+}
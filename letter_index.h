@@ -0,0 +1,60 @@
+#pragma once
+
+#include "storage.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//---------------------------------------------------
+// Non-letters of a text, to tell how many letters follow a position in one lookup.
+// A bit per symbol marks non-letters, and for every block of 64 symbols
+// the first non-letter at its start or after it is kept: 0.19 bytes per symbol in all.
+// Letters are the ones of symbolClasses(), counted substrings never cross other symbols.
+class CLetterIndex {
+public:
+    // Indexes symbols of the text after the ones indexed already,
+    // the text is the same as before with more symbols at the end
+    void extend(const char *letters, size_t size);
+
+    // Forgets the text, e.g. when its beginning is erased
+    void clear();
+
+    // Number of letters from the position up to the next non-letter or the end of the text
+    size_t lettersFrom(size_t position) const {
+        if (position >= length) {
+            return 0;
+        }
+        const size_t block = position / BLOCK_SIZE;
+        const uint64_t following = nonLetters[block] >> (position % BLOCK_SIZE);
+        if (following != 0) {
+            return __builtin_ctzll(following);
+        }
+        const uint32_t next = (block + 1 < nextNonLetter.size()) ? nextNonLetter[block + 1] : NONE;
+        return ((next == NONE) ? length : next) - position;
+    }
+
+    size_t size() const { return length; }
+
+    // Arrays of the index, to be saved and viewed in place again
+    const CStorage<uint64_t> &nonLetterBits() const { return nonLetters; }
+    const CStorage<uint32_t> &blockNextNonLetters() const { return nextNonLetter; }
+    void view(const uint64_t *nonLetters_, const uint32_t *nextNonLetter_, size_t size_) {
+        nonLetters.view(nonLetters_, (size_ + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        nextNonLetter.view(nextNonLetter_, (size_ + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        length = size_;
+    }
+
+    size_t bytesUsed() const {
+        return nonLetters.capacity() * sizeof(uint64_t) + nextNonLetter.capacity() * sizeof(uint32_t);
+    }
+
+    static const size_t BLOCK_SIZE = 64;
+    // No non-letter up to the end of the text
+    static const uint32_t NONE = 0xFFFFFFFFu;
+
+private:
+    CStorage<uint64_t> nonLetters;
+    CStorage<uint32_t> nextNonLetter;
+    size_t length = 0;
+};
@@ -1,48 +1,614 @@
 #include "suffix_tree.h"
+#include "suffix_array.h"
+#include "sharded_counter.h"
+#include "partitioned_counter.h"
+#include "approximate_counter.h"
+#include "mapped_file.h"
+#include "tree_index.h"
+#include "query_server.h"
+#include "corpus.h"
+#include "dictionary.h"
+#include "stats.h"
 
-#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <chrono>
 #include <fstream>
-#include <climits>
+#include <memory>
+#include <sstream>
 #include <set>
 #include <string>
+#include <vector>
 
-// Increase stack size for recursizely walking suffix trees for bigger inputs
-void setStackLimit() {
-    // Really big number is needed to fit the recursion depth
-    const rlim_t kStackSize = INT_MAX - 7;
-    struct rlimit rl;
-    int result;
+void printUsage() {
+    std::cerr << "Usage:" << std::endl
+              << "./counter [--engine tree|array] [--threads N] [--dedup] [--window W] [--patterns P] <file to read>" << std::endl
+              << "  --engine  tree builds a suffix tree (default)," << std::endl
+              << "            array builds a suffix array, it is faster and takes about half the memory" << std::endl
+              << "  --threads cuts the text into N parts at non-letters and builds their suffix arrays in parallel," << std::endl
+              << "            with --engine tree given occurrences of the whole tree are counted by N threads" << std::endl
+              << "  --dedup   indexes every distinct word once with the number of its occurrences" << std::endl
+              << "  --window  streams the file ('-' for standard input) through a suffix tree of the last W characters," << std::endl
+              << "            top substrings of the window are printed every second and at the end" << std::endl
+              << "  --patterns prints numbers of occurrences of the patterns of file P, one pattern a line" << std::endl
+              << "./counter --memory M [--spill-dir D] <file to read>" << std::endl
+              << "  counts a file bigger than memory in partitions of suffixes by their first letters," << std::endl
+              << "  a suffix tree of every partition takes about M MB; the file is read in chunks, words of partitions" << std::endl
+              << "  are spilled into files under D (/tmp by default) and top substrings of partitions are merged exactly" << std::endl
+              << "./counter --approximate M <file to read | ->" << std::endl
+              << "  streams the file or the standard input through Space-Saving counters of about M MB:" << std::endl
+              << "  percentages of top substrings are never below true ones and are over by the error printed at most" << std::endl
+              << "./counter build [--threads N] [--dedup] <file to read> <index file>" << std::endl
+              << "  saves the suffix tree of the file with its occurrences into the index file" << std::endl
+              << "./counter query [--threads N] [--top N] [--min-length L] [--queries N:L,...] [--patterns P] <index file> [substring ...]" << std::endl
+              << "  maps the index file and prints top N substrings of L letters at least (10 and 4 by default)" << std::endl
+              << "  and numbers of occurrences of the substrings given and of the patterns of file P, nothing is built;" << std::endl
+              << "  --queries prints top N of L letters for every pair given, all of them found in one walk" << std::endl
+              << "./counter serve [--threads N] [--dedup] <file to read | index file> <socket path>" << std::endl
+              << "  loads the index file or builds the suffix tree of the file once and answers requests" << std::endl
+              << "  of N connections at a time on the Unix socket, see query_server.h for the protocol" << std::endl
+              << "./counter corpus [--threads N] [--top N] [--min-length L] [--by occurrences|documents] <file or directory> ..." << std::endl
+              << "  reads the files (N at a time) as documents of one suffix tree and prints top N substrings" << std::endl
+              << "  by occurrences or by numbers of documents they occur in, with both numbers" << std::endl
+              << "./counter client <socket path> [request ...]" << std::endl
+              << "  sends requests given or read from the standard input line by line and prints responses" << std::endl
+              << "./counter --letters ascii|alnum|utf8|custom:<letters> <any of the above without ./counter>" << std::endl
+              << "  counts substrings of a-z and A-Z (ascii, default), of digits as well (alnum) or of the letters given," << std::endl
+              << "  which join the dictionary; an index has to be queried with the letters it was built with." << std::endl
+              << "  utf8 reads UTF-8 texts with Unicode letters, lengths are in code points; the suffix tree counts them," << std::endl
+              << "  not --engine array, --threads parts, --dedup, --memory or --approximate" << std::endl
+              << "./counter --stats <any of the above without ./counter>" << std::endl
+              << "  prints wall and CPU time and RSS growth of every phase, peak RSS, numbers of nodes, edges and leaves" << std::endl
+              << "  and bytes per input character as JSON to the standard error at the end;" << std::endl
+              << "  a counter built with -DTREE_COUNTERS=ON adds events of building the suffix tree" << std::endl;
+}
+
+// Numbers of what was built, for --stats
+template <typename TEngine>
+void recordSizes(TEngine &engine, size_t inputBytes) {
+    runStats().setValue("input_bytes", inputBytes);
+    runStats().setValue("bytes_per_character", engine.bytesPerCharacter());
+}
+
+// Nodes of the tree are counted by a walk, only when they are printed
+void recordSizes(CSuffixTree &tree, size_t inputBytes) {
+    if (!runStats().isEnabled()) {
+        return;
+    }
+    const auto nodesAndLeaves = tree.nodesAndLeaves();
+    runStats().setValue("input_bytes", inputBytes);
+    runStats().setValue("nodes", nodesAndLeaves.first);
+    runStats().setValue("leaves", nodesAndLeaves.second);
+    runStats().setValue("edges", nodesAndLeaves.first - 1 + nodesAndLeaves.second);
+    runStats().setValue("bytes_per_character", tree.bytesPerCharacter());
+    tree.recordBuildCounters();
+}
+
+// Answers top queries one by one with engines not having a batch
+template <typename TEngine>
+std::vector<CTopAnswer> answerTopQueries(TEngine &engine, const std::vector<CTopQuery> &queries) {
+    std::vector<CTopAnswer> answers;
+    for (const auto &query: queries) {
+        answers.push_back({ engine.getTopSuitableSubstrings(query.takeTopN, query.minimalLength),
+                            engine.getNumbetOfSubstringsLongerThan(query.minimalLength) });
+    }
+    return answers;
+}
+
+// The tree answers all queries and counts their substrings in one walk
+std::vector<CTopAnswer> answerTopQueries(CSuffixTree &tree, const std::vector<CTopQuery> &queries) {
+    return tree.getTopSuitableSubstringsMany(queries);
+}
+
+// Prints answers to top queries
+void printTopAnswers(const std::vector<CTopQuery> &queries, const std::vector<CTopAnswer> &answers) {
+    for (size_t index = 0; index < queries.size(); ++index) {
+        const BigInt minimalLength = queries[index].minimalLength;
+        if (index > 0) {
+            std::cout << std::endl;
+        }
+        std::cout << "Performing computation of top " << queries[index].takeTopN << " substrings longer or equal to " << minimalLength << " by occurrence frequency." << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "Number of substrings longer or equal to " << minimalLength << " is: " << (double)answers[index].numberOfLongSubstrings << std::endl;
+        std::cout << std::endl;
+
+        prettyPrintFrequencyResults(answers[index].topN);
+    }
+}
+
+// Prints top substrings found by either of the engines
+template <typename TEngine>
+void printTopSubstrings(TEngine &engine, const std::vector<CTopQuery> &queries = { {10, 4} }) {
+    printTopAnswers(queries, answerTopQueries(engine, queries));
+}
+
+// Top queries given as N:L[,N:L...], empty if they are malformed
+std::vector<CTopQuery> parseTopQueries(const std::string &text) {
+    std::vector<CTopQuery> queries;
+    std::istringstream input(text);
+    std::string query;
+    while (std::getline(input, query, ',')) {
+        long long topNumber = 0;
+        long long minimalLength = 0;
+        char extra;
+        if (sscanf(query.c_str(), "%lld:%lld%c", &topNumber, &minimalLength, &extra) != 2 || topNumber < 1 || minimalLength < 1) {
+            return std::vector<CTopQuery>();
+        }
+        queries.push_back({ (size_t)topNumber, minimalLength });
+    }
+    return queries;
+}
+
+// Patterns of a file, one a line
+std::vector<std::string> readPatterns(const std::string &fileName) {
+    std::ifstream file(fileName);
+    if (!file) {
+        throw std::runtime_error("Couldn't open patterns file '" + fileName + "'");
+    }
+    std::vector<std::string> patterns;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty()) {
+            patterns.push_back(line);
+        }
+    }
+    return patterns;
+}
+
+// Counts patterns one by one with engines not having a batch
+template <typename TEngine>
+std::vector<BigInt> countPatterns(TEngine &engine, const std::vector<std::string> &patterns) {
+    std::vector<BigInt> counts;
+    for (const auto &pattern: patterns) {
+        counts.push_back(engine.count(pattern));
+    }
+    return counts;
+}
+
+std::vector<BigInt> countPatterns(CSuffixTree &tree, const std::vector<std::string> &patterns) {
+    return tree.countMany(patterns);
+}
+
+template <typename TEngine>
+void printPatternCounts(TEngine &engine, const std::vector<std::string> &patterns) {
+    if (patterns.empty()) {
+        return;
+    }
+    const auto counts = countPatterns(engine, patterns);
+    std::cout << std::endl;
+    for (size_t index = 0; index < patterns.size(); ++index) {
+        std::cout << "Substring '" << patterns[index] << "' occurs " << counts[index] << " times." << std::endl;
+    }
+}
+
+// Counts the file in partitions of suffix trees, each of them within the memory given
+int countInPartitions(const std::string &fileName, size_t memoryMegabytes, const std::string &spillDirectory) {
+    std::cout << "Reading file '" << fileName << "' in partitions of " << memoryMegabytes << " MB" << std::endl;
+    CPartitionedCounter counter(fileName, memoryMegabytes << 20, spillDirectory);
+    const std::vector<CTopQuery> queries = { {10, 4} };
+    const auto answers = counter.getTopSuitableSubstringsMany(queries);
+    std::cout << "Suffix trees of " << counter.partitionsNumber() << " partitions constructed." << std::endl;
+    std::cout << "The biggest suffix tree uses " << counter.bytesPerCharacter() << " bytes per input character." << std::endl;
+    if (counter.oversizedPartitions() > 0) {
+        std::cerr << "Warning: suffix trees of " << counter.oversizedPartitions() << " partitions took more than " << memoryMegabytes
+                  << " MB, their words or prefixes of the minimal length are too long to split further" << std::endl;
+    }
+    recordSizes(counter, counter.inputSize());
+    runStats().setValue("partitions", counter.partitionsNumber());
+    runStats().setValue("oversized_partitions", counter.oversizedPartitions());
+
+    printTopAnswers(queries, answers);
+    return 0;
+}
+
+// Streams the input through approximate counters within the memory given,
+// top substrings are printed with bounds of their percentages
+int countApproximately(const std::string &fileName, size_t memoryMegabytes) {
+    const int input = (fileName == "-") ? 0 : open(fileName.c_str(), O_RDONLY);
+    if (input < 0) {
+        std::cerr << "Couldn't open file '" << fileName << "'" << std::endl;
+        printUsage();
+        return 1;
+    }
+    const std::vector<CTopQuery> queries = { {10, 4} };
+    CApproximateCounter counter(CApproximateCounter::countersFor(memoryMegabytes << 20), queries[0].minimalLength);
+    std::cout << "Streaming file '" << fileName << "' through " << counter.countersNumber() << " approximate counters of "
+              << memoryMegabytes << " MB" << std::endl;
 
-    result = getrlimit(RLIMIT_STACK, &rl);
-    if (result == 0)
+    std::vector<char> buffer(1 << 16);
+    size_t charactersRead = 0;
+    ssize_t bytesRead;
     {
-        if (rl.rlim_cur < kStackSize)
-        {
-            rl.rlim_cur = kStackSize;
-            result = setrlimit(RLIMIT_STACK, &rl);
-            if (result != 0)
-            {
-                fprintf(stderr, "setrlimit returned result = %d\n", result);
-            }
+        CStatsPhase phase("approximate_count");
+        while ((bytesRead = read(input, buffer.data(), buffer.size())) > 0) {
+            counter.append(buffer.data(), bytesRead);
+            charactersRead += bytesRead;
         }
+        counter.finish();
+    }
+    if (input != 0) {
+        close(input);
+    }
+    if (bytesRead < 0) {
+        std::cerr << "Couldn't read file '" << fileName << "'" << std::endl;
+        return 1;
     }
+    std::cout << "Approximate counters use " << counter.bytesPerCharacter() << " bytes per input character." << std::endl;
+    recordSizes(counter, charactersRead);
+    runStats().setValue("maximal_error", counter.maximalError());
+
+    printTopSubstrings(counter, queries);
+
+    // A true count is from count - error to count
+    const BigInt total = counter.getNumbetOfSubstringsLongerThan(queries[0].minimalLength);
+    std::cout << std::endl << "Percentages are over by at most " << 100 * counter.maximalError() / (double)std::max((BigInt)1, total)
+              << "%, every substring above it is counted. Bounds of the top ones:" << std::endl;
+    for (const auto &entry: counter.getTopEntries(queries[0].takeTopN)) {
+        std::cout << "  " << entry.substring << ": from " << 100 * (entry.count - entry.error) / (double)total
+                  << "% to " << 100 * entry.count / (double)total << "%" << std::endl;
+    }
+    return 0;
 }
 
-void printUsage() {
-    std::cerr << "Usage:" << std::endl
-              << "./counter <file to read>" << std::endl;
+// Streams the input through a suffix tree of the last windowSize characters,
+// top substrings of the window are printed every second and at the end
+int streamWindow(const std::string &fileName, BigInt windowSize, int threadsNumber) {
+    const int input = (fileName == "-") ? 0 : open(fileName.c_str(), O_RDONLY);
+    if (input < 0) {
+        std::cerr << "Couldn't open file '" << fileName << "'" << std::endl;
+        printUsage();
+        return 1;
+    }
+    std::cout << "Streaming file '" << fileName << "' through a window of " << windowSize << " characters" << std::endl;
+
+    CSuffixTree tree("");
+    tree.setWindowSize(windowSize);
+    tree.setThreadsNumber(threadsNumber);
+    tree.buildTree();
+
+    auto printWindow = [&tree](BigInt charactersRead) {
+        std::cout << std::endl << "Window of the last " << tree.sourceString.size() - tree.windowStart
+                  << " of " << charactersRead << " characters read." << std::endl;
+        printTopSubstrings(tree);
+    };
+
+    // Whatever the input has at the moment is taken, so a pipe is reported on while it goes.
+    // A UTF-8 code point cut by a read waits for the rest of it.
+    std::vector<char> buffer(1 << 16);
+    std::string chunk;
+    BigInt charactersRead = 0;
+    auto lastReport = std::chrono::steady_clock::now();
+    ssize_t bytesRead;
+    while ((bytesRead = read(input, buffer.data(), buffer.size())) > 0) {
+        chunk.append(buffer.data(), bytesRead);
+        const size_t complete = symbolClasses().isUtf8() ? CSymbolClasses::completeUtf8(chunk.data(), chunk.size()) : chunk.size();
+        tree.append(chunk.substr(0, complete));
+        chunk.erase(0, complete);
+        charactersRead += bytesRead;
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now - lastReport >= std::chrono::seconds(1)) {
+            printWindow(charactersRead);
+            lastReport = now;
+        }
+    }
+    if (input != 0) {
+        close(input);
+    }
+    if (bytesRead < 0) {
+        std::cerr << "Couldn't read file '" << fileName << "'" << std::endl;
+        return 1;
+    }
+    // The input ends in the middle of a code point, it is refused
+    if (!chunk.empty()) {
+        tree.append(chunk);
+    }
+
+    printWindow(charactersRead);
+    recordSizes(tree, charactersRead);
+    return 0;
 }
 
-int main(int argc, char *argv[]) {
+// Builds the suffix tree of a file and saves it into an index file
+int buildIndex(int argc, char *argv[]) {
+    int threadsNumber = 1;
+    bool deduplicateWords = false;
+
+    int argIndex = 0;
+    while (argIndex + 2 < argc) {
+        const std::string option = argv[argIndex];
+        if (option == "--dedup") {
+            deduplicateWords = true;
+            argIndex += 1;
+        } else if (option == "--threads") {
+            threadsNumber = atoi(argv[argIndex + 1]);
+            argIndex += 2;
+        } else {
+            break;
+        }
+    }
+    if (argc != argIndex + 2 || threadsNumber < 1) {
+        printUsage();
+        return 1;
+    }
+    const std::string fileName = argv[argIndex];
+    const std::string indexFileName = argv[argIndex + 1];
+
+    if (access(fileName.c_str(), R_OK) != 0) {
+        std::cerr << "Couldn't open file '" << fileName << "'" << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    std::cout << "Reading file '" << fileName << "'" << std::endl;
+    CMappedFile file(fileName);
+    CText input = file.view();
+    CLeafWeights leafWeights;
+    if (deduplicateWords) {
+        CDistinctWords words(input);
+        std::cout << "Indexing " << words.weights.wordStart.size() << " distinct words, "
+                  << words.text.size() << " of " << words.originalSize << " characters." << std::endl;
+        input = std::move(words.text);
+        leafWeights = std::move(words.weights);
+    }
+
+    CSuffixTree tree( std::move(input), std::move(leafWeights) );
+    file.adviseNormal();
+    tree.setThreadsNumber( threadsNumber );
+    tree.buildTree( );
+    std::cout << "Suffix tree constructed." << std::endl;
+    recordSizes(tree, file.size());
+
+    tree.save( indexFileName );
+    std::cout << "Suffix tree saved into '" << indexFileName << "'." << std::endl;
+    return 0;
+}
+
+// Answers queries with a suffix tree read in place from an index file
+int queryIndex(int argc, char *argv[]) {
+    int threadsNumber = 1;
+    int topNumber = 10;
+    int minimalLength = 4;
+    std::vector<std::string> patterns;
+    std::vector<CTopQuery> queries;
+    bool queriesGiven = false;
+
+    int argIndex = 0;
+    while (argIndex + 2 < argc && strncmp(argv[argIndex], "--", 2) == 0) {
+        const std::string option = argv[argIndex];
+        const int value = atoi(argv[argIndex + 1]);
+        if (option == "--threads") {
+            threadsNumber = value;
+        } else if (option == "--top") {
+            topNumber = value;
+        } else if (option == "--min-length") {
+            minimalLength = value;
+        } else if (option == "--patterns") {
+            patterns = readPatterns(argv[argIndex + 1]);
+        } else if (option == "--queries") {
+            queries = parseTopQueries(argv[argIndex + 1]);
+            queriesGiven = true;
+        } else {
+            printUsage();
+            return 1;
+        }
+        argIndex += 2;
+    }
+    if (argIndex >= argc || threadsNumber < 1 || topNumber < 1 || minimalLength < 1 || (queriesGiven && queries.empty())) {
+        printUsage();
+        return 1;
+    }
+    const std::string indexFileName = argv[argIndex];
+
+    // Pages of the file are shared with other processes mapping it
+    CMappedFile indexFile(indexFileName);
+    CSuffixTree tree( indexFile );
+    indexFile.adviseNormal();
+    tree.setThreadsNumber( threadsNumber );
+    std::cout << "Suffix tree loaded from '" << indexFileName << "'." << std::endl;
+    recordSizes(tree, tree.sourceString.size());
+
+    if (!queriesGiven) {
+        queries.push_back({ (size_t)topNumber, minimalLength });
+    }
+    printTopSubstrings(tree, queries);
+
+    patterns.insert(patterns.begin(), argv + argIndex + 1, argv + argc);
+    printPatternCounts(tree, patterns);
+    return 0;
+}
+
+// Serves queries to a suffix tree over a Unix socket until a shutdown request
+int serveQueries(int argc, char *argv[]) {
+    int threadsNumber = 4;
+    bool deduplicateWords = false;
+
+    int argIndex = 0;
+    while (argIndex + 2 < argc) {
+        const std::string option = argv[argIndex];
+        if (option == "--dedup") {
+            deduplicateWords = true;
+            argIndex += 1;
+        } else if (option == "--threads") {
+            threadsNumber = atoi(argv[argIndex + 1]);
+            argIndex += 2;
+        } else {
+            break;
+        }
+    }
+    if (argc != argIndex + 2 || threadsNumber < 1) {
+        printUsage();
+        return 1;
+    }
+    const std::string fileName = argv[argIndex];
+    const std::string socketPath = argv[argIndex + 1];
+
+    if (access(fileName.c_str(), R_OK) != 0) {
+        std::cerr << "Couldn't open file '" << fileName << "'" << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    // Index files are told by their magic bytes, anything else is a text to build the tree of
+    CMappedFile file(fileName);
+    std::unique_ptr<CSuffixTree> tree;
+    if (file.size() >= sizeof(IndexMagic) && memcmp(file.data(), IndexMagic, sizeof(IndexMagic)) == 0) {
+        if (deduplicateWords) {
+            std::cerr << "Option --dedup is given to build an index, not to serve it" << std::endl;
+            return 1;
+        }
+        tree.reset(new CSuffixTree( file ));
+        file.adviseNormal();
+        std::cout << "Suffix tree loaded from '" << fileName << "'." << std::endl;
+    } else {
+        std::cout << "Reading file '" << fileName << "'" << std::endl;
+        CText input = file.view();
+        CLeafWeights leafWeights;
+        if (deduplicateWords) {
+            CDistinctWords words(input);
+            input = std::move(words.text);
+            leafWeights = std::move(words.weights);
+        }
+        tree.reset(new CSuffixTree( std::move(input), std::move(leafWeights) ));
+        file.adviseNormal();
+        tree->buildTree( );
+        std::cout << "Suffix tree constructed." << std::endl;
+    }
+    recordSizes(*tree, file.size());
+
+    CQueryServer server(*tree, socketPath, threadsNumber);
+    std::cout << "Serving queries on '" << socketPath << "' with " << threadsNumber << " threads." << std::endl;
+    server.run();
+
+    std::cout << "Served " << server.requestsNumber() << " requests, latency p50 " << server.latencyPercentile(0.5)
+              << " us, p99 " << server.latencyPercentile(0.99) << " us." << std::endl;
+    return 0;
+}
+
+// Indexes many files as documents of one suffix tree,
+// top substrings are ranked by occurrences or by numbers of documents
+int countCorpus(int argc, char *argv[]) {
+    int threadsNumber = 1;
+    int topNumber = 10;
+    int minimalLength = 4;
+    std::string metric = "occurrences";
+
+    int argIndex = 0;
+    while (argIndex + 2 < argc && strncmp(argv[argIndex], "--", 2) == 0) {
+        const std::string option = argv[argIndex];
+        const std::string value = argv[argIndex + 1];
+        if (option == "--threads") {
+            threadsNumber = atoi(value.c_str());
+        } else if (option == "--top") {
+            topNumber = atoi(value.c_str());
+        } else if (option == "--min-length") {
+            minimalLength = atoi(value.c_str());
+        } else if (option == "--by") {
+            metric = value;
+        } else {
+            printUsage();
+            return 1;
+        }
+        argIndex += 2;
+    }
+    if (argIndex >= argc || threadsNumber < 1 || topNumber < 1 || minimalLength < 1
+            || (metric != "occurrences" && metric != "documents")) {
+        printUsage();
+        return 1;
+    }
+
+    CCorpus corpus(std::vector<std::string>(argv + argIndex, argv + argc), threadsNumber);
+    std::cout << "Indexing " << corpus.fileNames.size() << " documents, " << corpus.text.size() << " characters." << std::endl;
+    const size_t inputBytes = corpus.text.size();
+
+    CSuffixTree tree( std::move(corpus.text) );
+    tree.setDocuments( std::move(corpus.documentStart) );
+    tree.setThreadsNumber( threadsNumber );
+    tree.buildTree( );
+    std::cout << "Suffix tree constructed." << std::endl;
+    recordSizes(tree, inputBytes);
+
+    const bool byDocuments = (metric == "documents");
+    std::cout << "Performing computation of top " << topNumber << " substrings longer or equal to " << minimalLength << " by " << metric << "." << std::endl;
+    std::cout << std::endl;
+    const auto answer = tree.getTopSuitableSubstringsMany({ {(size_t)topNumber, minimalLength, byDocuments} })[0];
+    std::cout << "Number of substrings longer or equal to " << minimalLength << " is: " << (double)answer.numberOfLongSubstrings << std::endl;
+    if (byDocuments) {
+        std::cout << "Percentages are of " << tree.documentsNumber() << " documents." << std::endl;
+    }
+    std::cout << std::endl;
+    prettyPrintFrequencyResults(answer.topN);
+
+    std::vector<std::string> substrings;
+    for (const auto &entry: answer.topN) {
+        substrings.push_back(entry.first);
+    }
+    const auto occurrences = tree.countMany(substrings);
+    const auto documents = tree.countDocuments(substrings);
+    std::cout << std::endl;
+    for (size_t index = 0; index < substrings.size(); ++index) {
+        std::cout << "Substring '" << substrings[index] << "' occurs " << occurrences[index] << " times in "
+                  << documents[index] << " documents." << std::endl;
+    }
+    return 0;
+}
+
+// Sends requests to a query server and prints its responses
+int askServer(int argc, char *argv[]) {
+    if (argc < 1) {
+        printUsage();
+        return 1;
+    }
+    std::vector<std::string> requests(argv + 1, argv + argc);
+    if (requests.empty()) {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            requests.push_back(line);
+        }
+    }
+
+    for (const auto &response: sendRequests(argv[0], requests)) {
+        std::cout << response << std::endl;
+    }
+    return 0;
+}
+
+// Runs the command or counts substrings of the file given
+int runCommand(int argc, char *argv[]) {
     try {
-        setStackLimit();
+        // Subcommands working with index files
+        if (argc >= 2 && strcmp(argv[1], "build") == 0) {
+            return buildIndex(argc - 2, argv + 2);
+        }
+        if (argc >= 2 && strcmp(argv[1], "query") == 0) {
+            return queryIndex(argc - 2, argv + 2);
+        }
+        if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+            return serveQueries(argc - 2, argv + 2);
+        }
+        if (argc >= 2 && strcmp(argv[1], "corpus") == 0) {
+            return countCorpus(argc - 2, argv + 2);
+        }
+        if (argc >= 2 && strcmp(argv[1], "client") == 0) {
+            return askServer(argc - 2, argv + 2);
+        }
 
         std::string fileName = "";
+        std::string engine = "tree";
+        bool engineGiven = false;
+        int threadsNumber = 1;
+        bool deduplicateWords = false;
+        BigInt windowSize = 0;
+        std::string patternsFileName;
+        size_t memoryMegabytes = 0;
+        size_t approximateMegabytes = 0;
+        std::string spillDirectory = "/tmp";
 
         if (argc >= 2) {
             const std::set<std::string> helpCommands = {"-h", "--help", "-help" };
@@ -52,38 +618,148 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        if (argc != 2) {
+        // Options go before the file name
+        int argIndex = 1;
+        while (argIndex + 1 < argc) {
+            const std::string option = argv[argIndex];
+            if (option == "--dedup") {
+                deduplicateWords = true;
+                argIndex += 1;
+                continue;
+            }
+
+            if (argIndex + 2 >= argc) {
+                printUsage();
+                return 1;
+            }
+            const std::string value = argv[argIndex + 1];
+            if (option == "--engine") {
+                engine = value;
+                engineGiven = true;
+            } else if (option == "--threads") {
+                threadsNumber = atoi(value.c_str());
+            } else if (option == "--patterns") {
+                patternsFileName = value;
+            } else if (option == "--memory") {
+                memoryMegabytes = atoll(value.c_str());
+                if (memoryMegabytes == 0) {
+                    printUsage();
+                    return 1;
+                }
+            } else if (option == "--approximate") {
+                approximateMegabytes = atoll(value.c_str());
+                if (approximateMegabytes == 0) {
+                    printUsage();
+                    return 1;
+                }
+            } else if (option == "--spill-dir") {
+                spillDirectory = value;
+            } else if (option == "--window") {
+                windowSize = atoll(value.c_str());
+                if (windowSize <= 0) {
+                    printUsage();
+                    return 1;
+                }
+            } else {
+                printUsage();
+                return 1;
+            }
+            argIndex += 2;
+        }
+
+        if (argc != argIndex + 1 || (engine != "tree" && engine != "array") || threadsNumber < 1) {
             printUsage();
             return 1;
         }
 
-        if (argc == 2) {
-            fileName = argv[1];
+        // Parts of the text are indexed with suffix arrays only, the tree is walked in parallel after building
+        if (threadsNumber > 1 && !(engineGiven && engine == "tree")) {
+            engine = "sharded";
         }
 
-        std::ifstream inFile(fileName);
-        if (inFile) {
-            std::cout << "Reading file '" << fileName << "'" << std::endl;
-            std::string input_string((std::istreambuf_iterator<char>(inFile)),
-                                      std::istreambuf_iterator<char>());
+        fileName = argv[argIndex];
 
-            CSuffixTree tree( std::move(input_string) );
-            tree.buildTree( );
-            std::cout << "Suffix tree constructed." << std::endl;
+        // Patterns may cross the cuts between parts
+        if (engine == "sharded" && !patternsFileName.empty()) {
+            std::cerr << "Option --patterns works with a single index, not with --threads parts" << std::endl;
+            return 1;
+        }
 
-            const int maximumTopNumber = 10;
-            const int minimalLength = 4;
+        // Counters are fed by chunks of the file or of the standard input
+        if (approximateMegabytes > 0) {
+            if (engineGiven || threadsNumber > 1 || deduplicateWords || windowSize > 0 || !patternsFileName.empty() || memoryMegabytes > 0) {
+                std::cerr << "Option --approximate works only without --engine, --threads, --dedup, --window, --patterns and --memory" << std::endl;
+                return 1;
+            }
+            return countApproximately(fileName, approximateMegabytes);
+        }
 
-            std::cout << "Performing computation of top " << maximumTopNumber << " substrings longer or equal to " << minimalLength << " by occurrence frequency." << std::endl;
-            std::cout << std::endl;
+        // Partitions are read from the file by chunks, never mapped whole
+        if (memoryMegabytes > 0) {
+            if (engineGiven || threadsNumber > 1 || deduplicateWords || windowSize > 0 || !patternsFileName.empty()) {
+                std::cerr << "Option --memory works only without --engine, --threads, --dedup, --window and --patterns" << std::endl;
+                return 1;
+            }
+            return countInPartitions(fileName, memoryMegabytes, spillDirectory);
+        }
 
-            auto topN = tree.getTopSuitableSubstrings(maximumTopNumber, minimalLength);
+        // Only the suffix tree can forget old suffixes
+        if (windowSize > 0) {
+            if (engine != "tree" || deduplicateWords || !patternsFileName.empty()) {
+                std::cerr << "Option --window works only with --engine tree and without --dedup and --patterns" << std::endl;
+                return 1;
+            }
+            return streamWindow(fileName, windowSize, threadsNumber);
+        }
 
-            double numberOfLongSubstrings = tree.getNumbetOfSubstringsLongerThan(minimalLength);
-            std::cout << "Number of substrings longer or equal to " << minimalLength << " is: " << numberOfLongSubstrings << std::endl;
-            std::cout << std::endl;
+        if (access(fileName.c_str(), R_OK) == 0) {
+            const std::vector<std::string> patterns = patternsFileName.empty() ? std::vector<std::string>() : readPatterns(patternsFileName);
+            std::cout << "Reading file '" << fileName << "'" << std::endl;
+            // Engines index the mapped file in place, it is never copied
+            CMappedFile file(fileName);
+            CText input = file.view();
 
-            prettyPrintFrequencyResults(topN);
+            // Words are counted in every part separately
+            CLeafWeights leafWeights;
+            if (deduplicateWords && engine != "sharded") {
+                CDistinctWords words(input);
+                std::cout << "Indexing " << words.weights.wordStart.size() << " distinct words, "
+                          << words.text.size() << " of " << words.originalSize << " characters." << std::endl;
+                input = std::move(words.text);
+                leafWeights = std::move(words.weights);
+            }
+
+            if (engine == "sharded") {
+                CShardedCounter counter( std::move(input), threadsNumber, deduplicateWords );
+                file.adviseNormal();
+                counter.buildShards( );
+                std::cout << "Suffix arrays of " << counter.shardsNumber() << " parts constructed." << std::endl;
+                std::cout << "Suffix arrays use " << counter.bytesPerCharacter() << " bytes per input character." << std::endl;
+                recordSizes(counter, file.size());
+
+                printTopSubstrings(counter);
+            } else if (engine == "array") {
+                CSuffixArray suffixArray( std::move(input), std::move(leafWeights) );
+                file.adviseNormal();
+                suffixArray.buildArray( );
+                std::cout << "Suffix array constructed." << std::endl;
+                std::cout << "Suffix array uses " << suffixArray.bytesPerCharacter() << " bytes per input character." << std::endl;
+                recordSizes(suffixArray, file.size());
+
+                printTopSubstrings(suffixArray);
+                printPatternCounts(suffixArray, patterns);
+            } else {
+                CSuffixTree tree( std::move(input), std::move(leafWeights) );
+                file.adviseNormal();
+                tree.setThreadsNumber( threadsNumber );
+                tree.buildTree( );
+                std::cout << "Suffix tree constructed." << std::endl;
+                std::cout << "Suffix tree uses " << tree.bytesPerCharacter() << " bytes per input character." << std::endl;
+                recordSizes(tree, file.size());
+
+                printTopSubstrings(tree);
+                printPatternCounts(tree, patterns);
+            }
 
             return 0;
         } else {
@@ -99,3 +775,34 @@ int main(int argc, char *argv[]) {
     }
     return 1;
 }
+
+int main(int argc, char *argv[]) {
+    // Options of every command go first: letters to check and cut texts by, statistics of the run
+    while (argc >= 2) {
+        int optionSize = 0;
+        if (argc >= 3 && strcmp(argv[1], "--letters") == 0) {
+            try {
+                setSymbolClasses(CSymbolClasses::parse(argv[2]));
+            } catch (std::exception &e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+            optionSize = 2;
+        } else if (strcmp(argv[1], "--stats") == 0) {
+            runStats().enable();
+            optionSize = 1;
+        } else {
+            break;
+        }
+        argv[optionSize] = argv[0];
+        argc -= optionSize;
+        argv += optionSize;
+    }
+
+    const int result = runCommand(argc, argv);
+    // Standard output keeps the results only
+    if (runStats().isEnabled()) {
+        std::cerr << runStats().toJson();
+    }
+    return result;
+}
@@ -0,0 +1,53 @@
+#include "mapped_file.h"
+#include "stats.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+CMappedFile::CMappedFile(const std::string &fileName)
+    : address(MAP_FAILED), letters(""), length(0)
+{
+    // Pages are read later, by the first pass over them
+    CStatsPhase phase("read");
+    const int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("Couldn't open file '" + fileName + "'");
+    }
+
+    struct stat status;
+    if (fstat(file, &status) != 0 || !S_ISREG(status.st_mode)) {
+        close(file);
+        throw std::runtime_error("Couldn't map file '" + fileName + "', it is not a regular file");
+    }
+
+    // Nothing to map in an empty file
+    length = status.st_size;
+    if (length > 0) {
+        address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+
+    if (length > 0) {
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("Couldn't map file '" + fileName + "'");
+        }
+        letters = static_cast<const char *>(address);
+        madvise(address, length, MADV_SEQUENTIAL);
+    }
+}
+
+CMappedFile::~CMappedFile() {
+    if (address != MAP_FAILED) {
+        munmap(address, length);
+    }
+}
+
+void CMappedFile::adviseNormal() const {
+    if (address != MAP_FAILED) {
+        madvise(address, length, MADV_NORMAL);
+    }
+}
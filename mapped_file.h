@@ -0,0 +1,34 @@
+#pragma once
+
+#include "text.h"
+
+#include <string>
+#include <cstddef>
+
+//---------------------------------------------------
+// Whole file mapped read-only into memory.
+// Engines index it in place through view(), so it has to outlive them.
+// Pages are read ahead sequentially until adviseNormal() is called,
+// the first pass over the text, checking its letters, goes from the start to the end.
+class CMappedFile {
+public:
+    // Throws std::runtime_error if the file can't be opened or mapped
+    explicit CMappedFile(const std::string &fileName);
+    ~CMappedFile();
+
+    CMappedFile(const CMappedFile &) = delete;
+    CMappedFile &operator=(const CMappedFile &) = delete;
+
+    const char *data() const { return letters; }
+    size_t size() const { return length; }
+
+    CText view() const { return CText(letters, length); }
+
+    // Engines walk the text in no particular order after the first pass
+    void adviseNormal() const;
+
+private:
+    void *address;
+    const char *letters;
+    size_t length;
+};
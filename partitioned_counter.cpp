@@ -0,0 +1,397 @@
+#include "partitioned_counter.h"
+#include "suffix_tree.h"
+#include "dictionary.h"
+#include "stats.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+const size_t CPartitionedCounter::SPILL_BYTE_COST;
+const size_t CPartitionedCounter::MAX_OPEN_FILES;
+const uint32_t CPartitionedCounter::NO_RANK;
+const uint32_t CPartitionedCounter::SPLIT_PREFIX;
+const uint32_t CPartitionedCounter::NO_PARTITION;
+const size_t CPartitionedCounter::CHUNK_SIZE;
+
+namespace {
+
+// Directory of spill files of one answer, deleted with the files left in it, e.g. after an error
+class CSpillDirectory {
+public:
+    explicit CSpillDirectory(const std::string &parent) {
+        std::string pattern = parent + "/substrings_counter_spill_XXXXXX";
+        if (mkdtemp(&pattern[0]) == nullptr) {
+            throw std::runtime_error("Couldn't make a directory for spill files in '" + parent + "'");
+        }
+        path = pattern;
+    }
+
+    ~CSpillDirectory() {
+        for (const auto &file: files) {
+            unlink(file.c_str());
+        }
+        rmdir(path.c_str());
+    }
+
+    CSpillDirectory(const CSpillDirectory &) = delete;
+    CSpillDirectory &operator=(const CSpillDirectory &) = delete;
+
+    std::string file(size_t number) {
+        files.push_back(path + "/" + std::to_string(number));
+        return files.back();
+    }
+
+private:
+    std::string path;
+    std::vector<std::string> files;
+};
+
+}
+
+CPartitionedCounter::CPartitionedCounter(const std::string &fileName_, size_t memoryBudget_, const std::string &spillDirectory_)
+    : fileName(fileName_), memoryBudget(memoryBudget_), spillDirectory(spillDirectory_), letterRank(256, NO_RANK)
+{
+    // Words are cut at bytes of non-letters
+    if (symbolClasses().isUtf8()) {
+        throw std::runtime_error("UTF-8 letters are counted by the suffix tree only, not in partitions!");
+    }
+    if (memoryBudget == 0) {
+        throw std::runtime_error("Memory for partitions has to be positive!");
+    }
+    for (size_t symbol = 0; symbol < 256; ++symbol) {
+        if (symbolClasses().isLetter((char)symbol)) {
+            letterRank[symbol] = lettersNumber++;
+        }
+    }
+}
+
+template <typename TVisitWord>
+void CPartitionedCounter::forEachWord(TVisitWord visit) {
+    std::ifstream input(fileName, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Couldn't open file '" + fileName + "'");
+    }
+    std::vector<char> buffer(CHUNK_SIZE);
+    // Letters of a word cut by the end of a chunk
+    std::string word;
+    fileSize = 0;
+    while (input.read(buffer.data(), buffer.size()) || input.gcount() > 0) {
+        const size_t size = input.gcount();
+        const char *chunk = buffer.data();
+        checkDictionary(chunk, size);
+        fileSize += size;
+
+        size_t begin = 0;
+        for (size_t index = 0; index < size; ++index) {
+            if (letterRank[(unsigned char)chunk[index]] != NO_RANK) {
+                continue;
+            }
+            if (!word.empty()) {
+                word.append(chunk + begin, index - begin);
+                visit(word.data(), word.size());
+                word.clear();
+            } else if (index > begin) {
+                visit(chunk + begin, index - begin);
+            }
+            begin = index + 1;
+        }
+        word.append(chunk + begin, size - begin);
+    }
+    if (!input.eof()) {
+        throw std::runtime_error("Couldn't read file '" + fileName + "'");
+    }
+    if (!word.empty()) {
+        visit(word.data(), word.size());
+    }
+}
+
+uint32_t CPartitionedCounter::partitionOfSuffix(const char *letters, size_t available) const {
+    if (available < prefixLength) {
+        return NO_PARTITION;
+    }
+    uint64_t code = prefixCode(letters);
+    uint32_t partition = partitionOf[code];
+    for (size_t length = prefixLength + 1; partition == SPLIT_PREFIX; ++length) {
+        if (length > available) {
+            return NO_PARTITION;
+        }
+        code = code * lettersNumber + letterRank[(unsigned char)letters[length - 1]];
+        const auto &partitions = longPrefixPartition[length - prefixLength - 1];
+        const auto found = partitions.find(code);
+        if (found == partitions.end()) {
+            return NO_PARTITION;
+        }
+        partition = found->second;
+    }
+    return partition;
+}
+
+void CPartitionedCounter::planPartitions(BigInt minimalLength) {
+    CStatsPhase phase("plan_partitions");
+    // The longest prefix of a minimal substring whose counters take an eighth of the budget at most
+    prefixLength = 1;
+    prefixesNumber = std::max(1u, lettersNumber);
+    while ((BigInt)prefixLength < minimalLength && (uint64_t)prefixesNumber * lettersNumber * sizeof(uint64_t) * 8 <= memoryBudget
+           && (uint64_t)prefixesNumber * lettersNumber < SPLIT_PREFIX) {
+        ++prefixLength;
+        prefixesNumber *= lettersNumber;
+    }
+
+    // Every word is spilled with its separator for every prefix it has, at most
+    std::vector<uint64_t> prefixBytes(prefixesNumber, 0);
+    forEachWord([&](const char *word, size_t size) {
+        for (size_t index = 0; index + prefixLength <= size; ++index) {
+            prefixBytes[prefixCode(word + index)] += size + 1;
+        }
+    });
+
+    // Prefixes fill partitions up to the budget in their order. A prefix bigger than it is split
+    // by its next letter while it is shorter than the minimal length and numbers of longer ones fit
+    // into 64 bits, otherwise it is a partition alone.
+    const uint64_t partitionBytes = std::max((size_t)1, memoryBudget / SPILL_BYTE_COST);
+    uint64_t bytes = 0;
+    partitionsCount = 0;
+    auto placePrefix = [&](uint64_t prefixBytes) -> uint32_t {
+        if (partitionsCount == 0 || (bytes > 0 && bytes + prefixBytes > partitionBytes)) {
+            ++partitionsCount;
+            bytes = 0;
+        }
+        bytes += prefixBytes;
+        return partitionsCount - 1;
+    };
+    uint64_t lengthPrefixes = prefixesNumber;
+    auto splits = [&](uint64_t prefixBytes, size_t length) {
+        return prefixBytes > partitionBytes && (BigInt)length < minimalLength
+               && lengthPrefixes <= std::numeric_limits<uint64_t>::max() / std::max(1u, lettersNumber);
+    };
+
+    bool anySplit = false;
+    partitionOf.assign(prefixesNumber, 0);
+    longPrefixPartition.clear();
+    for (uint32_t code = 0; code < prefixesNumber; ++code) {
+        if (splits(prefixBytes[code], prefixLength)) {
+            partitionOf[code] = SPLIT_PREFIX;
+            anySplit = true;
+        } else {
+            partitionOf[code] = placePrefix(prefixBytes[code]);
+        }
+    }
+    std::vector<uint64_t>().swap(prefixBytes);
+
+    // Every split takes a pass over the file summing words around the prefixes one letter longer
+    for (size_t length = prefixLength + 1; anySplit; ++length) {
+        std::map<uint64_t, uint64_t> longPrefixBytes;
+        forEachWord([&](const char *word, size_t size) {
+            for (size_t index = 0; index + length <= size; ++index) {
+                uint64_t code = prefixCode(word + index);
+                bool split = partitionOf[code] == SPLIT_PREFIX;
+                for (size_t known = prefixLength + 1; split && known < length; ++known) {
+                    code = code * lettersNumber + letterRank[(unsigned char)word[index + known - 1]];
+                    const auto found = longPrefixPartition[known - prefixLength - 1].find(code);
+                    split = found != longPrefixPartition[known - prefixLength - 1].end() && found->second == SPLIT_PREFIX;
+                }
+                if (split) {
+                    longPrefixBytes[code * lettersNumber + letterRank[(unsigned char)word[index + length - 1]]] += size + 1;
+                }
+            }
+        });
+
+        lengthPrefixes *= lettersNumber;
+        anySplit = false;
+        longPrefixPartition.emplace_back();
+        for (const auto &prefix: longPrefixBytes) {
+            if (splits(prefix.second, length)) {
+                longPrefixPartition.back()[prefix.first] = SPLIT_PREFIX;
+                anySplit = true;
+            } else {
+                longPrefixPartition.back()[prefix.first] = placePrefix(prefix.second);
+            }
+        }
+    }
+}
+
+void CPartitionedCounter::spillPartitions(size_t first, size_t last, const std::vector<std::string> &spillFiles) {
+    CStatsPhase phase("spill");
+    std::vector<std::unique_ptr<std::ofstream>> outputs;
+    for (size_t partition = first; partition < last; ++partition) {
+        outputs.emplace_back(new std::ofstream(spillFiles[partition], std::ios::binary));
+        if (!*outputs.back()) {
+            throw std::runtime_error("Couldn't write spill file '" + spillFiles[partition] + "'");
+        }
+    }
+
+    // Partitions the word is written to already, few of them for usual words
+    std::vector<uint32_t> written;
+    forEachWord([&](const char *word, size_t size) {
+        written.clear();
+        for (size_t index = 0; index + prefixLength <= size; ++index) {
+            const uint32_t partition = partitionOfSuffix(word + index, size - index);
+            if (partition == NO_PARTITION || partition < first || partition >= last || std::find(written.begin(), written.end(), partition) != written.end()) {
+                continue;
+            }
+            written.push_back(partition);
+            std::ofstream &output = *outputs[partition - first];
+            output.write(word, size);
+            output.put(' ');
+        }
+    });
+
+    for (size_t partition = first; partition < last; ++partition) {
+        outputs[partition - first]->close();
+        if (!*outputs[partition - first]) {
+            throw std::runtime_error("Couldn't write spill file '" + spillFiles[partition] + "'");
+        }
+    }
+}
+
+void CPartitionedCounter::countPartition(size_t partition, const std::string &spillFile, const std::vector<CTopQuery> &queries,
+                                         std::vector<std::vector<std::pair<std::string, BigInt>>> &candidates, std::vector<BigInt> &totals) {
+    std::string text;
+    CLeafWeights weights;
+    {
+        CStatsPhase phase("load_partition");
+        std::string spilled;
+        std::ifstream input(spillFile, std::ios::binary | std::ios::ate);
+        if (input) {
+            spilled.resize(input.tellg());
+            input.seekg(0);
+            input.read(&spilled[0], spilled.size());
+        }
+        if (!input) {
+            throw std::runtime_error("Couldn't read spill file '" + spillFile + "'");
+        }
+
+        // Every word is followed by a space
+        std::unordered_map<std::string, uint32_t> wordCount;
+        size_t begin = 0;
+        for (size_t end = spilled.find(' '); end != std::string::npos; begin = end + 1, end = spilled.find(' ', begin)) {
+            if (++wordCount[spilled.substr(begin, end - begin)] == 0) {
+                throw std::runtime_error("Word occurs too many times for counting in partitions!");
+            }
+        }
+        std::string().swap(spilled);
+
+        // Suffixes of the partition weigh as many as their word occurs, the others weigh nothing.
+        // The separator after a word gets the weight of its last suffix, but no counted substring starts there.
+        for (const auto &counted: wordCount) {
+            const std::string &letters = counted.first;
+            for (size_t index = 0; index < letters.size(); ++index) {
+                const uint32_t weight = (partitionOfSuffix(letters.data() + index, letters.size() - index) == partition) ? counted.second : 0;
+                if (weights.wordStart.empty() || weights.multiplicity.back() != weight) {
+                    weights.wordStart.push_back(text.size() + index);
+                    weights.multiplicity.push_back(weight);
+                }
+            }
+            text += letters;
+            text += ' ';
+        }
+    }
+
+    const size_t textSize = text.size();
+    CSuffixTree tree(std::move(text), std::move(weights));
+    tree.buildTree();
+    const size_t treeBytes = tree.bytesPerCharacter() * textSize;
+    biggestTreeBytes = std::max(biggestTreeBytes, treeBytes);
+    if (treeBytes > memoryBudget) {
+        ++oversizedCount;
+    }
+
+    // Substrings out of the partition have no weight, they can only be at the end of a top list
+    auto answers = tree.getTopSuitableSubstringsMany(queries);
+    for (size_t query = 0; query < queries.size(); ++query) {
+        totals[query] += answers[query].numberOfLongSubstrings;
+        const size_t takeTopN = queries[query].takeTopN;
+        CFrequencyInfo topN = std::move(answers[query].topN);
+        std::vector<BigInt> counts;
+        for (const auto &substring: topN) {
+            counts.push_back(tree.count(substring.first));
+        }
+
+        // Ties of the N-th substring are cut in the order of the tree, the merge orders them by letters,
+        // so the top is taken twice as long until it has all of them
+        CTopQuery widened = queries[query];
+        while (takeTopN > 0 && counts.size() >= widened.takeTopN && counts[takeTopN - 1] > 0 && counts.back() == counts[takeTopN - 1]) {
+            widened.takeTopN *= 2;
+            topN = tree.getTopSuitableSubstringsMany({ widened })[0].topN;
+            counts.clear();
+            for (const auto &substring: topN) {
+                counts.push_back(tree.count(substring.first));
+            }
+        }
+
+        for (size_t index = 0; index < topN.size(); ++index) {
+            if (counts[index] > 0) {
+                candidates[query].emplace_back(topN[index].first, counts[index]);
+            }
+        }
+    }
+}
+
+std::vector<CTopAnswer> CPartitionedCounter::getTopSuitableSubstringsMany(const std::vector<CTopQuery> &queries) {
+    BigInt minimalLength = 0;
+    for (const auto &query: queries) {
+        if (query.byDocuments) {
+            throw std::runtime_error("Partitions of a file have no documents!");
+        }
+        minimalLength = (minimalLength == 0) ? query.minimalLength : std::min(minimalLength, query.minimalLength);
+    }
+    planPartitions(minimalLength);
+    biggestTreeBytes = 0;
+    oversizedCount = 0;
+
+    std::vector<std::vector<std::pair<std::string, BigInt>>> candidates(queries.size());
+    std::vector<BigInt> totals(queries.size(), 0);
+    CSpillDirectory directory(spillDirectory);
+    std::vector<std::string> spillFiles;
+    for (size_t partition = 0; partition < partitionsNumber(); ++partition) {
+        spillFiles.push_back(directory.file(partition));
+    }
+
+    // A pass over the file spills as many partitions as there can be open files
+    for (size_t first = 0; first < partitionsNumber(); first += MAX_OPEN_FILES) {
+        const size_t last = std::min(partitionsNumber(), first + MAX_OPEN_FILES);
+        spillPartitions(first, last, spillFiles);
+        for (size_t partition = first; partition < last; ++partition) {
+            countPartition(partition, spillFiles[partition], queries, candidates, totals);
+            unlink(spillFiles[partition].c_str());
+        }
+    }
+
+    // More occurrences go first, equal ones in lexicographical order
+    std::vector<CTopAnswer> answers;
+    for (size_t query = 0; query < queries.size(); ++query) {
+        auto &counted = candidates[query];
+        std::sort(counted.begin(), counted.end(), [](const std::pair<std::string, BigInt> &a, const std::pair<std::string, BigInt> &b) {
+            return a.second > b.second || (a.second == b.second && a.first < b.first);
+        });
+        CTopAnswer answer = { CFrequencyInfo(), totals[query] };
+        for (const auto &substring: counted) {
+            if (queries[query].takeTopN > 0 && answer.topN.size() >= queries[query].takeTopN) {
+                break;
+            }
+            answer.topN.emplace_back(substring.first, 100 * substring.second / (double)totals[query]);
+        }
+        answers.push_back(std::move(answer));
+    }
+    return answers;
+}
+
+CFrequencyInfo CPartitionedCounter::getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength) {
+    return getTopSuitableSubstringsMany({ {takeTopN, minimalLength} })[0].topN;
+}
+
+BigInt CPartitionedCounter::getNumbetOfSubstringsLongerThan(BigInt minimalLength) {
+    return getTopSuitableSubstringsMany({ {1, minimalLength} })[0].numberOfLongSubstrings;
+}
+
+// Memory of the biggest tree of partitions per input character
+double CPartitionedCounter::bytesPerCharacter() const {
+    return biggestTreeBytes / (double)std::max((size_t)1, fileSize);
+}
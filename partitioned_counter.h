@@ -0,0 +1,111 @@
+#pragma once
+
+#include "print.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+
+//---------------------------------------------------
+// Counter of substrings of a file bigger than memory, within a budget of memory.
+//
+// Counted substrings never cross a non-letter, and one of L letters at least starts with
+// its first k <= L letters, so suffixes are partitioned by their first k letters:
+//   1. The file is read once to sum words around every prefix, ranges of prefixes
+//      whose words fit into the budget become partitions. A prefix whose words don't fit
+//      is split by its next letter, reading the file again, until it fits or has L letters.
+//   2. The file is read again, every word goes into the spill files of the partitions
+//      of its prefixes, once for each of them.
+//   3. Every partition is read back as distinct words and a suffix tree of them is built,
+//      where only suffixes starting with the prefixes of the partition weigh.
+//      Its top N substrings with their counts and its number of long substrings are kept,
+//      the tree and the spill file are deleted before the next partition.
+// A substring is counted in the partition of its first letters only, so the top N of all
+// partitions with the substrings tied with their N-th one contain the top N of the file
+// and numbers of long substrings add up: answers are exact.
+// Words go whole into partitions, so a partition of a word or a prefix of L letters too big
+// for the budget can't be made smaller, such partitions are counted by oversizedPartitions().
+class CPartitionedCounter {
+public:
+    // Nothing is read until queries come, every answer reads the file again
+    CPartitionedCounter(const std::string &fileName_, size_t memoryBudget_, const std::string &spillDirectory_);
+
+    // Answers of all queries, found with the same partitions.
+    // Substrings of equal counts go in lexicographical order.
+    std::vector<CTopAnswer> getTopSuitableSubstringsMany(const std::vector<CTopQuery> &queries);
+
+    // Get top N substrings by occurrence frequency
+    CFrequencyInfo getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength);
+
+    // Get number of substrings longer than given minimalLength
+    BigInt getNumbetOfSubstringsLongerThan(BigInt minimalLength);
+
+    // Partitions of the last answer and memory of the biggest of their trees per input character
+    size_t partitionsNumber() const { return partitionsCount; }
+    double bytesPerCharacter() const;
+    // Partitions of the last answer whose trees took more memory than the budget
+    size_t oversizedPartitions() const { return oversizedCount; }
+    size_t inputSize() const { return fileSize; }
+
+    // Memory taken by a partition per byte of its words, before duplicates are counted once
+    static const size_t SPILL_BYTE_COST = 40;
+    // Spill files written in one pass over the file
+    static const size_t MAX_OPEN_FILES = 256;
+
+private:
+    std::string fileName;
+    size_t memoryBudget;
+    std::string spillDirectory;
+    size_t fileSize = 0;
+
+    // Rank of every letter in the order of symbols, NO_RANK for other symbols
+    std::vector<uint32_t> letterRank;
+    uint32_t lettersNumber = 0;
+    // Letters partitions are made by, and the number of their combinations
+    size_t prefixLength = 0;
+    uint32_t prefixesNumber = 0;
+    // Partition of every prefix, SPLIT_PREFIX for a prefix split by its next letters
+    std::vector<uint32_t> partitionOf;
+    // Partitions of longer prefixes of split ones by their numbers, for every letter after prefixLength,
+    // SPLIT_PREFIX for those split further
+    std::vector<std::unordered_map<uint64_t, uint32_t>> longPrefixPartition;
+    size_t partitionsCount = 0;
+    size_t biggestTreeBytes = 0;
+    size_t oversizedCount = 0;
+
+    static const uint32_t NO_RANK = 0xFFFFFFFFu;
+    static const uint32_t SPLIT_PREFIX = 0xFFFFFFFEu;
+    // Partition of a suffix too short for any counted substring
+    static const uint32_t NO_PARTITION = 0xFFFFFFFFu;
+    // Symbols read at once
+    static const size_t CHUNK_SIZE = 1 << 20;
+
+    // Calls visit(word, size) for every run of letters of the file, reading it by chunks.
+    // Checks the file like the engines do, throws std::runtime_error if it is wrong.
+    template <typename TVisitWord>
+    void forEachWord(TVisitWord visit);
+
+    // Number of the first prefixLength letters in lexicographical order
+    uint32_t prefixCode(const char *letters) const {
+        uint32_t code = 0;
+        for (size_t index = 0; index < prefixLength; ++index) {
+            code = code * lettersNumber + letterRank[(unsigned char)letters[index]];
+        }
+        return code;
+    }
+
+    // Partition of the suffix of the letters available, NO_PARTITION if it is shorter than its prefix
+    uint32_t partitionOfSuffix(const char *letters, size_t available) const;
+
+    // Chooses the prefix length for the minimal length of substrings and makes partitions
+    void planPartitions(BigInt minimalLength);
+
+    // Writes words of the partitions from the first one up to the last one into their spill files
+    void spillPartitions(size_t first, size_t last, const std::vector<std::string> &spillFiles);
+
+    // Answers the queries over the partition, its substrings go to candidates with their counts
+    void countPartition(size_t partition, const std::string &spillFile, const std::vector<CTopQuery> &queries,
+                        std::vector<std::vector<std::pair<std::string, BigInt>>> &candidates, std::vector<BigInt> &totals);
+};
@@ -8,6 +8,15 @@
 
 const double epsilon = 1e-12;
 
+// Columns a substring takes, a column per code point of UTF-8
+static size_t columnsOf(const std::string &text) {
+    size_t columns = 0;
+    for (const char c: text) {
+        columns += ((unsigned char)c & 0xC0) != 0x80;
+    }
+    return columns;
+}
+
 void prettyPrintFrequencyResults(CFrequencyInfo topN) {
 
     if ( topN.empty() ) {
@@ -24,7 +33,7 @@ void prettyPrintFrequencyResults(CFrequencyInfo topN) {
     size_t idColumnWidth = std::max((size_t)4, idHeader.length());
     size_t textColumnWidth = std::max((size_t)4, substringHeader.length());
     for (auto p : topN)
-        textColumnWidth = std::max(textColumnWidth, p.first.length());
+        textColumnWidth = std::max(textColumnWidth, columnsOf(p.first));
     size_t numberColumnWidth = std::max((size_t)30, percentageHeader.length());
 
     // Write one separator line in table
@@ -57,7 +66,7 @@ void prettyPrintFrequencyResults(CFrequencyInfo topN) {
 
             std::cout << std::setfill(' ');
             std::cout << "|" << std::setw(idColumnWidth) << std::right << index
-                      << "|" << std::setw(textColumnWidth) << std::right << p.first
+                      << "|" << std::string(textColumnWidth - columnsOf(p.first), ' ') << p.first
                       << "|" << std::setw(numberColumnWidth) << std::right
                              //<< std::setprecision(numberColumnWidth - 6)
                              << p.second << "%" << "|"
@@ -3,8 +3,29 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <sys/types.h>
+
+typedef ssize_t BigInt;
 
 typedef std::vector<std::pair<std::string, double>> CFrequencyInfo;
 
+// Top N substrings of minimalLength letters at least, one of queries answered together
+struct CTopQuery {
+    // Brace initialization without the last fields, by occurrences if byDocuments isn't given
+    CTopQuery(size_t takeTopN_ = 0, BigInt minimalLength_ = 0, bool byDocuments_ = false)
+        : takeTopN(takeTopN_), minimalLength(minimalLength_), byDocuments(byDocuments_) {}
+
+    size_t takeTopN;
+    BigInt minimalLength;
+    // Ranked by numbers of documents they occur in instead of occurrences, percentages are of documents
+    bool byDocuments;
+};
+
+// Answer to a CTopQuery with the number of substrings its percentages are of
+struct CTopAnswer {
+    CFrequencyInfo topN;
+    BigInt numberOfLongSubstrings;
+};
+
 // Prints CFrequencyInfo as a table ans as a bar chart
 void prettyPrintFrequencyResults(CFrequencyInfo topN);
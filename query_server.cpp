@@ -0,0 +1,450 @@
+#include "query_server.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+const size_t CQueryServer::LATENCY_WINDOW;
+
+namespace {
+
+// Longer request lines are refused and their connection is closed
+const size_t MAX_REQUEST_SIZE = 1 << 20;
+
+// Value of a field of a request, numbers and literals are kept as written
+struct CJsonValue {
+    bool isString;
+    std::string text;
+};
+
+// Reads a flat JSON object, the only kind of requests there is.
+// Throws std::runtime_error on anything else.
+class CJsonReader {
+public:
+    explicit CJsonReader(const std::string &text_) : text(text_) {}
+
+    std::map<std::string, CJsonValue> readObject() {
+        std::map<std::string, CJsonValue> fields;
+        expect('{');
+        skipSpaces();
+        if (peek() == '}') {
+            ++position;
+        } else {
+            while (true) {
+                skipSpaces();
+                const std::string name = readString();
+                expect(':');
+                fields[name] = readValue();
+                skipSpaces();
+                if (peek() == '}') {
+                    ++position;
+                    break;
+                }
+                expect(',');
+            }
+        }
+        skipSpaces();
+        if (position != text.size()) {
+            throw std::runtime_error("unexpected text after the request");
+        }
+        return fields;
+    }
+
+private:
+    const std::string &text;
+    size_t position = 0;
+
+    char peek() const {
+        return (position < text.size()) ? text[position] : '\0';
+    }
+
+    void skipSpaces() {
+        while (position < text.size() && strchr(" \t\r\n", text[position]) != nullptr) {
+            ++position;
+        }
+    }
+
+    void expect(char symbol) {
+        skipSpaces();
+        if (peek() != symbol) {
+            throw std::runtime_error(std::string("'") + symbol + "' expected at position " + std::to_string(position));
+        }
+        ++position;
+    }
+
+    CJsonValue readValue() {
+        skipSpaces();
+        if (peek() == '"') {
+            return CJsonValue{true, readString()};
+        }
+        // Numbers, true, false and null
+        const size_t begin = position;
+        while (position < text.size() && (isalnum((unsigned char)text[position]) || strchr("+-.", text[position]) != nullptr)) {
+            ++position;
+        }
+        if (position == begin) {
+            throw std::runtime_error("value expected at position " + std::to_string(position));
+        }
+        return CJsonValue{false, text.substr(begin, position - begin)};
+    }
+
+    std::string readString() {
+        expect('"');
+        std::string result;
+        while (true) {
+            if (position >= text.size()) {
+                throw std::runtime_error("unterminated string");
+            }
+            const char symbol = text[position++];
+            if (symbol == '"') {
+                return result;
+            }
+            if (symbol != '\\') {
+                result += symbol;
+                continue;
+            }
+            const char escaped = peek();
+            ++position;
+            switch (escaped) {
+                case '"': case '\\': case '/': result += escaped; break;
+                case 'b': result += '\b'; break;
+                case 'f': result += '\f'; break;
+                case 'n': result += '\n'; break;
+                case 'r': result += '\r'; break;
+                case 't': result += '\t'; break;
+                case 'u': {
+                    // Texts are indexed by bytes, so only codes of single bytes make sense
+                    if (position + 4 > text.size()) {
+                        throw std::runtime_error("bad escape in a string");
+                    }
+                    const std::string digits = text.substr(position, 4);
+                    char *end = nullptr;
+                    const long code = strtol(digits.c_str(), &end, 16);
+                    if (end != digits.c_str() + 4 || code > 0xFF) {
+                        throw std::runtime_error("only \\u0000 to \\u00ff escapes are supported");
+                    }
+                    result += (char)code;
+                    position += 4;
+                    break;
+                }
+                default:
+                    throw std::runtime_error("bad escape in a string");
+            }
+        }
+    }
+};
+
+std::string quoteJson(const std::string &text) {
+    std::string result = "\"";
+    for (const char symbol: text) {
+        switch (symbol) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:
+                // Other control symbols and bytes above ASCII are escaped as they are, so the line stays valid JSON
+                if ((unsigned char)symbol < 0x20 || (unsigned char)symbol >= 0x80) {
+                    const char *hex = "0123456789abcdef";
+                    result += "\\u00";
+                    result += hex[(unsigned char)symbol >> 4];
+                    result += hex[(unsigned char)symbol & 0xF];
+                } else {
+                    result += symbol;
+                }
+        }
+    }
+    return result + "\"";
+}
+
+// Positive integer field of a request, or the default one if it is not given
+BigInt integerField(const std::map<std::string, CJsonValue> &fields, const std::string &name, BigInt defaultValue) {
+    const auto field = fields.find(name);
+    if (field == fields.end()) {
+        return defaultValue;
+    }
+    char *end = nullptr;
+    const long long value = strtoll(field->second.text.c_str(), &end, 10);
+    if (field->second.isString || field->second.text.empty() || *end != '\0' || value < 1) {
+        throw std::runtime_error("'" + name + "' must be a positive integer");
+    }
+    return value;
+}
+
+// Sends all of the data, false if the connection is closed
+bool sendAll(int connection, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        // A client gone doesn't stop the server with SIGPIPE
+        const ssize_t result = send(connection, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+sockaddr_un socketAddress(const std::string &socketPath) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path '" + socketPath + "' is empty or too long");
+    }
+    memcpy(address.sun_path, socketPath.data(), socketPath.size());
+    return address;
+}
+
+}
+
+//---------------------------------------------------
+//---------  CQueryServer Implementation  -----------
+//---------------------------------------------------
+
+CQueryServer::CQueryServer(CSuffixTree &tree_, const std::string &socketPath_, size_t threadsNumber)
+    : tree(tree_), socketPath(socketPath_), listener(-1), pool(threadsNumber), stopping(false)
+{
+    // After this queries only read the tree, so they run in parallel.
+    // Requests are what runs in parallel, walks of the tree can't share its workers.
+    tree.refreshOccurrences();
+    tree.setThreadsNumber(1);
+    latencies.reserve(LATENCY_WINDOW);
+
+    const sockaddr_un address = socketAddress(socketPath);
+    // A socket of a server gone is replaced, other files are not touched
+    struct stat status;
+    if (lstat(socketPath.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(socketPath.c_str());
+    }
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw std::runtime_error("Couldn't create a socket");
+    }
+    if (bind(listener, (const sockaddr *)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        close(listener);
+        throw std::runtime_error("Couldn't listen on socket '" + socketPath + "'");
+    }
+}
+
+CQueryServer::~CQueryServer() {
+    close(listener);
+    unlink(socketPath.c_str());
+}
+
+// Accepts connections until a shutdown request, waits for open connections to close
+void CQueryServer::run() {
+    while (true) {
+        const int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            if (stopping) {
+                break;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            throw std::runtime_error("Couldn't accept a connection on socket '" + socketPath + "'");
+        }
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            if (stopping) {
+                close(connection);
+                break;
+            }
+            connections.insert(connection);
+        }
+        pool.run([this, connection]() { serveConnection(connection); });
+    }
+    pool.wait();
+}
+
+// Stops accepting and ends reading of open connections, answers being sent are finished
+void CQueryServer::stop() {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    stopping = true;
+    shutdown(listener, SHUT_RDWR);
+    for (const int connection: connections) {
+        shutdown(connection, SHUT_RD);
+    }
+}
+
+// Answers requests of a connection until it is closed
+void CQueryServer::serveConnection(int connection) {
+    std::string buffer;
+    char chunk[1 << 12];
+    bool open = true;
+    while (open) {
+        const ssize_t received = recv(connection, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        buffer.append(chunk, received);
+
+        size_t lineBegin = 0;
+        size_t lineEnd;
+        while (open && (lineEnd = buffer.find('\n', lineBegin)) != std::string::npos) {
+            const auto start = std::chrono::steady_clock::now();
+            const std::string request = buffer.substr(lineBegin, lineEnd - lineBegin);
+            lineBegin = lineEnd + 1;
+            if (request.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            open = sendAll(connection, answer(request) + "\n");
+            recordLatency(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+        buffer.erase(0, lineBegin);
+
+        if (open && buffer.size() > MAX_REQUEST_SIZE) {
+            sendAll(connection, "{\"ok\": false, \"error\": \"request is too long\"}\n");
+            open = false;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connections.erase(connection);
+    }
+    close(connection);
+}
+
+// Response to a request line
+std::string CQueryServer::answer(const std::string &request) {
+    std::ostringstream response;
+    try {
+        const auto fields = CJsonReader(request).readObject();
+        const auto query = fields.find("query");
+        if (query == fields.end() || !query->second.isString) {
+            throw std::runtime_error("'query' string expected");
+        }
+
+        response << "{\"ok\": true";
+        if (query->second.text == "top") {
+            const BigInt topNumber = integerField(fields, "n", 10);
+            const BigInt minimalLength = integerField(fields, "min_length", 4);
+            response.precision(10);
+            response << ", \"substrings\": [";
+            bool first = true;
+            for (const auto &entry: tree.getTopSuitableSubstrings(topNumber, minimalLength)) {
+                response << (first ? "" : ", ") << "{\"substring\": " << quoteJson(entry.first)
+                         << ", \"count\": " << tree.count(entry.first) << ", \"percentage\": " << entry.second << "}";
+                first = false;
+            }
+            response << "]";
+        } else if (query->second.text == "count") {
+            const auto substring = fields.find("substring");
+            if (substring == fields.end() || !substring->second.isString) {
+                throw std::runtime_error("'substring' string expected");
+            }
+            response << ", \"count\": " << tree.count(substring->second.text);
+        } else if (query->second.text == "total") {
+            const BigInt minimalLength = integerField(fields, "min_length", 4);
+            response << ", \"total\": " << tree.getNumbetOfSubstringsLongerThan(minimalLength);
+        } else if (query->second.text == "stats") {
+            response << ", \"requests\": " << requestsNumber()
+                     << ", \"p50_us\": " << std::lround(latencyPercentile(0.5))
+                     << ", \"p99_us\": " << std::lround(latencyPercentile(0.99));
+        } else if (query->second.text == "shutdown") {
+            stop();
+        } else {
+            throw std::runtime_error("unknown query " + quoteJson(query->second.text));
+        }
+        response << "}";
+        return response.str();
+    } catch (std::exception &e) {
+        return "{\"ok\": false, \"error\": " + quoteJson(e.what()) + "}";
+    }
+}
+
+void CQueryServer::recordLatency(double microseconds) {
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    if (latencies.size() < LATENCY_WINDOW) {
+        latencies.push_back(microseconds);
+    } else {
+        latencies[answeredRequests % LATENCY_WINDOW] = microseconds;
+    }
+    ++answeredRequests;
+}
+
+size_t CQueryServer::requestsNumber() {
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    return answeredRequests;
+}
+
+// Nearest rank percentile of the latencies kept, 0 before any request
+double CQueryServer::latencyPercentile(double percentile) {
+    std::vector<double> sorted;
+    {
+        std::lock_guard<std::mutex> lock(latencyMutex);
+        sorted = latencies;
+    }
+    if (sorted.empty()) {
+        return 0;
+    }
+    const size_t rank = std::min(sorted.size(), (size_t)std::max(1.0, std::ceil(percentile * sorted.size())));
+    std::nth_element(sorted.begin(), sorted.begin() + rank - 1, sorted.end());
+    return sorted[rank - 1];
+}
+
+// Stand-in client: sends request lines over one connection and returns the response lines
+std::vector<std::string> sendRequests(const std::string &socketPath, const std::vector<std::string> &requests) {
+    const sockaddr_un address = socketAddress(socketPath);
+    const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, (const sockaddr *)&address, sizeof(address)) != 0) {
+        if (connection >= 0) {
+            close(connection);
+        }
+        throw std::runtime_error("Couldn't connect to socket '" + socketPath + "'");
+    }
+
+    // Every request waits for its response, like a client measuring latencies would
+    std::vector<std::string> responses;
+    std::string buffer;
+    char chunk[1 << 12];
+    for (const auto &request: requests) {
+        if (!sendAll(connection, request + "\n")) {
+            break;
+        }
+        size_t lineEnd;
+        while ((lineEnd = buffer.find('\n')) == std::string::npos) {
+            const ssize_t received = recv(connection, chunk, sizeof(chunk), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                break;
+            }
+            buffer.append(chunk, received);
+        }
+        if (lineEnd == std::string::npos) {
+            break;
+        }
+        responses.push_back(buffer.substr(0, lineEnd));
+        buffer.erase(0, lineEnd + 1);
+    }
+    close(connection);
+
+    if (responses.size() < requests.size()) {
+        throw std::runtime_error("Server on socket '" + socketPath + "' closed the connection");
+    }
+    return responses;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "suffix_tree.h"
+#include "thread_pool.h"
+
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <atomic>
+
+//---------------------------------------------------
+// Server answering queries to a suffix tree over a Unix domain socket.
+// Every request is a line of JSON and gets a line of JSON back:
+//   {"query": "top", "n": 10, "min_length": 4}
+//       => {"ok": true, "substrings": [{"substring": "abcd", "count": 12, "percentage": 1.5}, ...]}
+//   {"query": "count", "substring": "abcd"}   => {"ok": true, "count": 12}
+//   {"query": "total", "min_length": 4}       => {"ok": true, "total": 800}
+//   {"query": "stats"}                        => {"ok": true, "requests": 10, "p50_us": 15, "p99_us": 80}
+//   {"query": "shutdown"}                     => {"ok": true}, then the server stops
+// A wrong request gets {"ok": false, "error": "..."}.
+//
+// Connections are served by a pool of threads, requests of a connection are answered in order.
+// Occurrences are counted before serving, after that queries only read the tree.
+// Every request walks the tree in the thread serving it, the tree is left without workers of its own.
+class CQueryServer {
+public:
+    // Listens on the socket path, a file left there is replaced
+    CQueryServer(CSuffixTree &tree_, const std::string &socketPath_, size_t threadsNumber);
+    ~CQueryServer();
+
+    CQueryServer(const CQueryServer &) = delete;
+    CQueryServer &operator=(const CQueryServer &) = delete;
+
+    // Accepts connections until a shutdown request, waits for open connections to close
+    void run();
+
+    // Makes run() return, what a shutdown request does
+    void stop();
+
+    // Response to a request line
+    std::string answer(const std::string &request);
+
+    // Latencies of the last requests answered, in microseconds
+    size_t requestsNumber();
+    double latencyPercentile(double percentile);
+
+    // Latencies of this many last requests are kept
+    static const size_t LATENCY_WINDOW = 65536;
+
+private:
+    CSuffixTree &tree;
+    std::string socketPath;
+    int listener;
+    CThreadPool pool;
+    std::atomic<bool> stopping;
+
+    // Connections being served, their reading is ended by stop()
+    std::mutex connectionsMutex;
+    std::set<int> connections;
+
+    std::mutex latencyMutex;
+    std::vector<double> latencies;
+    size_t answeredRequests = 0;
+
+    // Answers requests of a connection until it is closed
+    void serveConnection(int connection);
+    void recordLatency(double microseconds);
+};
+
+// Stand-in client: sends request lines over one connection and returns the response lines.
+// Throws std::runtime_error if the server can't be reached.
+std::vector<std::string> sendRequests(const std::string &socketPath, const std::vector<std::string> &requests);
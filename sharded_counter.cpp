@@ -0,0 +1,246 @@
+#include "sharded_counter.h"
+#include "dictionary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+using std::vector;
+using std::string;
+
+namespace {
+
+// Substring of a shard, kept by its position instead of a copy of its letters
+struct CCandidate {
+    uint32_t shard;
+    uint32_t position;
+    uint32_t length;
+    // Sum of counts of the shards reporting it
+    BigInt count;
+    uint32_t shardsReporting;
+};
+
+// Letters of a substring found in one shard or another
+struct CLetters {
+    const char *letters;
+    size_t length;
+
+    bool operator==(const CLetters &other) const {
+        return length == other.length && memcmp(letters, other.letters, length) == 0;
+    }
+};
+
+// FNV-1a of the letters
+struct CLettersHash {
+    size_t operator()(const CLetters &key) const {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t index = 0; index < key.length; ++index) {
+            hash = (hash ^ (unsigned char)key.letters[index]) * 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+}
+
+// Cuts the string into threadsNumber shards at non-letter symbols
+CShardedCounter::CShardedCounter(CText sourceString_, size_t threadsNumber, bool deduplicateWords_)
+    : pool(threadsNumber), deduplicateWords(deduplicateWords_), sourceString(std::move(sourceString_))
+{
+    const size_t size = sourceString.size();
+    const size_t shardsNumber = pool.size();
+
+    size_t begin = 0;
+    for (size_t shard = 0; shard < shardsNumber && begin < size; ++shard) {
+        size_t end = std::max(begin, size * (shard + 1) / shardsNumber);
+        // Move the cut to a non-letter, so no counted substring is cut
+        while (end < size && symbolClasses().isLetter(sourceString[end])) {
+            ++end;
+        }
+        if (end > begin) {
+            shardStrings.emplace_back(sourceString.data() + begin, end - begin);
+        }
+        begin = end;
+    }
+}
+
+// Runs task(shardIndex) for every shard on the pool and waits for all of them
+template <typename TTask>
+void CShardedCounter::forEachShard(TTask task) {
+    for (size_t shard = 0; shard < shardStrings.size(); ++shard) {
+        pool.run([&task, shard]() { task(shard); });
+    }
+    pool.wait();
+}
+
+// Builds suffix arrays of all shards in parallel
+void CShardedCounter::buildShards() {
+    shards.resize(shardStrings.size());
+    forEachShard([this](size_t shard) {
+        if (deduplicateWords) {
+            CDistinctWords words(shardStrings[shard]);
+            shards[shard].reset(new CSuffixArray( std::move(words.text), std::move(words.weights) ));
+        } else {
+            shards[shard].reset(new CSuffixArray( std::move(shardStrings[shard]) ));
+        }
+        shards[shard]->buildArray();
+    });
+}
+
+// Memory used by all shards per input character
+double CShardedCounter::bytesPerCharacter() const {
+    double bytes = 0;
+    size_t size = 0;
+    for (const auto &shard: shards) {
+        bytes += shard->bytesPerCharacter() * (shard->sourceString.size() + 1);
+        size += shard->sourceString.size();
+    }
+    return bytes / std::max((size_t)1, size);
+}
+
+// Get number of substrings longer than given minimalLength
+BigInt CShardedCounter::getNumbetOfSubstringsLongerThan(BigInt minimalLength) {
+    vector<BigInt> counts(shards.size());
+    forEachShard([&](size_t shard) {
+        counts[shard] = shards[shard]->getNumbetOfSubstringsLongerThan(minimalLength);
+    });
+
+    BigInt count = 0;
+    for (auto shardCount: counts) {
+        count += shardCount;
+    }
+    return count;
+}
+
+// Get top N substrings by occurrence frequency with minimal length more or equal to minimalLength
+CFrequencyInfo CShardedCounter::getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength) {
+    if (shards.empty()) {
+        return CFrequencyInfo();
+    }
+
+    // Letters of a substring of a shard
+    auto letters = [this](uint32_t shard, uint32_t position) {
+        return shards[shard]->sourceString.data() + position;
+    };
+
+    // Threshold of the total count every top substring reaches
+    BigInt threshold = 1;
+    if (takeTopN > 0) {
+        vector<vector<CSubstringGroup>> shardTops(shards.size());
+        forEachShard([&](size_t shard) {
+            shardTops[shard] = shards[shard]->getTopGroups(takeTopN, minimalLength);
+        });
+
+        std::unordered_map<string, BigInt> lowerBounds;
+        for (size_t shard = 0; shard < shards.size(); ++shard) {
+            for (const auto &group: shardTops[shard]) {
+                for (uint32_t length = group.fromLength; length <= group.toLength; ++length) {
+                    lowerBounds[string(letters(shard, group.position), length)] += group.count;
+                }
+            }
+        }
+
+        // With less than N substrings reported every shard has reported all its substrings
+        if (lowerBounds.size() >= takeTopN) {
+            vector<BigInt> bounds;
+            bounds.reserve(lowerBounds.size());
+            for (const auto &bound: lowerBounds) {
+                bounds.push_back(bound.second);
+            }
+            std::nth_element(bounds.begin(), bounds.begin() + (takeTopN - 1), bounds.end(), std::greater<BigInt>());
+            threshold = bounds[takeTopN - 1];
+        }
+    }
+
+    // Candidates reach threshold / shards at least in one shard
+    const BigInt shardThreshold = std::max((BigInt)1, (threshold + (BigInt)shards.size() - 1) / (BigInt)shards.size());
+    vector<vector<CSubstringGroup>> shardGroups(shards.size());
+    forEachShard([&](size_t shard) {
+        shardGroups[shard] = shards[shard]->getFrequentGroups(shardThreshold, minimalLength);
+    });
+
+    // Candidates stay positions in the first shard reporting them, counts of all reporting shards are summed.
+    // A substring is in one group of a shard at most.
+    vector<CCandidate> candidates;
+    vector<vector<uint32_t>> reportedBy(shards.size());
+    {
+        std::unordered_map<CLetters, uint32_t, CLettersHash> candidateOf;
+        for (uint32_t shard = 0; shard < shards.size(); ++shard) {
+            for (const auto &group: shardGroups[shard]) {
+                for (uint32_t length = group.fromLength; length <= group.toLength; ++length) {
+                    const auto inserted = candidateOf.emplace(CLetters{ letters(shard, group.position), length }, (uint32_t)candidates.size());
+                    if (inserted.second) {
+                        candidates.push_back({ shard, group.position, length, 0, 0 });
+                    }
+                    CCandidate &candidate = candidates[inserted.first->second];
+                    candidate.count += group.count;
+                    ++candidate.shardsReporting;
+                    reportedBy[shard].push_back(inserted.first->second);
+                }
+            }
+            vector<CSubstringGroup>().swap(shardGroups[shard]);
+        }
+    }
+
+    // A shard not reporting a candidate has less than shardThreshold of it, candidates not reaching
+    // the threshold even so are dropped before they are counted
+    vector<uint32_t> recounted;
+    for (uint32_t index = 0; index < candidates.size(); ++index) {
+        const CCandidate &candidate = candidates[index];
+        if (candidate.count + (BigInt)(shards.size() - candidate.shardsReporting) * (shardThreshold - 1) >= threshold) {
+            recounted.push_back(index);
+        }
+    }
+
+    // Exact counts of the candidates in the shards not reporting them
+    vector<vector<BigInt>> shardCounts(shards.size());
+    forEachShard([&](size_t shard) {
+        vector<bool> reported(candidates.size(), false);
+        for (auto index: reportedBy[shard]) {
+            reported[index] = true;
+        }
+        vector<uint32_t>().swap(reportedBy[shard]);
+        shardCounts[shard].reserve(recounted.size());
+        for (auto index: recounted) {
+            const CCandidate &candidate = candidates[index];
+            shardCounts[shard].push_back(reported[index] ? 0 : shards[shard]->count(string(letters(candidate.shard, candidate.position), candidate.length)));
+        }
+    });
+
+    vector<std::pair<BigInt, const CCandidate *>> counted;
+    for (size_t index = 0; index < recounted.size(); ++index) {
+        const CCandidate &candidate = candidates[recounted[index]];
+        BigInt count = candidate.count;
+        for (const auto &counts: shardCounts) {
+            count += counts[index];
+        }
+        if (count >= threshold) {
+            counted.emplace_back(count, &candidate);
+        }
+    }
+
+    // More occurrences go first, equal ones in lexicographical order
+    auto lettersLess = [&letters](const CCandidate *a, const CCandidate *b) {
+        const int order = memcmp(letters(a->shard, a->position), letters(b->shard, b->position), std::min(a->length, b->length));
+        return order < 0 || (order == 0 && a->length < b->length);
+    };
+    std::sort(counted.begin(), counted.end(), [&lettersLess](const std::pair<BigInt, const CCandidate *> &a, const std::pair<BigInt, const CCandidate *> &b) {
+        return a.first > b.first || (a.first == b.first && lettersLess(a.second, b.second));
+    });
+
+    CFrequencyInfo topN;
+
+    // Number of all substrings of appropriate length in the text
+    double numberOfLongSubstrings = getNumbetOfSubstringsLongerThan(minimalLength);
+
+    for (const auto &substring: counted) {
+        const CCandidate &candidate = *substring.second;
+        topN.emplace_back(string(letters(candidate.shard, candidate.position), candidate.length), 100 * substring.first / numberOfLongSubstrings);
+
+        // If we have enough data in topN, quit
+        if ( (takeTopN > 0) && (topN.size() >= takeTopN) ) {
+            break;
+        }
+    }
+    return topN;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "print.h"
+#include "suffix_array.h"
+#include "thread_pool.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+
+//---------------------------------------------------
+// Counter of substrings over several suffix arrays built in parallel.
+//
+// Counted substrings never cross a non-letter symbol, so the text is cut
+// into shards at non-letters and every shard is indexed on its own.
+// The count of a substring is the sum of its counts in the shards.
+//
+// Top N is merged exactly in three rounds:
+//   1. Top N of every shard give lower bounds of total counts,
+//      the N-th best lower bound is a threshold every top substring reaches.
+//   2. A substring reaching the threshold in total reaches threshold / shards
+//      in at least one shard, such substrings of all shards are the candidates.
+//   3. Exact counts of the candidates are summed over all shards.
+// Candidates are positions in a shard reporting them, every distinct one is kept once with
+// the counts of the shards reporting it. A shard not reporting it has less than threshold / shards,
+// so a candidate not reaching the threshold even with that is dropped before it is counted
+// in the other shards. With many shards threshold / shards comes down to 1, then the worst case
+// is every distinct substring of the text as a candidate, about 40 bytes each.
+class CShardedCounter {
+public:
+    // Cuts the string into threadsNumber shards, they are built with buildShards().
+    // Shards view the string, so no letter is copied.
+    // With deduplicateWords every shard indexes its distinct words only.
+    CShardedCounter(CText, size_t threadsNumber, bool deduplicateWords_ = false);
+
+    // Builds suffix arrays of all shards in parallel
+    void buildShards();
+
+    // Memory used by all shards per input character
+    double bytesPerCharacter() const;
+
+    // Get top N substrings by occurrence frequency
+    CFrequencyInfo getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength);
+
+    // Get number of substrings longer than given minimalLength
+    BigInt getNumbetOfSubstringsLongerThan(BigInt minimalLength);
+
+    size_t shardsNumber() const { return shardStrings.size(); }
+
+private:
+    CThreadPool pool;
+    bool deduplicateWords;
+    // The whole string and views of its shards, given to suffix arrays by buildShards()
+    CText sourceString;
+    std::vector<CText> shardStrings;
+    std::vector<std::unique_ptr<CSuffixArray>> shards;
+
+    // Runs task(shardIndex) for every shard on the pool and waits for all of them
+    template <typename TTask>
+    void forEachShard(TTask task);
+};
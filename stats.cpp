@@ -0,0 +1,157 @@
+#include "stats.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// Whole numbers are printed exactly, others with 6 significant digits
+void writeNumber(std::ostream &output, double value) {
+    if (value == std::floor(value) && std::fabs(value) < 9007199254740992.0) {
+        output << (long long)value;
+    } else {
+        output << value;
+    }
+}
+
+}
+
+void CRunStats::enable() {
+    enabled = true;
+    start = std::chrono::steady_clock::now();
+}
+
+void CRunStats::addPhase(const char *name, double wallSeconds, double cpuSeconds, long rssGrowthKb) {
+    const long peakRss = peakRssKb();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &phase: phases) {
+        if (phase.name == name) {
+            ++phase.calls;
+            phase.wallSeconds += wallSeconds;
+            phase.cpuSeconds += cpuSeconds;
+            phase.rssGrowthKb += rssGrowthKb;
+            phase.processPeakRssKb = peakRss;
+            return;
+        }
+    }
+    phases.push_back({name, 1, wallSeconds, cpuSeconds, rssGrowthKb, peakRss});
+}
+
+void CRunStats::setValue(const std::string &name, double value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &nameValue: values) {
+        if (nameValue.first == name) {
+            nameValue.second = value;
+            return;
+        }
+    }
+    values.emplace_back(name, value);
+}
+
+void CRunStats::setHistogram(const std::string &name, const std::vector<uint64_t> &counts) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &nameCounts: histograms) {
+        if (nameCounts.first == name) {
+            nameCounts.second = counts;
+            return;
+        }
+    }
+    histograms.emplace_back(name, counts);
+}
+
+double CRunStats::phaseSeconds(const std::string &name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &phase: phases) {
+        if (phase.name == name) {
+            return phase.wallSeconds;
+        }
+    }
+    return 0;
+}
+
+void CRunStats::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    phases.clear();
+    values.clear();
+    histograms.clear();
+}
+
+std::string CRunStats::toJson() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream output;
+    output << "{" << std::endl << "  \"phases\": [";
+    for (size_t index = 0; index < phases.size(); ++index) {
+        const CPhase &phase = phases[index];
+        output << (index > 0 ? "," : "") << std::endl
+               << "    {\"name\": \"" << phase.name << "\", \"calls\": " << phase.calls
+               << ", \"wall_s\": " << phase.wallSeconds << ", \"cpu_s\": " << phase.cpuSeconds
+               << ", \"rss_growth_kb\": " << phase.rssGrowthKb << ", \"process_peak_rss_kb\": " << phase.processPeakRssKb << "}";
+    }
+    output << std::endl << "  ]";
+    for (const auto &nameValue: values) {
+        output << "," << std::endl << "  \"" << nameValue.first << "\": ";
+        writeNumber(output, nameValue.second);
+    }
+    for (const auto &nameCounts: histograms) {
+        output << "," << std::endl << "  \"" << nameCounts.first << "\": [";
+        for (size_t index = 0; index < nameCounts.second.size(); ++index) {
+            output << (index > 0 ? ", " : "") << nameCounts.second[index];
+        }
+        output << "]";
+    }
+    const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    output << "," << std::endl << "  \"wall_s\": " << wallSeconds
+           << "," << std::endl << "  \"cpu_s\": " << cpuSeconds()
+           << "," << std::endl << "  \"peak_rss_kb\": " << peakRssKb()
+           << std::endl << "}" << std::endl;
+    return output.str();
+}
+
+double CRunStats::cpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Resident pages are the second number of /proc/self/statm, 0 where there is none
+long CRunStats::currentRssKb() {
+    std::ifstream statm("/proc/self/statm");
+    long totalPages = 0;
+    long residentPages = 0;
+    if (!(statm >> totalPages >> residentPages)) {
+        return 0;
+    }
+    return residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+long CRunStats::peakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+CRunStats &runStats() {
+    static CRunStats stats;
+    return stats;
+}
+
+CStatsPhase::CStatsPhase(const char *name_)
+    : name(name_), recording(runStats().isEnabled())
+{
+    if (recording) {
+        wallStart = std::chrono::steady_clock::now();
+        cpuStart = CRunStats::cpuSeconds();
+        rssStart = CRunStats::currentRssKb();
+    }
+}
+
+CStatsPhase::~CStatsPhase() {
+    if (recording) {
+        const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        runStats().addPhase(name, wallSeconds, CRunStats::cpuSeconds() - cpuStart, CRunStats::currentRssKb() - rssStart);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+//---------------------------------------------------
+// Wall time, CPU time and RSS growth of the phases of a run, with numbers of what was built.
+// Nothing is recorded unless enabled, e.g. by --stats, a phase costs a flag test then.
+// Phases of the same name add up, e.g. of every chunk appended, and so do phases run
+// by several threads at once, e.g. building suffix arrays of parts.
+class CRunStats {
+public:
+    void enable();
+    bool isEnabled() const { return enabled; }
+
+    // RSS growth is the current RSS at the end of the phase less the one at its start,
+    // memory taken and freed within the phase is not in it
+    void addPhase(const char *name, double wallSeconds, double cpuSeconds, long rssGrowthKb);
+    // Numbers are kept in the order they were first set
+    void setValue(const std::string &name, double value);
+    // Arrays of counts, printed after the numbers
+    void setHistogram(const std::string &name, const std::vector<uint64_t> &counts);
+
+    // Wall time of the phases of the name so far, 0 if there was none
+    double phaseSeconds(const std::string &name) const;
+    // Forgets phases and numbers, e.g. between runs of a benchmark
+    void clear();
+
+    // JSON object of the phases in the order they first ended, the numbers and totals of the run
+    std::string toJson() const;
+
+    // CPU time of all threads of the process, its current RSS and its peak RSS so far
+    static double cpuSeconds();
+    static long currentRssKb();
+    static long peakRssKb();
+
+private:
+    struct CPhase {
+        std::string name;
+        size_t calls;
+        double wallSeconds;
+        double cpuSeconds;
+        long rssGrowthKb;
+        // Of the whole process when the phase ended last, phases after the biggest one show its peak
+        long processPeakRssKb;
+    };
+
+    bool enabled = false;
+    std::chrono::steady_clock::time_point start;
+    mutable std::mutex mutex;
+    std::vector<CPhase> phases;
+    std::vector<std::pair<std::string, double>> values;
+    std::vector<std::pair<std::string, std::vector<uint64_t>>> histograms;
+};
+
+// Statistics of this run
+CRunStats &runStats();
+
+// Phase of the run from construction to destruction
+class CStatsPhase {
+public:
+    explicit CStatsPhase(const char *name_);
+    ~CStatsPhase();
+
+    CStatsPhase(const CStatsPhase &) = delete;
+    CStatsPhase &operator=(const CStatsPhase &) = delete;
+
+private:
+    const char *name;
+    bool recording;
+    std::chrono::steady_clock::time_point wallStart;
+    double cpuStart = 0;
+    long rssStart = 0;
+};
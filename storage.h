@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+//---------------------------------------------------
+// Array of plain items, either owned or a view of a buffer owned by the caller,
+// like a section of a mapped index file. Viewed items are read in place,
+// an array that has to grow or shrink makes an owned copy first.
+// Items of a view are not written, a mapped file is read-only.
+template <typename T>
+class CStorage {
+public:
+    CStorage() {}
+
+    CStorage(const CStorage &other)
+        : owned(other.owned), length(other.length), viewed(other.viewed)
+    {
+        items = viewed ? other.items : owned.data();
+    }
+
+    CStorage(CStorage &&other)
+        : owned(std::move(other.owned)), length(other.length), viewed(other.viewed)
+    {
+        items = viewed ? other.items : owned.data();
+        other.clear();
+    }
+
+    CStorage &operator=(CStorage other) {
+        owned.swap(other.owned);
+        length = other.length;
+        viewed = other.viewed;
+        items = viewed ? other.items : owned.data();
+        return *this;
+    }
+
+    // Items of a buffer that outlives the array
+    void view(const T *items_, size_t size_) {
+        std::vector<T>().swap(owned);
+        items = const_cast<T *>(items_);
+        length = size_;
+        viewed = true;
+    }
+
+    bool isView() const { return viewed; }
+
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    // Viewed items are counted as well, like the letters of a viewed CText
+    size_t capacity() const { return viewed ? length : owned.capacity(); }
+
+    T &operator[](size_t index) { return items[index]; }
+    const T &operator[](size_t index) const { return items[index]; }
+    T *data() { return items; }
+    const T *data() const { return items; }
+    T &back() { return items[length - 1]; }
+    const T &back() const { return items[length - 1]; }
+    T *begin() { return items; }
+    T *end() { return items + length; }
+    const T *begin() const { return items; }
+    const T *end() const { return items + length; }
+
+    void push_back(const T &item) {
+        own();
+        owned.push_back(item);
+        update();
+    }
+
+    void pop_back() {
+        own();
+        owned.pop_back();
+        update();
+    }
+
+    void resize(size_t size_) {
+        resize(size_, T());
+    }
+
+    // Resizing to the same size keeps a view
+    void resize(size_t size_, const T &item) {
+        if (size_ == length) {
+            return;
+        }
+        own();
+        owned.resize(size_, item);
+        update();
+    }
+
+    void reserve(size_t capacity_) {
+        own();
+        owned.reserve(capacity_);
+        update();
+    }
+
+    void clear() {
+        owned.clear();
+        viewed = false;
+        update();
+    }
+
+private:
+    std::vector<T> owned;
+    T *items = nullptr;
+    size_t length = 0;
+    bool viewed = false;
+
+    // Copies viewed items before the array changes
+    void own() {
+        if (viewed) {
+            owned.assign(items, items + length);
+            viewed = false;
+        }
+    }
+
+    void update() {
+        items = owned.data();
+        length = owned.size();
+    }
+};
@@ -0,0 +1,386 @@
+#include "suffix_array.h"
+#include "dictionary.h"
+#include "stats.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+
+using std::vector;
+using std::string;
+
+//---------------------------------------------------
+//-----------  SA-IS Implementation  ----------------
+//---------------------------------------------------
+
+// Source string as seen by SA-IS: bytes followed by a virtual zero terminator
+struct CTerminatedText {
+    const unsigned char *data;
+    int32_t size;
+
+    int32_t operator[](int32_t index) const {
+        return (index < size) ? data[index] : 0;
+    }
+};
+
+// Fills bucket with the starts or the ends of buckets of every symbol
+template <typename TText>
+static void getBuckets(const TText &text, int32_t size, vector<int32_t> &bucket, bool ends) {
+    std::fill(bucket.begin(), bucket.end(), 0);
+    for (int32_t index = 0; index < size; ++index) {
+        ++bucket[ text[index] ];
+    }
+    int32_t sum = 0;
+    for (auto &count: bucket) {
+        sum += count;
+        count = ends ? sum : (sum - count);
+    }
+}
+
+// Sorts L-type suffixes by already sorted suffixes to the right, then S-type ones the same way
+template <typename TText>
+static void induceSort(const TText &text, int32_t size, int32_t *suffixArray, const vector<bool> &isSType, vector<int32_t> &bucket) {
+    getBuckets(text, size, bucket, false);
+    for (int32_t index = 0; index < size; ++index) {
+        const int32_t previous = suffixArray[index] - 1;
+        if (previous >= 0 && !isSType[previous]) {
+            suffixArray[ bucket[ text[previous] ]++ ] = previous;
+        }
+    }
+
+    getBuckets(text, size, bucket, true);
+    for (int32_t index = size - 1; index >= 0; --index) {
+        const int32_t previous = suffixArray[index] - 1;
+        if (previous >= 0 && isSType[previous]) {
+            suffixArray[ --bucket[ text[previous] ] ] = previous;
+        }
+    }
+}
+
+// Suffix array of a text ending with a unique smallest symbol 0, symbols are below alphabetSize.
+// Induced sorting by Nong, Zhang and Chan, works in linear time.
+// The reduced problem is solved in place in the suffix array.
+template <typename TText>
+static void inducedSortSuffixes(const TText &text, int32_t size, int32_t *suffixArray, int32_t alphabetSize) {
+    // The terminator alone is not an LMS position
+    if (size == 1) {
+        suffixArray[0] = 0;
+        return;
+    }
+
+    // S-type suffix is smaller than the next one, L-type is larger
+    vector<bool> isSType(size);
+    isSType[size - 1] = true;
+    for (int32_t index = size - 2; index >= 0; --index) {
+        isSType[index] = text[index] < text[index + 1] || (text[index] == text[index + 1] && isSType[index + 1]);
+    }
+    // Leftmost S-type positions split the text into LMS substrings
+    auto isLMS = [&isSType](int32_t index) {
+        return index > 0 && isSType[index] && !isSType[index - 1];
+    };
+
+    vector<int32_t> bucket(alphabetSize);
+
+    // Sort LMS substrings
+    getBuckets(text, size, bucket, true);
+    std::fill(suffixArray, suffixArray + size, -1);
+    for (int32_t index = 1; index < size; ++index) {
+        if (isLMS(index)) {
+            suffixArray[ --bucket[ text[index] ] ] = index;
+        }
+    }
+    induceSort(text, size, suffixArray, isSType, bucket);
+
+    // Move sorted LMS substrings to the beginning
+    int32_t lmsNumber = 0;
+    for (int32_t index = 0; index < size; ++index) {
+        if (isLMS(suffixArray[index])) {
+            suffixArray[lmsNumber++] = suffixArray[index];
+        }
+    }
+
+    // Name LMS substrings, equal substrings get equal names.
+    // No two LMS positions are neighbours, so position / 2 is a unique slot.
+    std::fill(suffixArray + lmsNumber, suffixArray + size, -1);
+    int32_t namesNumber = 0;
+    int32_t previous = -1;
+    for (int32_t index = 0; index < lmsNumber; ++index) {
+        const int32_t position = suffixArray[index];
+        bool differs = false;
+        for (int32_t offset = 0; offset < size; ++offset) {
+            if (previous == -1
+                    || text[position + offset] != text[previous + offset]
+                    || isSType[position + offset] != isSType[previous + offset]) {
+                differs = true;
+                break;
+            } else if (offset > 0 && (isLMS(position + offset) || isLMS(previous + offset))) {
+                break;
+            }
+        }
+        if (differs) {
+            ++namesNumber;
+            previous = position;
+        }
+        suffixArray[ lmsNumber + position / 2 ] = namesNumber - 1;
+    }
+    for (int32_t index = size - 1, target = size - 1; index >= lmsNumber; --index) {
+        if (suffixArray[index] >= 0) {
+            suffixArray[target--] = suffixArray[index];
+        }
+    }
+
+    // Sort LMS suffixes by the reduced text of names, recursively if names repeat
+    int32_t *reducedText = suffixArray + size - lmsNumber;
+    if (namesNumber < lmsNumber) {
+        inducedSortSuffixes<const int32_t *>(reducedText, lmsNumber, suffixArray, namesNumber);
+    } else {
+        for (int32_t index = 0; index < lmsNumber; ++index) {
+            suffixArray[ reducedText[index] ] = index;
+        }
+    }
+
+    // Sort all suffixes starting from sorted LMS suffixes
+    for (int32_t index = 1, target = 0; index < size; ++index) {
+        if (isLMS(index)) {
+            reducedText[target++] = index;
+        }
+    }
+    for (int32_t index = 0; index < lmsNumber; ++index) {
+        suffixArray[index] = reducedText[ suffixArray[index] ];
+    }
+    std::fill(suffixArray + lmsNumber, suffixArray + size, -1);
+    getBuckets(text, size, bucket, true);
+    for (int32_t index = lmsNumber - 1; index >= 0; --index) {
+        const int32_t position = suffixArray[index];
+        suffixArray[index] = -1;
+        suffixArray[ --bucket[ text[position] ] ] = position;
+    }
+    induceSort(text, size, suffixArray, isSType, bucket);
+}
+
+//---------------------------------------------------
+//-----------  CSuffixArray Implementation  ---------
+//---------------------------------------------------
+
+CSuffixArray::CSuffixArray(CText sourceString_, CLeafWeights leafWeights_)
+    : leafWeights(std::move(leafWeights_))
+{
+    sourceString = std::move(sourceString_);
+
+    // Letter runs and lengths are in bytes
+    if (symbolClasses().isUtf8()) {
+        throw std::runtime_error("UTF-8 letters are counted by the suffix tree only!");
+    }
+
+    // Positions with the terminator have to fit into int32_t
+    if (sourceString.size() + 1 >= 0x80000000u) {
+        throw std::runtime_error("String is too long for the suffix array!");
+    }
+
+    checkDictionary(sourceString.data(), sourceString.size());
+}
+
+// Builds the suffix array with SA-IS and the LCP array with Kasai's algorithm
+void CSuffixArray::buildArray() {
+    CStatsPhase phase("build");
+    const int32_t textSize = sourceString.size();
+    const int32_t size = textSize + 1;
+
+    suffixArray.assign(size, 0);
+    const CTerminatedText text = { (const unsigned char *)sourceString.data(), textSize };
+    inducedSortSuffixes(text, size, suffixArray.data(), 256);
+
+    // Kasai's algorithm, inverse suffix array is kept in letterRun for a while
+    vector<int32_t> &rank = letterRun;
+    rank.assign(size, 0);
+    for (int32_t index = 0; index < size; ++index) {
+        rank[ suffixArray[index] ] = index;
+    }
+    lcp.assign(size, 0);
+    int32_t common = 0;
+    for (int32_t position = 0; position < textSize; ++position) {
+        // Only the terminator goes first, so there is always a previous suffix
+        const int32_t previous = suffixArray[ rank[position] - 1 ];
+        while (position + common < textSize && previous + common < textSize
+               && sourceString[position + common] == sourceString[previous + common]) {
+            ++common;
+        }
+        lcp[ rank[position] ] = common;
+        if (common > 0) {
+            --common;
+        }
+    }
+
+    const CSymbolClasses &classes = symbolClasses();
+    letterRun[textSize] = 0;
+    for (int32_t position = textSize - 1; position >= 0; --position) {
+        letterRun[position] = classes.isLetter(sourceString[position]) ? (letterRun[position + 1] + 1) : 0;
+    }
+
+    // If the common prefix has a non-letter, both suffixes have it at the same place,
+    // so the cap is the same whichever of the two suffixes is taken
+    for (int32_t index = 1; index < size; ++index) {
+        lcp[index] = std::min(lcp[index], letterRun[ suffixArray[index] ]);
+    }
+}
+
+// Memory used by the arrays and the source string per input character
+double CSuffixArray::bytesPerCharacter() const {
+    const size_t bytes = sourceString.bytesUsed()
+                       + sizeof(int32_t) * (suffixArray.capacity() + lcp.capacity() + letterRun.capacity());
+    return bytes / (double)(sourceString.size() + 1);
+}
+
+// Every group is an LCP interval: suffixes from one index to another share a prefix
+// longer than the prefix they share with the suffixes around.
+// Its substrings are prefixes longer than the enclosing interval prefix and not longer than its own.
+// Suffixes which share nothing that long with neighbours form groups of single occurrences.
+// The count of a group is the sum of weights of its suffixes.
+template <typename TVisitor>
+void CSuffixArray::forEachGroup(BigInt minimalLength, TVisitor visit) const {
+    const BigInt shortest = std::max((BigInt)1, minimalLength);
+    const int32_t size = suffixArray.size();
+
+    for (int32_t index = 0; index < size; ++index) {
+        const int32_t shared = std::max(lcp[index], (index + 1 < size) ? lcp[index + 1] : 0);
+        const BigInt fromLength = std::max((BigInt)shared + 1, shortest);
+        const BigInt toLength = letterRun[ suffixArray[index] ];
+        if (fromLength <= toLength) {
+            visit(CSubstringGroup{ leafWeights.at(suffixArray[index]), (uint32_t)index, (uint32_t)suffixArray[index],
+                                   (uint32_t)fromLength, (uint32_t)toLength });
+        }
+    }
+
+    // Open intervals: common prefix length, the first index and the total weight of suffixes before it
+    struct COpenInterval {
+        int32_t length;
+        int32_t leftBound;
+        BigInt weightBefore;
+    };
+    vector<COpenInterval> openIntervals;
+    openIntervals.push_back(COpenInterval{ 0, 0, 0 });
+    // Total weight of suffixes before index - 1
+    BigInt weightBefore = 0;
+    for (int32_t index = 1; index <= size; ++index) {
+        const BigInt weightUpTo = weightBefore + leafWeights.at(suffixArray[index - 1]);
+
+        const int32_t current = (index < size) ? lcp[index] : 0;
+        int32_t leftBound = index - 1;
+        BigInt leftWeightBefore = weightBefore;
+        while (current < openIntervals.back().length) {
+            const auto interval = openIntervals.back();
+            openIntervals.pop_back();
+
+            // Enclosing interval is either the one below on the stack or the one about to be opened
+            const BigInt enclosingLength = std::max(current, openIntervals.back().length);
+            const BigInt fromLength = std::max(enclosingLength + 1, shortest);
+            if (fromLength <= interval.length) {
+                visit(CSubstringGroup{ weightUpTo - interval.weightBefore, (uint32_t)interval.leftBound, (uint32_t)suffixArray[interval.leftBound],
+                                       (uint32_t)fromLength, (uint32_t)interval.length });
+            }
+            leftBound = interval.leftBound;
+            leftWeightBefore = interval.weightBefore;
+        }
+        if (current > openIntervals.back().length) {
+            openIntervals.push_back(COpenInterval{ current, leftBound, leftWeightBefore });
+        }
+        weightBefore = weightUpTo;
+    }
+}
+
+// Get number of substrings longer than given minimalLength
+// Every position starts one substring of letters of every length up to its letter run
+BigInt CSuffixArray::getNumbetOfSubstringsLongerThan(BigInt minimalLength) const {
+    CStatsPhase phase("long_substrings");
+    const BigInt shortest = std::max((BigInt)1, minimalLength);
+    BigInt count = 0;
+    for (size_t position = 0; position < letterRun.size(); ++position) {
+        const BigInt run = letterRun[position];
+        if (run >= shortest) {
+            count += (run - shortest + 1) * leafWeights.at(position);
+        }
+    }
+    return count;
+}
+
+// Best groups of substrings by occurrence frequency, together they have at least takeTopN substrings
+vector<CSubstringGroup> CSuffixArray::getTopGroups(const size_t takeTopN, BigInt minimalLength) const {
+    CStatsPhase phase("top_selection");
+    // More occurrences go first, equal ones in lexicographical order
+    auto better = [](const CSubstringGroup &a, const CSubstringGroup &b) {
+        return a.count > b.count || (a.count == b.count && a.rank < b.rank);
+    };
+
+    // Heap of the best groups found so far with the worst one on top.
+    // It is kept just big enough to have takeTopN substrings without its top.
+    vector<CSubstringGroup> bestGroups;
+    BigInt substringsNumber = 0;
+    forEachGroup(minimalLength, [&](const CSubstringGroup &group) {
+        if (takeTopN > 0 && substringsNumber >= (BigInt)takeTopN && !better(group, bestGroups.front())) {
+            return;
+        }
+        bestGroups.push_back(group);
+        std::push_heap(bestGroups.begin(), bestGroups.end(), better);
+        substringsNumber += group.size();
+
+        while (takeTopN > 0 && substringsNumber - bestGroups.front().size() >= (BigInt)takeTopN) {
+            substringsNumber -= bestGroups.front().size();
+            std::pop_heap(bestGroups.begin(), bestGroups.end(), better);
+            bestGroups.pop_back();
+        }
+    });
+    std::sort(bestGroups.begin(), bestGroups.end(), better);
+    return bestGroups;
+}
+
+// Groups of substrings occurring at least minimalCount times
+vector<CSubstringGroup> CSuffixArray::getFrequentGroups(BigInt minimalCount, BigInt minimalLength) const {
+    vector<CSubstringGroup> groups;
+    forEachGroup(minimalLength, [&](const CSubstringGroup &group) {
+        if (group.count >= minimalCount) {
+            groups.push_back(group);
+        }
+    });
+    return groups;
+}
+
+// Number of occurrences of the pattern in the text.
+// Suffixes starting with the pattern are a range of the suffix array.
+BigInt CSuffixArray::count(const string &pattern) const {
+    auto first = std::lower_bound(suffixArray.begin(), suffixArray.end(), pattern,
+        [this](int32_t suffix, const string &pattern) {
+            return sourceString.compare(suffix, pattern.size(), pattern) < 0;
+        });
+    auto last = std::upper_bound(first, suffixArray.end(), pattern,
+        [this](const string &pattern, int32_t suffix) {
+            return sourceString.compare(suffix, pattern.size(), pattern) > 0;
+        });
+    if (leafWeights.empty()) {
+        return last - first;
+    }
+    BigInt count = 0;
+    for (; first != last; ++first) {
+        count += leafWeights.at(*first);
+    }
+    return count;
+}
+
+// Get top N substrings by occurrence frequency with minimal length more or equal to minimalLength
+CFrequencyInfo CSuffixArray::getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength) {
+    CFrequencyInfo topN;
+
+    // Number of all substrings of appropriate length in the text
+    double numberOfLongSubstrings = getNumbetOfSubstringsLongerThan(minimalLength);
+
+    for (const auto &group: getTopGroups(takeTopN, minimalLength)) {
+        for (uint32_t length = group.fromLength; length <= group.toLength; ++length) {
+            topN.emplace_back(sourceString.substr(group.position, length), 100 * group.count / numberOfLongSubstrings);
+
+            // If we have enough data in topN, quit
+            if ( (takeTopN > 0) && (topN.size() >= takeTopN) ) {
+                return topN;
+            }
+        }
+    }
+    return topN;
+}
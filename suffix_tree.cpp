@@ -1,6 +1,13 @@
 #include "suffix_tree.h"
+#include "dictionary.h"
+#include "stats.h"
 
 #include <cctype>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <numeric>
 
 using std::map;
 using std::vector;
@@ -9,6 +16,17 @@ using std::cout;
 using std::endl;
 using std::string;
 
+const uint32_t CTreeArena::LEAF_FLAG;
+const uint32_t CTreeArena::NONE;
+const uint8_t CTreeArena::NO_SYMBOL;
+const uint32_t CTreeArena::INLINE_CHILDREN;
+const uint32_t CTreeArena::MAX_BLOCK_CHILDREN;
+const uint32_t CTreeArena::BLOCK_MARK;
+const uint32_t CTreeArena::TABLE_MARK;
+const uint32_t CSuffixTree::NONE;
+const NodeId CSuffixTree::ROOT;
+const size_t CSuffixTree::MAX_SPLIT_LEVEL;
+
 //---------------------------------------------------
 //-----------  CPoint Implementation  ---------------
 //---------------------------------------------------
@@ -16,54 +34,48 @@ using std::string;
 // It either increases current point position or splits an edge/adds new edge
 // returns 1 if increase succeeded
 //         0 if split/add happened
-// If split happens the point doesn't change.
-BigInt CPoint::increaseOrSplit(char letter, CNode **returnNode) {
-    *returnNode = nullptr;
-
-    CEdge *newEdge = edge;
+// If split happens the point stays at the same place of the text.
+BigInt CPoint::increaseOrSplit(char letter, NodeId *returnNode) {
+    *returnNode = CSuffixTree::NONE;
 
-    if (edge->beginIndex + relativeIndex < edge->getRealEndIndex()) {
-        if(letter == edge->letterFromRelativeIndex(relativeIndex + 1) ) { // Just go further the current edge
+    if (edge != CSuffixTree::NONE && relativeIndex + 1 < tree->edgeLength(node, edge)) {
+        if(letter == tree->letterFromRelativeIndex(node, edge, relativeIndex + 1) ) { // Just go further the current edge
             ++relativeIndex;
-            *returnNode = edge->beginNode;
+            *returnNode = node;
             return 1;
         } else { // Split the edge with a new node;
-            CNode *newNode = tree->newCNode();
-            CEdge *edge_1 = tree->newCEdge();
-            CEdge *edge_2 = tree->newCEdge();
-
-            newNode->inEdge = this->edge;
-            edge_1->endNode = edge->endNode;
-            edge_1->beginNode = newNode;
-            edge_2->beginNode = newNode;
-            edge->endNode = newNode;
+            const BigInt beginIndex = tree->edgeBeginIndex(node, edge);
+            NodeId newNode = tree->arena.addNode(beginIndex - tree->nodeDepth(node), tree->nodeDepth(node) + relativeIndex + 1);
 
-            edge_1->beginIndex = edge->beginIndex + relativeIndex + 1;
-            edge_1->endIndex = edge->endIndex;
-            edge->endIndex = edge->beginIndex + relativeIndex;
-            edge_2->endIndex = CSuffixTree::FREE;
-            edge_2->beginIndex = tree->currentIndex;
+            // The new node takes place of the edge in the parent,
+            // the edge itself hangs below together with a new leaf
+            tree->setEdge(node, newNode);
+            tree->setEdge(newNode, edge);
+            tree->setEdge(newNode, CTreeArena::LEAF_FLAG | (tree->currentIndex - tree->arena.depth[newNode]));
+            tree->markChanged(newNode);
+            tree->buildCounters.edgeSplit();
+            tree->buildCounters.leafCreation();
 
-            newNode->edges[ edge_1->letterFromRelativeIndex(0) ] = edge_1;
-            newNode->edges[ edge_2->letterFromRelativeIndex(0) ] = edge_2;
+            // The point is now at the end of the upper part of the split edge
+            edge = newNode;
 
             *returnNode = newNode;
             return 0;
         }
     } else {
-        newEdge = edge->endNode->edgeFromLetter(letter);
-        if (newEdge == nullptr) { // Create new child edge
-            CEdge *edge_1 = tree->newCEdge();
-            edge_1->beginIndex = tree->currentIndex;
-            edge_1->endIndex = CSuffixTree::FREE;
-            edge_1->beginNode = edge->endNode;
-            edge->endNode->edges[letter] = edge_1;
-
-            *returnNode = edge_1->beginNode;
+        const NodeId endNode = (edge == CSuffixTree::NONE) ? node : tree->endNode(edge);
+        EdgeId newEdge = tree->edgeFromLetter(endNode, letter);
+        if (newEdge == CSuffixTree::NONE) { // Create new child edge
+            tree->setEdge(endNode, CTreeArena::LEAF_FLAG | (tree->currentIndex - tree->arena.depth[endNode]));
+            tree->markChanged(endNode);
+            tree->buildCounters.leafCreation();
+
+            *returnNode = endNode;
             return 0;
         } else { // No new children, just follow the right edge
-            *returnNode = edge->endNode;
+            *returnNode = endNode;
 
+            node = endNode;
             edge = newEdge;
             relativeIndex = 0;
 
@@ -74,26 +86,317 @@ BigInt CPoint::increaseOrSplit(char letter, CNode **returnNode) {
 
 CPoint::CPoint(CSuffixTree *tree_) : tree(tree_) {}
 
+//---------------------------------------------------
+//----------  CTreeArena Implementation  ------------
+//---------------------------------------------------
+
+// Appends a new internal node without children and suffix link, or reuses a freed one
+NodeId CTreeArena::addNode(uint32_t position_, uint32_t depth_) {
+    if (!freeNodes.empty()) {
+        const NodeId node = freeNodes.back();
+        freeNodes.pop_back();
+        position[node] = position_;
+        depth[node] = depth_;
+        occurrenceNumber[node] = 0;
+        return node;
+    }
+    position.push_back(position_);
+    depth.push_back(depth_);
+    suffixLink.push_back(NONE);
+    parent.push_back(NONE);
+    children.push_back(CChildSet());
+    children.back().letters = 0xFFFFFFFFu;
+    occurrenceNumber.push_back(0);
+    return position.size() - 1;
+}
+
+// Allocates a block of letters and edges for the given number of children
+uint32_t CTreeArena::allocateBlock(uint32_t capacity) {
+    std::vector<uint32_t> &freeList = freeBlocks[ __builtin_ctz(capacity / 8) ];
+    if (!freeList.empty()) {
+        const uint32_t offset = freeList.back();
+        freeList.pop_back();
+        return offset;
+    }
+    const uint32_t offset = blockPool.size();
+    blockPool.resize(blockPool.size() + capacity / 4 + capacity);
+    return offset;
+}
+
+void CTreeArena::freeBlock(uint32_t offset, uint32_t capacity) {
+    freeBlocks[ __builtin_ctz(capacity / 8) ].push_back(offset);
+}
+
+// Releases the node and its child storage for reuse
+void CTreeArena::freeNode(NodeId node) {
+    CChildSet &set = children[node];
+    if (set.letters == BLOCK_MARK) {
+        freeBlock(set.edge[0], set.edge[1]);
+    } else if (set.letters == TABLE_MARK) {
+        freeTables.push_back(set.edge[0]);
+    }
+    set.letters = 0xFFFFFFFFu;
+    suffixLink[node] = NONE;
+    parent[node] = NONE;
+    freeNodes.push_back(node);
+}
+
+// Adds a child edge or replaces an existing one with the same first letter.
+// Moves children to a bigger representation when the current one is full.
+void CTreeArena::setChild(NodeId node, uint8_t code, EdgeId edge) {
+    CChildSet &set = children[node];
+
+    if (set.letters == TABLE_MARK) {
+        tables[ (size_t)set.edge[0] * alphabetSize + code ] = edge;
+        return;
+    }
+
+    // Letters are unpacked from words where the first letter is the lowest byte
+    uint8_t letters[MAX_BLOCK_CHILDREN];
+    uint32_t *letterWords;
+    EdgeId *edges;
+    uint32_t capacity;
+    if (set.letters == BLOCK_MARK) {
+        capacity = set.edge[1];
+        letterWords = &blockPool[ set.edge[0] ];
+        edges = letterWords + capacity / 4;
+    } else {
+        capacity = INLINE_CHILDREN;
+        letterWords = &set.letters;
+        edges = set.edge;
+    }
+    for (uint32_t index = 0; index < capacity; ++index)
+        letters[index] = (letterWords[index / 4] >> (8 * (index % 4))) & 0xFF;
+
+    uint32_t count = 0;
+    uint32_t slot = 0;
+    for (; count < capacity && letters[count] != NO_SYMBOL; ++count) {
+        if (letters[count] == code) {
+            edges[count] = edge;
+            return;
+        }
+        if (letters[count] < code)
+            slot = count + 1;
+    }
+
+    if (count < capacity) {
+        for (uint32_t index = count; index > slot; --index) {
+            letters[index] = letters[index - 1];
+            edges[index] = edges[index - 1];
+        }
+        letters[slot] = code;
+        edges[slot] = edge;
+        for (uint32_t index = slot; index <= count; ++index) {
+            const uint32_t shift = 8 * (index % 4);
+            letterWords[index / 4] = (letterWords[index / 4] & ~(0xFFu << shift)) | ((uint32_t)letters[index] << shift);
+        }
+        return;
+    }
+
+    // The representation is full, copy children out before the pool may move
+    EdgeId allEdges[MAX_BLOCK_CHILDREN + 1];
+    uint8_t allLetters[MAX_BLOCK_CHILDREN + 1];
+    for (uint32_t index = 0, source = 0; index <= count; ++index) {
+        if (index == slot) {
+            allLetters[index] = code;
+            allEdges[index] = edge;
+        } else {
+            allLetters[index] = letters[source];
+            allEdges[index] = edges[source];
+            ++source;
+        }
+    }
+    if (set.letters == BLOCK_MARK)
+        freeBlock(set.edge[0], capacity);
+
+    if (count + 1 > MAX_BLOCK_CHILDREN) {
+        uint32_t table;
+        if (!freeTables.empty()) {
+            table = freeTables.back();
+            freeTables.pop_back();
+        } else {
+            table = tables.size() / alphabetSize;
+            tables.resize(tables.size() + alphabetSize);
+        }
+        EdgeId *tableEdges = &tables[ (size_t)table * alphabetSize ];
+        std::fill(tableEdges, tableEdges + alphabetSize, NONE);
+        for (uint32_t index = 0; index <= count; ++index)
+            tableEdges[ allLetters[index] ] = allEdges[index];
+
+        set.letters = TABLE_MARK;
+        set.edge[0] = table;
+        return;
+    }
+
+    const uint32_t newCapacity = (capacity < 8) ? 8 : 2 * capacity;
+    const uint32_t offset = allocateBlock(newCapacity);
+    uint32_t *block = &blockPool[offset];
+    for (uint32_t word = 0; word < newCapacity / 4; ++word)
+        block[word] = 0xFFFFFFFFu;
+    for (uint32_t index = 0; index <= count; ++index) {
+        const uint32_t shift = 8 * (index % 4);
+        block[index / 4] = (block[index / 4] & ~(0xFFu << shift)) | ((uint32_t)allLetters[index] << shift);
+        block[newCapacity / 4 + index] = allEdges[index];
+    }
+
+    set.letters = BLOCK_MARK;
+    set.edge[0] = offset;
+    set.edge[1] = newCapacity;
+}
+
+// Removes the child edge with the first letter of the code, if there is one.
+// Blocks and tables are kept, they are only released with the node.
+void CTreeArena::removeChild(NodeId node, uint8_t code) {
+    CChildSet &set = children[node];
+
+    if (set.letters == TABLE_MARK) {
+        tables[ (size_t)set.edge[0] * alphabetSize + code ] = NONE;
+        return;
+    }
+
+    uint8_t letters[MAX_BLOCK_CHILDREN];
+    uint32_t *letterWords;
+    EdgeId *edges;
+    uint32_t capacity;
+    if (set.letters == BLOCK_MARK) {
+        capacity = set.edge[1];
+        letterWords = &blockPool[ set.edge[0] ];
+        edges = letterWords + capacity / 4;
+    } else {
+        capacity = INLINE_CHILDREN;
+        letterWords = &set.letters;
+        edges = set.edge;
+    }
+    for (uint32_t index = 0; index < capacity; ++index)
+        letters[index] = (letterWords[index / 4] >> (8 * (index % 4))) & 0xFF;
+
+    uint32_t slot = 0;
+    while (slot < capacity && letters[slot] != NO_SYMBOL && letters[slot] != code)
+        ++slot;
+    if (slot == capacity || letters[slot] != code)
+        return;
+
+    // Letters after the slot move one place down, the last used place becomes free
+    for (uint32_t index = slot; index < capacity; ++index) {
+        const bool last = (index + 1 == capacity);
+        letters[index] = last ? NO_SYMBOL : letters[index + 1];
+        if (!last)
+            edges[index] = edges[index + 1];
+        const uint32_t shift = 8 * (index % 4);
+        letterWords[index / 4] = (letterWords[index / 4] & ~(0xFFu << shift)) | ((uint32_t)letters[index] << shift);
+        if (letters[index] == NO_SYMBOL)
+            break;
+    }
+}
+
+// Moves leaf numbers of the children of the node back by delta
+void CTreeArena::shiftLeaves(NodeId node, uint32_t delta) {
+    CChildSet &set = children[node];
+    EdgeId *edges;
+    uint32_t count;
+    if (set.letters == TABLE_MARK) {
+        edges = &tables[ (size_t)set.edge[0] * alphabetSize ];
+        count = alphabetSize;
+    } else if (set.letters == BLOCK_MARK) {
+        edges = &blockPool[ set.edge[0] + set.edge[1] / 4 ];
+        count = set.edge[1];
+    } else {
+        edges = set.edge;
+        count = INLINE_CHILDREN;
+    }
+    // Unused places are ignored by readers, so they may be shifted as well
+    for (uint32_t index = 0; index < count; ++index) {
+        if (edges[index] != NONE && (edges[index] & LEAF_FLAG))
+            edges[index] -= delta;
+    }
+}
+
+size_t CTreeArena::bytesUsed() const {
+    size_t freeListBytes = 0;
+    for (auto &freeList: freeBlocks)
+        freeListBytes += freeList.capacity() * sizeof(uint32_t);
+
+    return position.capacity() * sizeof(uint32_t)
+         + depth.capacity() * sizeof(uint32_t)
+         + suffixLink.capacity() * sizeof(NodeId)
+         + parent.capacity() * sizeof(NodeId)
+         + children.capacity() * sizeof(CChildSet)
+         + occurrenceNumber.capacity() * sizeof(uint32_t)
+         + blockPool.capacity() * sizeof(uint32_t)
+         + freeListBytes
+         + tables.capacity() * sizeof(EdgeId)
+         + freeTables.capacity() * sizeof(uint32_t)
+         + freeNodes.capacity() * sizeof(NodeId);
+}
+
+//---------------------------------------------------
+//--------  CChildIterator Implementation  ----------
+//---------------------------------------------------
+
+CChildIterator::CChildIterator(const CTreeArena &arena_, NodeId node, uint32_t cursor_)
+    : arena(arena_), set(arena_.children[node]), cursor(cursor_), edge(CTreeArena::NONE)
+{
+    next();
+}
+
+// Moves to the next child in the order of letter codes
+void CChildIterator::next() {
+    edge = CTreeArena::NONE;
+
+    if (set.letters == CTreeArena::TABLE_MARK) {
+        const EdgeId *tableEdges = &arena.tables[ (size_t)set.edge[0] * arena.alphabetSize ];
+        while (cursor < arena.alphabetSize && edge == CTreeArena::NONE)
+            edge = tableEdges[cursor++];
+    } else if (set.letters == CTreeArena::BLOCK_MARK) {
+        const uint32_t capacity = set.edge[1];
+        const uint32_t *block = &arena.blockPool[ set.edge[0] ];
+        if (cursor < capacity && ((block[cursor / 4] >> (8 * (cursor % 4))) & 0xFF) != CTreeArena::NO_SYMBOL) {
+            edge = block[capacity / 4 + cursor];
+            ++cursor;
+        }
+    } else {
+        if (cursor < CTreeArena::INLINE_CHILDREN && ((set.letters >> (8 * cursor)) & 0xFF) != CTreeArena::NO_SYMBOL)
+            edge = set.edge[cursor++];
+    }
+}
+
 //---------------------------------------------------
 //---------  CSuffixTree Implementation  ------------
 //---------------------------------------------------
 
 // Finds a place in a tree to which leads a current string without the first letter
 CPoint CSuffixTree::getNextPoint(CPoint point) {
-    if ( (point.edge->beginIndex == -1) && (point.relativeIndex <= 1) )
+    // Empty string at root has nothing to drop
+    if (point.edge == NONE)
         return point;
 
     CPoint nextPoint(this);
     BigInt distanceGone = 0;
 
-    CNode *node = point.edge->beginNode->suffixLink;
-    CEdge *edge = node->edgeFromLetter(point.edge->letterFromRelativeIndex(0));
+    NodeId node = arena.suffixLink[point.node];
 
-    while (distanceGone + edge->length() <= point.relativeIndex) {
-        node = edge->endNode;
-        distanceGone += edge->length();
-        edge = node->edgeFromLetter(point.edge->letterFromRelativeIndex(distanceGone));
+    // Root links to itself, so the first letter is dropped by skipping it on the edge
+    if (point.node == ROOT) {
+        if (point.relativeIndex == 0) {
+            nextPoint.node = ROOT;
+            nextPoint.edge = NONE;
+            nextPoint.relativeIndex = 0;
+            return nextPoint;
+        }
+        distanceGone = 1;
+    } else {
+        buildCounters.suffixLinkFollow();
     }
+
+    EdgeId edge = edgeFromLetter(node, letterFromRelativeIndex(point.node, point.edge, distanceGone));
+
+    while (distanceGone + edgeLength(node, edge) <= point.relativeIndex) {
+        distanceGone += edgeLength(node, edge);
+        node = endNode(edge);
+        buildCounters.skipCountHop();
+        edge = edgeFromLetter(node, letterFromRelativeIndex(point.node, point.edge, distanceGone));
+    }
+    nextPoint.node = node;
     nextPoint.edge = edge;
     nextPoint.relativeIndex = point.relativeIndex - distanceGone;
 
@@ -101,337 +404,991 @@ CPoint CSuffixTree::getNextPoint(CPoint point) {
 }
 
 // Initilaize suffix tree data to prepare for a buildTree() call
-CSuffixTree::CSuffixTree(string sourceString_)
-    : activePoint(this), previousPoint(this)
+CSuffixTree::CSuffixTree(CText sourceString_, CLeafWeights leafWeights_)
+    : activePoint(this), previousPoint(this), leafWeights(std::move(leafWeights_))
 {
     sourceString = std::move(sourceString_);
 
-    root = newCNode();
-    preRoot = newCNode();
-
-    root->suffixLink = preRoot;
-    preRoot->suffixLink = preRoot;
-
-    // Vocabulary this tree will accept
-    string letters("ABCDEFGHIJKLMNOPQRSTUVWXYZ\t\n\r \"',.[]{}()-*&^%$#@!1?;:234567890_abcdefghijklmnopqrstuvwxyz");
-    {
-        const std::unordered_set<char> dictionary(letters.begin(), letters.end());
-        // Check for symbols not in dictionary
-        for (const auto c: sourceString) {
-            if (dictionary.count(c) == 0) {
-                std::string errorString = "String contains a symbol '";
-                errorString += c;
-                errorString += "' which is not in dictionary!";
-
-                throw std::runtime_error(errorString);
-            }
-            if (c == '$') {
-                throw std::runtime_error("There must be no symbol '$' in a string! It is a special symbol.");
-            }
-        }
+    // Leaf numbers and positions have to fit into 31 bit
+    if (sourceString.size() + 1 >= CTreeArena::LEAF_FLAG) {
+        throw std::runtime_error("String is too long for the suffix tree!");
     }
 
-    sourceString += '$';
+    checkDictionary(sourceString.data(), sourceString.size());
+    // Bytes of an ASCII text are its code points, nothing is counted differently
+    codePoints = symbolClasses().isUtf8() && !CSymbolClasses::isAscii(sourceString.data(), sourceString.size());
 
-    // Adding a virtual edge from pre-root to root for every charachter in vocabulary
-    for (size_t i = 0 ; i < letters.size() ; ++i) {
-        virtualEdgesKeeper.emplace_back(new CVirtualEdge(this, letters[i], preRoot, root));
-        preRoot->edges[ letters[i] ] = virtualEdgesKeeper.back().get();
+    // Codes of symbols go in the order of symbols, so children are visited in alphabetical order
+    std::fill(symbolCode, symbolCode + 256, CTreeArena::NO_SYMBOL);
+    const CSymbolClasses &classes = symbolClasses();
+    for (size_t symbol = 0; symbol < 256; ++symbol) {
+        if (classes.isAllowed((char)symbol)) {
+            symbolCode[symbol] = arena.alphabetSize++;
+        }
     }
 
-    activePoint.edge = preRoot->edges['a'];
+    // Usual texts produce about one internal node per two leaves
+    arena.position.reserve(sourceString.size() / 2);
+    arena.depth.reserve(sourceString.size() / 2);
+    arena.suffixLink.reserve(sourceString.size() / 2);
+    arena.parent.reserve(sourceString.size() / 2);
+    arena.children.reserve(sourceString.size() / 2);
+    arena.occurrenceNumber.reserve(sourceString.size() / 2);
+
+    arena.addNode(0, 0);
+    // Root links to itself, getNextPoint() never follows this link
+    arena.suffixLink[ROOT] = ROOT;
+
+    // Start with empty string at root
+    activePoint.node = ROOT;
+    activePoint.edge = NONE;
     activePoint.relativeIndex = 0;
+    currentIndex = -1;
 }
 
 // Does tha ctual work of building the suffix tree
 void CSuffixTree::buildTree() {
-    CNode *newNode = nullptr
-         ,*oldNode = nullptr;
+    if (readOnly) {
+        throw std::runtime_error("Suffix tree loaded from an index is built already!");
+    }
+    {
+        CStatsPhase phase("build");
+        extendTree();
+    }
+    refreshOccurrences();
+}
+
+// Appends a chunk to the string and extends the tree in place
+void CSuffixTree::append(const string &chunk) {
+    if (readOnly) {
+        throw std::runtime_error("Can't append to a suffix tree loaded from an index!");
+    }
+    // Weights belong to words of the whole string
+    if (!leafWeights.empty()) {
+        throw std::runtime_error("Can't append to a suffix tree of distinct words!");
+    }
+    // The last document would grow, numbers of documents are counted over the whole tree
+    if (!documentStart.empty()) {
+        throw std::runtime_error("Can't append to a suffix tree of documents!");
+    }
+    if (sourceString.size() + chunk.size() + 1 >= CTreeArena::LEAF_FLAG) {
+        throw std::runtime_error("String is too long for the suffix tree!");
+    }
+    checkDictionary(chunk);
+    codePoints = codePoints || (symbolClasses().isUtf8() && !CSymbolClasses::isAscii(chunk.data(), chunk.size()));
+
+    sourceString.append(chunk);
+    CStatsPhase phase("build");
+    extendTree();
+}
+
+// Keeps only suffixes of the last windowSize_ letters
+void CSuffixTree::setWindowSize(BigInt windowSize_) {
+    if (currentIndex >= 0 || readOnly) {
+        throw std::runtime_error("Window of a suffix tree has to be set before building!");
+    }
+    if (!leafWeights.empty() || !documentStart.empty()) {
+        throw std::runtime_error("Can't slide a window over distinct words or documents!");
+    }
+    if (windowSize_ <= 0) {
+        throw std::runtime_error("Window of a suffix tree has to be positive!");
+    }
+    windowSize = windowSize_;
+}
+
+// Documents are counted with occurrences, so they have to be known before the first count
+void CSuffixTree::setDocuments(std::vector<uint32_t> documentStart_) {
+    if (currentIndex >= 0 || readOnly) {
+        throw std::runtime_error("Documents of a suffix tree have to be set before building!");
+    }
+    if (!leafWeights.empty() || windowSize > 0) {
+        throw std::runtime_error("Documents can't be counted over distinct words or a window!");
+    }
+    if (documentStart_.empty() || documentStart_[0] != 0 || !std::is_sorted(documentStart_.begin(), documentStart_.end())
+            || documentStart_.back() > sourceString.size()) {
+        throw std::runtime_error("Documents have to start from the beginning of the string in ascending order!");
+    }
+    documentStart = std::move(documentStart_);
+}
+
+// Walks after building run on a pool of workers
+void CSuffixTree::setThreadsNumber(size_t threadsNumber) {
+    if (threadsNumber > 1) {
+        pool.reset(new CWorkStealingPool(threadsNumber));
+    } else {
+        pool.reset();
+    }
+}
+
+// Runs Ukkonen's phases for the letters of the string not in the tree yet
+void CSuffixTree::extendTree() {
+    clearTerminalMarks();
+    if (windowSize > 0) {
+        leafParent.resize(sourceString.size(), NONE);
+    }
+
+    NodeId newNode = NONE;
 
     char current_letter;
 
-    for (currentIndex = 0; currentIndex < (ssize_t)sourceString.size(); ++currentIndex) {
+    for (currentIndex = currentIndex + 1; currentIndex < (ssize_t)sourceString.size(); ++currentIndex) {
         current_letter = sourceString[currentIndex];
 
         while (!activePoint.increaseOrSplit(current_letter, &newNode)) {
-            if (oldNode != nullptr) {
-                if (oldNode->suffixLink == nullptr) {
-                    oldNode->suffixLink = newNode;
+            if (oldNode != NONE) {
+                if (arena.suffixLink[oldNode] == NONE) {
+                    arena.suffixLink[oldNode] = newNode;
                 }
             }
             oldNode = newNode;
             previousPoint = activePoint;
             activePoint = getNextPoint(activePoint);
 
-            // The following condition happens when we have reached an edge second time at the same place
-            // It happens only on virtual edges and only when it is time to stop
-            if( previousPoint.edge == activePoint.edge && previousPoint.relativeIndex == activePoint.relativeIndex )
+            // The following condition happens when we have reached the same place second time
+            // It happens only at root with empty string and only when it is time to stop
+            if( previousPoint.edge == activePoint.edge && previousPoint.relativeIndex == activePoint.relativeIndex ) {
+                buildCounters.samePointExit();
                 break;
+            }
         }
+        buildCounters.phaseEnd();
 
-        if (oldNode != nullptr) {
-            if( oldNode->suffixLink == nullptr ) {
-                oldNode->suffixLink = newNode;
+        if (oldNode != NONE) {
+            if( arena.suffixLink[oldNode] == NONE ) {
+                arena.suffixLink[oldNode] = newNode;
             }
         }
+
+        while (windowSize > 0 && currentIndex + 1 - windowStart > windowSize) {
+            deleteOldestSuffix();
+        }
     }
 
-    // After a for loop currentIndex = sourceString.size() but we need a little less
-    // because we have added '$' to the end of the string:
+    // After a for loop currentIndex = sourceString.size() but leaves end at the last letter
     currentIndex = sourceString.size() - 1;
 
-    //std::cout << "Calculating occurrences...";
-    // Prepare occurrentNumber on edges
-    countOccurrences(root);
-    //std::cout << "done." << std::endl;
+    // Letters before the window are dropped once there are as many of them as in the window
+    if (windowSize > 0 && windowStart >= windowSize) {
+        compactWindow();
+    }
+}
+
+// Deletes the leaf of the longest suffix, whose first letter leaves the window (Larsson's sliding window).
+// The longest suffix occurs once, so it always has a leaf. If the active point is on the edge of that leaf,
+// the active suffix occurs only there and at the end of the string: the leaf goes to the suffix at the end
+// instead, and the active point moves to the next shorter suffix.
+// Node positions may stay before the window, the letters there are kept until compactWindow().
+void CSuffixTree::deleteOldestSuffix() {
+    const EdgeId leaf = CTreeArena::LEAF_FLAG | windowStart;
+    const NodeId node = leafParent[windowStart];
+    ++windowStart;
+
+    // Its suffix link is set already, and the node may be freed and reused below
+    oldNode = NONE;
+
+    if (activePoint.edge == leaf) {
+        const EdgeId endLeaf = CTreeArena::LEAF_FLAG | (currentIndex + 1 - pointDepth(activePoint));
+        setEdge(node, endLeaf);
+        activePoint.edge = endLeaf;
+        activePoint = getNextPoint(activePoint);
+        return;
+    }
+
+    removeEdge(node, leaf);
+    markChanged(node);
+
+    // Nothing links to a node left with one child: a node linking to it would have lost a child as well
+    if (node != ROOT) {
+        CChildIterator child(arena, node);
+        child.next();
+        if (!child.valid()) {
+            mergeUnaryNode(node);
+        }
+    }
+}
+
+// Replaces a node having a single child by its child edge and frees the node
+void CSuffixTree::mergeUnaryNode(NodeId node) {
+    const EdgeId child = *CChildIterator(arena, node);
+    const NodeId parentNode = arena.parent[node];
+    setEdge(parentNode, child);
+
+    if (activePoint.edge == node) {
+        activePoint.edge = child;
+    } else if (activePoint.node == node) {
+        activePoint.relativeIndex += nodeDepth(node) - nodeDepth(parentNode);
+        activePoint.node = parentNode;
+    }
+
+    if (node < isChanged.size()) {
+        isChanged[node] = false;
+    }
+    arena.freeNode(node);
+}
+
+// Drops the letters before the window and moves leaf numbers and positions back.
+// Positions before the window are replaced by positions of children, so children go first.
+void CSuffixTree::compactWindow() {
+    const uint32_t shift = windowStart;
+
+    // Nodes in breadth-first order, walked backwards every child comes before its parent
+    vector<NodeId> nodes(1, ROOT);
+    for (size_t index = 0; index < nodes.size(); ++index) {
+        for (CChildIterator child(arena, nodes[index]); child.valid(); child.next()) {
+            if (!isLeaf(*child)) {
+                nodes.push_back(*child);
+            }
+        }
+    }
+    for (size_t index = nodes.size(); index-- > 0; ) {
+        const NodeId node = nodes[index];
+        arena.shiftLeaves(node, shift);
+        if (node != ROOT) {
+            const EdgeId child = *CChildIterator(arena, node);
+            arena.position[node] = isLeaf(child) ? (child & ~CTreeArena::LEAF_FLAG) : arena.position[child];
+        }
+    }
+
+    if (activePoint.edge != NONE && isLeaf(activePoint.edge)) {
+        activePoint.edge -= shift;
+    }
+    sourceString.erase(0, shift);
+    letterIndex.clear();
+    leafParent.erase(leafParent.begin(), leafParent.begin() + shift);
+    currentIndex -= shift;
+    windowStart = 0;
+}
+
+// Brings occurrence numbers up to date after building or appending
+void CSuffixTree::refreshOccurrences() {
+    {
+        CStatsPhase phase("letter_index");
+        letterIndex.extend(sourceString.data(), sourceString.size());
+    }
+
+    if (!terminalsMarked) {
+        markImplicitSuffixes();
+    }
+    if (allChanged || (!isChanged.empty() && isChanged[ROOT])) {
+        //std::cout << "Calculating occurrences...";
+        // Prepare occurrentNumber on edges
+        countOccurrences();
+        //std::cout << "done." << std::endl;
+
+        allChanged = false;
+        isChanged.assign(arena.size(), false);
+        codePointDepth.clear();
+    }
+
+    // Also for a tree loaded from an index, queries only read them
+    if (codePoints && codePointDepth.empty()) {
+        countCodePointDepths();
+    }
+}
+
+// Code points from root to every node under edges of letters, the nodes queries walk to
+void CSuffixTree::countCodePointDepths() {
+    CStatsPhase phase("code_point_depths");
+    codePointDepth.assign(arena.size(), 0);
+    walkTree(ROOT, [&](NodeId node, EdgeId edge) {
+        if (startsInCodePoint(node, edge)) {
+            return false;
+        }
+        const BigInt letterBytes = edgeLetters(node, edge);
+        if (letterBytes != edgeLength(node, edge) || isLeaf(edge)) {
+            return false;
+        }
+        codePointDepth[edge] = nodeLength(node) + prefixLength(node, edge, letterBytes);
+        return true;
+    }, [](NodeId) {
+    });
+}
+
+// Walks the suffixes without leaves from the longest one at the active point by suffix links
+// and makes a terminal node at the end of each one, like a terminator symbol would make a leaf there.
+// Nodes made here keep single children until the string grows, they get suffix links like others
+// and are merged back by clearTerminalMarks().
+void CSuffixTree::markImplicitSuffixes() {
+    CStatsPhase phase("mark_suffixes");
+    NodeId previousNode = NONE;
+    CPoint point = activePoint;
+
+    while (pointDepth(point) > 0) {
+        const NodeId node = makeExplicit(point);
+        if (previousNode == NONE) {
+            // The edge under the active point could have been split
+            activePoint = point;
+        } else if (arena.suffixLink[previousNode] == NONE) {
+            arena.suffixLink[previousNode] = node;
+        }
+
+        if (isTerminal.size() < arena.size()) {
+            isTerminal.resize(arena.size());
+        }
+        isTerminal[node] = true;
+        terminalNodes.push_back(node);
+        markChanged(node);
+
+        previousNode = node;
+        point = getNextPoint(point);
+    }
+
+    if (previousNode != NONE && arena.suffixLink[previousNode] == NONE) {
+        arena.suffixLink[previousNode] = ROOT;
+    }
+    terminalsMarked = true;
+}
+
+void CSuffixTree::clearTerminalMarks() {
+    for (const auto node: terminalNodes) {
+        isTerminal[node] = false;
+        markChanged(node);
+    }
+    terminalNodes.clear();
+    terminalsMarked = false;
+
+    // Nothing but other marks links to them, so the tree is left as before marking
+    for (auto node = markNodes.rbegin(); node != markNodes.rend(); ++node) {
+        mergeUnaryNode(*node);
+    }
+    markNodes.clear();
+}
+
+// Splits the edge at the point unless the point is at its end, returns the node at the point
+NodeId CSuffixTree::makeExplicit(CPoint &point) {
+    if (point.edge == NONE) {
+        return point.node;
+    }
+    if (point.relativeIndex + 1 == edgeLength(point.node, point.edge)) {
+        return endNode(point.edge);
+    }
+
+    const NodeId node = point.node;
+    const EdgeId edge = point.edge;
+    NodeId newNode = arena.addNode(edgeBeginIndex(node, edge) - nodeDepth(node), nodeDepth(node) + point.relativeIndex + 1);
+    setEdge(node, newNode);
+    setEdge(newNode, edge);
+    markChanged(newNode);
+    markNodes.push_back(newNode);
+
+    point.edge = newNode;
+    return newNode;
+}
+
+// Memory used by the tree and the source string per input character
+double CSuffixTree::bytesPerCharacter() const {
+    return (arena.bytesUsed() + sourceString.bytesUsed() + letterIndex.bytesUsed() + leafParent.capacity() * sizeof(NodeId)) / (double)std::max((size_t)1, sourceString.size());
+}
+
+std::pair<size_t, size_t> CSuffixTree::nodesAndLeaves() {
+    size_t nodes = 1;
+    size_t leaves = 0;
+    walkTree(ROOT, [&](NodeId, EdgeId edge) {
+        ++(isLeaf(edge) ? leaves : nodes);
+        return true;
+    }, [](NodeId) {
+    });
+    return std::make_pair(nodes, leaves);
+}
+
+void CSuffixTree::recordBuildCounters() {
+    if (!treeCountersEnabled || !runStats().isEnabled()) {
+        return;
+    }
+    runStats().setValue("extension_phases", buildCounters.phases);
+    runStats().setValue("edge_splits", buildCounters.edgeSplits);
+    runStats().setValue("leaf_creations", buildCounters.leafCreations);
+    runStats().setValue("suffix_link_follows", buildCounters.suffixLinkFollows);
+    runStats().setValue("skip_count_hops", buildCounters.skipCountHops);
+    runStats().setValue("same_point_exits", buildCounters.samePointExits);
+    runStats().setHistogram("hops_per_phase", buildCounters.hopsPerPhase.counts());
+
+    // Shape of the tree built, the root is at depth 0
+    CLogHistogram fanOut;
+    CLogHistogram nodeDepth;
+    nodeDepth.add(0);
+    walkTree(ROOT, [](NodeId, EdgeId) {
+        return true;
+    }, [&](NodeId node) {
+        size_t children = 0;
+        for (CChildIterator child(arena, node); child.valid(); child.next()) {
+            ++children;
+        }
+        fanOut.add(children);
+    }, [&](NodeId, EdgeId, size_t level) {
+        nodeDepth.add(level + 1);
+        return false;
+    });
+    runStats().setHistogram("fan_out", fanOut.counts());
+    runStats().setHistogram("node_depth", nodeDepth.counts());
+}
+
+// Walks the subtree of the top node depth first, children in the order of letters
+template <typename TVisitEdge, typename TLeaveNode>
+void CSuffixTree::walkTree(NodeId top, TVisitEdge visitEdge, TLeaveNode leaveNode) {
+    walkTree(top, visitEdge, leaveNode, [](NodeId, EdgeId, size_t) { return false; });
+}
+
+template <typename TVisitEdge, typename TLeaveNode, typename TSplitEdge>
+void CSuffixTree::walkTree(NodeId top, TVisitEdge visitEdge, TLeaveNode leaveNode, TSplitEdge splitEdge) {
+    // Nodes above the current one with cursors of their children, 8 bytes per level
+    vector<pair<NodeId, uint32_t>> stack;
+
+    NodeId node = top;
+    uint32_t cursor = 0;
+    while (true) {
+        CChildIterator child(arena, node, cursor);
+        if (!child.valid()) {
+            leaveNode(node);
+            if (stack.empty()) {
+                return;
+            }
+            node = stack.back().first;
+            cursor = stack.back().second;
+            stack.pop_back();
+            continue;
+        }
+
+        const EdgeId edge = *child;
+        cursor = child.resumeCursor();
+        if (visitEdge(node, edge) && !isLeaf(edge) && !splitEdge(node, edge, stack.size())) {
+            stack.emplace_back(node, cursor);
+            node = edge;
+            cursor = 0;
+        }
+    }
+}
+
+// Walks the whole tree in tasks on the pool, every task walks a subtree
+template <typename TState, typename TVisitEdge, typename TLeaveNode, typename TSplitEdge>
+void CSuffixTree::walkTreeInTasks(std::deque<TState> &states, TVisitEdge visitEdge, TLeaveNode leaveNode, TSplitEdge splitEdge) {
+    // Top node and its level of every task, states grow with them
+    std::deque<pair<NodeId, size_t>> tasks;
+    std::mutex tasksMutex;
+
+    states.clear();
+    states.emplace_back();
+    tasks.emplace_back(ROOT, 0);
+
+    std::function<void(size_t)> walkTask = [&](size_t task) {
+        NodeId top;
+        size_t topLevel;
+        TState *state;
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            top = tasks[task].first;
+            topLevel = tasks[task].second;
+            state = &states[task];
+        }
+
+        walkTree(top, [&](NodeId node, EdgeId edge) {
+            return visitEdge(*state, node, edge);
+        }, [&](NodeId node) {
+            if (node != top) {
+                leaveNode(*state, node);
+            }
+        }, [&](NodeId node, EdgeId edge, size_t level) {
+            if (!pool || topLevel + level >= MAX_SPLIT_LEVEL || !pool->wantsTasks()) {
+                return false;
+            }
+            size_t newTask;
+            {
+                std::lock_guard<std::mutex> lock(tasksMutex);
+                newTask = tasks.size();
+                tasks.emplace_back(edge, topLevel + level + 1);
+                states.emplace_back();
+            }
+            splitEdge(*state, node, edge, newTask);
+            pool->spawn([&walkTask, newTask]() { walkTask(newTask); });
+            return true;
+        });
+    };
+
+    if (pool) {
+        pool->run([&walkTask]() { walkTask(0); });
+    } else {
+        walkTask(0);
+    }
 }
 
 // Print tree horizontally into console in hierarchically offsetted way
-void CSuffixTree::print(CNode *node, string offset) {
+void CSuffixTree::print(NodeId top, string offset) {
     cout << offset << "*"
          << endl;
 
-    for (auto edgesIterator = node->edges.begin(); edgesIterator != node->edges.end(); ++edgesIterator) {
+    walkTree(top, [&](NodeId node, EdgeId edge) {
         cout
             << " "
             <<  offset
             <<  sourceString.substr(
-                      edgesIterator->second->beginIndex
-                    , edgesIterator->second->getRealEndIndex() - edgesIterator->second->beginIndex + 1
+                      edgeBeginIndex(node, edge)
+                    , edgeLength(node, edge)
                 )
             << " ("
-            << edgesIterator->second->beginIndex
+            << edgeBeginIndex(node, edge)
             << ", "
-            << edgesIterator->second->getRealEndIndex() //endIndex
+            << edgeBeginIndex(node, edge) + edgeLength(node, edge) - 1
             << ") '"
-            <<  edgesIterator->first
+            <<  letterFromRelativeIndex(node, edge, 0)
             << "' "
-            << "occurrences=" << edgesIterator->second->occurrenceNumber
+            << "occurrences=" << occurrenceNumber(edge)
             << endl;
 
-        if( edgesIterator->second->endNode != nullptr )
-            print( edgesIterator->second->endNode , offset + " " );
-    }
+        if( endNode(edge) != NONE ) {
+            offset += " ";
+            cout << offset << "*"
+                 << endl;
+        }
+        return true;
+    }, [&](NodeId node) {
+        if (node != top) {
+            offset.resize(offset.size() - 1);
+        }
+    });
 }
 
-// Computes how many times specific edge happened in the text
-BigInt CSuffixTree::countOccurrences(CNode *node) {
-    BigInt count = 0;
-    for (auto edgesIterator = node->edges.begin() ; edgesIterator != node->edges.end() ; ++edgesIterator) {
-        if( edgesIterator->second->endNode != nullptr ) {
-            BigInt occurrenceNumber = countOccurrences( edgesIterator->second->endNode );
-            edgesIterator->second->occurrenceNumber = occurrenceNumber;
-            count += occurrenceNumber;
-        } else {
-            edgesIterator->second->occurrenceNumber = 1;
-            count += 1;
+// Computes how many times specific edge happened in the text.
+// Counts are summed up in occurrence numbers of nodes on the way up.
+// A task doesn't add up the count of a subtree split off, it is added to all its ancestors after the walk.
+void CSuffixTree::countOccurrences() {
+    CStatsPhase phase("count_occurrences");
+    if (!documentStart.empty()) {
+        countOccurrencesOfDocuments();
+        return;
+    }
+    arena.occurrenceNumber[ROOT] = 0;
+
+    // Tops of subtrees split off by every task
+    std::deque<vector<NodeId>> splitTops;
+    walkTreeInTasks(splitTops, [this](vector<NodeId> &, NodeId node, EdgeId edge) {
+        if (endNode(edge) != NONE && (allChanged || isChanged[edge])) {
+            const bool terminal = edge < isTerminal.size() && isTerminal[edge];
+            arena.occurrenceNumber[edge] = terminal ? leafWeights.at(sourceString.size() - nodeDepth(edge)) : 0;
+            return true;
+        }
+        arena.occurrenceNumber[node] += occurrenceNumber(edge);
+        return false;
+    }, [this](vector<NodeId> &, NodeId node) {
+        arena.occurrenceNumber[ arena.parent[node] ] += arena.occurrenceNumber[node];
+    }, [](vector<NodeId> &tops, NodeId, EdgeId edge, size_t) {
+        tops.push_back(edge);
+    });
+
+    // Counts of split subtrees without subtrees split off them, added up to the root once each
+    vector<pair<NodeId, uint32_t>> splitCounts;
+    for (const auto &tops: splitTops) {
+        for (const auto top: tops) {
+            splitCounts.emplace_back(top, arena.occurrenceNumber[top]);
+        }
+    }
+    for (const auto &split: splitCounts) {
+        for (NodeId node = arena.parent[split.first]; node != NONE; node = arena.parent[node]) {
+            arena.occurrenceNumber[node] += split.second;
         }
     }
-    return count;
 }
 
-// Prepares CFrequencyToEdgeMap for use in getTopSuitableSubstrings(...)
-void CSuffixTree::initializeFreqToEdgeMap(CNode *node, CFrequencyToEdgeMap &freqToEdgeMap, BigInt minimalLength, BigInt depth, string prefix) {
-
-
-
-    // Get first edges with enough letters in the beginning to meet the requirement
-    // of substing length more or equal to minimalLength.
-    // Length is counted as a sum or all edges lengths from the tree root.
-    for (auto edgesIterator = node->edges.begin() ; edgesIterator != node->edges.end() ; ++edgesIterator) {
-        BigInt edgeLength = 1 + edgesIterator->second->getRealEndIndex() - edgesIterator->second->beginIndex;
+// Counts occurrences and numbers of documents in one walk of the whole tree by a single task.
+// Suffixes come in the order of the walk, every one adds its document to its node, and the previous
+// suffix of the same document has added it already, so it is taken back at their lowest common ancestor.
+// Sums over subtrees are numbers of distinct documents then, like in Hui's counting of colors.
+// The common ancestor is the deepest node of the path entered before the previous suffix was walked.
+// A subtree split off would need the documents of the others, so the walk is not split.
+void CSuffixTree::countOccurrencesOfDocuments() {
+    arena.occurrenceNumber[ROOT] = 0;
+    // Sums of a node may be taken back below zero for a while, unsigned numbers wrap around exactly
+    documentNumber.assign(arena.size(), 0);
+
+    // Number of the last suffix walked of every document
+    vector<uint32_t> lastSuffix(documentStart.size(), NONE);
+    uint32_t suffixesWalked = 0;
+    // Nodes of the path with numbers of suffixes walked before them
+    vector<pair<NodeId, uint32_t>> path = { {ROOT, 0} };
+
+    auto addSuffix = [&](NodeId node, BigInt position) {
+        const size_t document = documentOf(position);
+        documentNumber[node] += 1;
+        if (lastSuffix[document] != NONE) {
+            const uint32_t previous = lastSuffix[document];
+            const auto ancestor = std::upper_bound(path.begin(), path.end(), previous, [](uint32_t suffix, const pair<NodeId, uint32_t> &entry) {
+                return suffix < entry.second;
+            }) - 1;
+            documentNumber[ancestor->first] -= 1;
+        }
+        lastSuffix[document] = suffixesWalked++;
+    };
+
+    walkTree(ROOT, [&](NodeId node, EdgeId edge) {
+        if (endNode(edge) != NONE) {
+            const bool terminal = edge < isTerminal.size() && isTerminal[edge];
+            path.emplace_back(edge, suffixesWalked);
+            arena.occurrenceNumber[edge] = 0;
+            if (terminal) {
+                const BigInt position = sourceString.size() - nodeDepth(edge);
+                arena.occurrenceNumber[edge] = leafWeights.at(position);
+                addSuffix(edge, position);
+            }
+            return true;
+        }
+        arena.occurrenceNumber[node] += occurrenceNumber(edge);
+        addSuffix(node, edge & ~CTreeArena::LEAF_FLAG);
+        return false;
+    }, [&](NodeId node) {
+        path.pop_back();
+        if (node != ROOT) {
+            arena.occurrenceNumber[ arena.parent[node] ] += arena.occurrenceNumber[node];
+            documentNumber[ arena.parent[node] ] += documentNumber[node];
+        }
+    });
+}
 
-        string edgeString = sourceString.substr(
-            edgesIterator->second->beginIndex
-            ,edgeLength
-        );
+// Document of a position of the string
+size_t CSuffixTree::documentOf(BigInt position) const {
+    return std::upper_bound(documentStart.begin(), documentStart.end(), (uint32_t)position) - documentStart.begin() - 1;
+}
 
-        BigInt firstNonLetterOffset = -1; // initially end of current substring
-        for ( BigInt index = 0 ; index < (ssize_t)edgeString.length() ; ++index ) {
-            // Find first non-letter symbol on this edge
-            if ( !isalpha(static_cast<unsigned char>(edgeString[index])) ) {
-                firstNonLetterOffset = index;
-                break;
-            }
+// Counts substrings of every minimal length and collects their candidates for top substrings in one walk
+void CSuffixTree::walkLongSubstrings(vector<CLongSubstrings> &lengths) {
+    // Substrings counted and candidates found by a task for every minimal length, numbered in the order
+    // of the walk, with places where subtrees split off would have been walked.
+    // With takeTopN > 0 candidates are a min-heap of the best ones found so far.
+    struct CFoundEdges {
+        vector<BigInt> counts;
+        vector<vector<CEdgeCandidate>> edges;
+        uint64_t edgesNumber = 0;
+        vector<pair<uint64_t, size_t>> splits;
+    };
+
+    CStatsPhase phase("long_substrings");
+    std::deque<CFoundEdges> found;
+    walkTreeInTasks(found, [&](CFoundEdges &foundEdges, NodeId node, EdgeId edge) {
+        if (startsInCodePoint(node, edge)) {
+            return false;
+        }
+        const BigInt depth = nodeLength(node);
+        const BigInt letterBytes = edgeLetters(node, edge);
+        const BigInt letters = prefixLength(node, edge, letterBytes);
+        if (foundEdges.counts.empty()) {
+            foundEdges.counts.assign(lengths.size(), 0);
+            foundEdges.edges.resize(lengths.size());
         }
 
-        // No spaces on the edge
-        if (firstNonLetterOffset == -1) {
-            // Add either this edge or its children
-            if ( (depth + edgeLength) >= minimalLength ) {
-                freqToEdgeMap[ edgesIterator->second->occurrenceNumber ].emplace_back( depth, prefix, firstNonLetterOffset, edgesIterator->second );
-            } else {
-                if ( edgesIterator->second->endNode != nullptr ) {
-                    initializeFreqToEdgeMap( edgesIterator->second->endNode, freqToEdgeMap, minimalLength, (depth + edgeLength), (prefix + edgeString) );
+        for (size_t length = 0; length < lengths.size(); ++length) {
+            const BigInt minimalLength = lengths[length].minimalLength;
+            // For every letter making a long enough substring count as many times as this edge has occurred in the text
+            const BigInt longLetters = letters - std::max((BigInt)0, std::min(letters, minimalLength - depth - 1));
+            foundEdges.counts[length] += longLetters * occurrenceNumber(edge);
+
+            // First edges with enough letters in the beginning to meet the requirement
+            // of substing length more or equal to minimalLength.
+            // Worse candidates than takeTopN others are never expanded.
+            if (lengths[length].collectCandidates && depth < minimalLength && depth + letters >= minimalLength) {
+                vector<CEdgeCandidate> &edges = foundEdges.edges[length];
+                const size_t takeTopN = lengths[length].takeTopN;
+                const BigInt weight = lengths[length].byDocuments ? edgeDocuments(edge) : occurrenceNumber(edge);
+                edges.emplace_back( weight, foundEdges.edgesNumber, node, edge, letters );
+                if (takeTopN > 0) {
+                    std::push_heap(edges.begin(), edges.end(), std::greater<CEdgeCandidate>());
+                    if (edges.size() > takeTopN) {
+                        std::pop_heap(edges.begin(), edges.end(), std::greater<CEdgeCandidate>());
+                        edges.pop_back();
+                    }
                 }
             }
-        } else {
-            // Have a space in the middle of the string
-            if ( (depth + firstNonLetterOffset) >= minimalLength ) {
-                freqToEdgeMap[ edgesIterator->second->occurrenceNumber ].emplace_back( depth, prefix, firstNonLetterOffset, edgesIterator->second );
-            }
         }
+        // Numbers are shared by all lengths, only their order matters
+        ++foundEdges.edgesNumber;
+
+        // No non-letters on the edge, walk below it
+        return letterBytes == edgeLength(node, edge);
+    }, [](CFoundEdges &, NodeId) {
+    }, [](CFoundEdges &foundEdges, NodeId, EdgeId, size_t task) {
+        foundEdges.splits.emplace_back(foundEdges.edgesNumber, task);
+    });
+
+    for (auto &foundEdges: found) {
+        foundEdges.counts.resize(lengths.size(), 0);
+        foundEdges.edges.resize(lengths.size());
     }
-}
-
-// Auxiliry function to initialis
-BigInt CSuffixTree::getNumbetOfSubstringsLongerThan(BigInt minimalLength, CNode *node, BigInt depth) {
-    if (node == nullptr)
-        node = root;
 
-    BigInt count = 0;
-    for (auto edgesIterator = node->edges.begin() ; edgesIterator != node->edges.end() ; ++edgesIterator) {
-        BigInt edgeLength = 1 + edgesIterator->second->getRealEndIndex() - edgesIterator->second->beginIndex;
-
-        // Temporary string for convenience
-        string edgeString = sourceString.substr(edgesIterator->second->beginIndex, edgeLength);
-
-        BigInt firstNonLetterOffset = -1; // initially end of current substring
-        for (BigInt index = 0 ; index < (ssize_t)edgeString.length() ; ++index) {
+    for (size_t length = 0; length < lengths.size(); ++length) {
+        CLongSubstrings &longSubstrings = lengths[length];
+        longSubstrings.count = 0;
+        for (const auto &foundEdges: found) {
+            longSubstrings.count += foundEdges.counts[length];
+        }
+        longSubstrings.candidates.clear();
+        if (!longSubstrings.collectCandidates) {
+            continue;
+        }
 
-            if ( !isalpha(static_cast<unsigned char>(edgeString[index])) ) {
-                firstNonLetterOffset = index;
-                break;
-            }
+        // Kept candidates of every task go back into the order of the walk
+        for (auto &foundEdges: found) {
+            std::sort(foundEdges.edges[length].begin(), foundEdges.edges[length].end(), [](const CEdgeCandidate &a, const CEdgeCandidate &b) {
+                return a.order < b.order;
+            });
+        }
 
-            // Calculate substrings longer or equal than minimum and before nonletter symbol appears
-            if ( (depth + index + 1) >= minimalLength ) {
-                // For every letter count as many times as this edge has occurred in the text
-                long long times = edgesIterator->second->occurrenceNumber;
-                count += times;
+        // Candidates are numbered in the order of a walk by a single task, so the results don't depend on threads.
+        // Tasks being merged with their next candidate and next split, splits nest MAX_SPLIT_LEVEL deep at most.
+        struct CMergePosition {
+            size_t task;
+            size_t edge;
+            size_t split;
+        };
+        vector<CEdgeCandidate> &candidates = longSubstrings.candidates;
+        vector<CMergePosition> stack = { {0, 0, 0} };
+        while (!stack.empty()) {
+            CMergePosition &position = stack.back();
+            CFoundEdges &foundEdges = found[position.task];
+            const vector<CEdgeCandidate> &edges = foundEdges.edges[length];
+            const bool edgeLeft = position.edge < edges.size();
+            if (position.split < foundEdges.splits.size()
+                    && (!edgeLeft || foundEdges.splits[position.split].first <= edges[position.edge].order)) {
+                const size_t task = foundEdges.splits[position.split++].second;
+                stack.push_back({task, 0, 0});
+            } else if (edgeLeft) {
+                candidates.push_back(edges[position.edge++]);
+                candidates.back().order = candidates.size() - 1;
+            } else {
+                vector<CEdgeCandidate>().swap(foundEdges.edges[length]);
+                stack.pop_back();
             }
         }
 
-        // No spaces on the edge
-        if (firstNonLetterOffset == -1) {
-            // If edge has a nonempty end node
-            if ( edgesIterator->second->endNode != nullptr ) {
-                long long nestedSubstringsNumber = getNumbetOfSubstringsLongerThan(minimalLength, edgesIterator->second->endNode, (depth + edgeLength) );
-                count += nestedSubstringsNumber;
-            }
+        // The best takeTopN of all tasks
+        const size_t takeTopN = longSubstrings.takeTopN;
+        if (takeTopN > 0 && candidates.size() > takeTopN) {
+            std::nth_element(candidates.begin(), candidates.begin() + (takeTopN - 1), candidates.end(), std::greater<CEdgeCandidate>());
+            candidates.erase(candidates.begin() + takeTopN, candidates.end());
         }
     }
-    return count;
+}
+
+// Get number of substrings longer than given minimalLength
+BigInt CSuffixTree::getNumbetOfSubstringsLongerThan(BigInt minimalLength) {
+    refreshOccurrences();
+    vector<CLongSubstrings> lengths = { {minimalLength, 0, false, false, 0, {}} };
+    walkLongSubstrings(lengths);
+    return lengths[0].count;
 }
 
 // Get tpp N substrings by occurrence frequency with minimal length more or equal to minimalLength
 CFrequencyInfo CSuffixTree::getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength) {
+    return getTopSuitableSubstringsMany({ {takeTopN, minimalLength} })[0].topN;
+}
 
-    CFrequencyToEdgeMap freqToEdgeMap;
-    initializeFreqToEdgeMap(root, freqToEdgeMap, minimalLength, 0);
+// Answers of all top queries out of one walk of the tree, queries of the same minimal length
+// share its count and candidates, which are collected for the greatest N of them
+vector<CTopAnswer> CSuffixTree::getTopSuitableSubstringsMany(const vector<CTopQuery> &queries) {
+    refreshOccurrences();
 
-    CFrequencyInfo topN;
+    vector<CLongSubstrings> lengths;
+    vector<size_t> lengthOfQuery;
+    for (const auto &query: queries) {
+        if (query.byDocuments && documentStart.empty()) {
+            throw std::runtime_error("Suffix tree is not a tree of documents!");
+        }
+        size_t length = 0;
+        while (length < lengths.size() && (lengths[length].minimalLength != query.minimalLength
+                                           || lengths[length].byDocuments != query.byDocuments)) {
+            ++length;
+        }
+        if (length == lengths.size()) {
+            lengths.push_back({query.minimalLength, query.takeTopN, query.byDocuments, true, 0, {}});
+        } else if (lengths[length].takeTopN > 0) {
+            // 0 takes all substrings
+            lengths[length].takeTopN = (query.takeTopN == 0) ? 0 : std::max(lengths[length].takeTopN, query.takeTopN);
+        }
+        lengthOfQuery.push_back(length);
+    }
+    walkLongSubstrings(lengths);
+
+    vector<CTopAnswer> answers;
+    for (size_t index = 0; index < queries.size(); ++index) {
+        const CTopQuery &query = queries[index];
+        const CLongSubstrings &longSubstrings = lengths[ lengthOfQuery[index] ];
+        // Candidates are used up by taking, every query takes a copy
+        vector<CEdgeCandidate> candidates = longSubstrings.candidates;
+        // Percentages of documents are of all documents
+        const double denominator = query.byDocuments ? (double)documentStart.size() : (double)longSubstrings.count;
+        answers.push_back({ takeTopSubstrings(candidates, query, denominator), longSubstrings.count });
+    }
+    return answers;
+}
 
-    // Number of all substrings of appropriate length in the text
-    double numberOfLongSubstrings = getNumbetOfSubstringsLongerThan(minimalLength);
-
-    // While we have candidate prefixed edges to process
-    while (!freqToEdgeMap.empty()) {
-        // Take top frequency bucket
-        auto freqTopIt = freqToEdgeMap.begin();
-
-        // Iterate the top bucket
-        while (!freqTopIt->second.empty()) {
-            // Get current edge from vector
-            CPrefixedEdge prefixedEdge = freqTopIt->second.back();
-            freqTopIt->second.pop_back();
-
-            // String the edge represents
-            string edgeSubstring = sourceString.substr(
-                        prefixedEdge.edgePtr->beginIndex
-                        ,prefixedEdge.edgePtr->getRealEndIndex() - prefixedEdge.edgePtr->beginIndex + 1);
-
-            // Edge has non-letter charackters
-            if (prefixedEdge.firstNonLetterOffset != -1) {
-                // Take only substring before first non-letter symbol
-                edgeSubstring = edgeSubstring.substr(0, prefixedEdge.firstNonLetterOffset);
-            }
+// Top substrings of a query out of its candidate edges, the candidates are used up.
+// Candidate edges are kept in a max-heap by occurrences or documents, strings are made for the substrings taken only
+CFrequencyInfo CSuffixTree::takeTopSubstrings(vector<CEdgeCandidate> &candidates, const CTopQuery &query, double denominator) {
+    CStatsPhase phase("top_selection");
+    const size_t takeTopN = query.takeTopN;
+    const BigInt minimalLength = query.minimalLength;
+    // Candidates beyond the top N of this query are never taken
+    if (takeTopN > 0 && candidates.size() > takeTopN) {
+        std::nth_element(candidates.begin(), candidates.begin() + (takeTopN - 1), candidates.end(), std::greater<CEdgeCandidate>());
+        candidates.erase(candidates.begin() + takeTopN, candidates.end());
+    }
+    std::make_heap(candidates.begin(), candidates.end());
+    // Children go after all candidates collected, some of them could be cut off
+    uint64_t nextOrder = 0;
+    for (const auto &candidate: candidates) {
+        nextOrder = std::max(nextOrder, candidate.order + 1);
+    }
 
-            // Iterate over symbols on this edge from closest to root
-            const ssize_t beginIndex = std::max((BigInt)1, minimalLength - prefixedEdge.prefixLength);
-            for (size_t cutOff = beginIndex; cutOff <= edgeSubstring.size(); ++cutOff) {
-                // Output substring and its frequency into vector topN
-                topN.emplace_back(prefixedEdge.prefixString + edgeSubstring.substr(0, cutOff), 100 * freqTopIt->first / numberOfLongSubstrings);
+    CFrequencyInfo topN;
 
-                // If we have enough data in topN, quit
-                if ( (takeTopN > 0) && (topN.size() >= takeTopN) ) {
-                    return topN;
-                }
+    // While we have candidate edges to process
+    while (!candidates.empty()) {
+        // Take the top candidate
+        std::pop_heap(candidates.begin(), candidates.end());
+        const CEdgeCandidate candidate = candidates.back();
+        candidates.pop_back();
+
+        // Iterate over symbols on this edge from closest to root,
+        // only before the first non-letter symbol if it has one
+        const BigInt depth = nodeLength(candidate.node);
+        const ssize_t beginIndex = std::max((BigInt)1, minimalLength - depth);
+        for (size_t cutOff = beginIndex; cutOff <= candidate.letters; ++cutOff) {
+            // Output substring and its frequency into vector topN
+            topN.emplace_back(edgeSubstring(candidate.node, candidate.edge, cutOff), 100 * candidate.count / denominator);
+
+            // If we have enough data in topN, quit
+            if ( (takeTopN > 0) && (topN.size() >= takeTopN) ) {
+                return topN;
             }
+        }
 
-            if (prefixedEdge.firstNonLetterOffset == -1) {
-                // Fill in helper data about this edge before processing child edges
-                auto prefix = prefixedEdge.prefixString + edgeSubstring;
-                auto node = prefixedEdge.edgePtr->endNode;
-                BigInt depth = prefixedEdge.prefixLength;
-
-                // If edge has a valid end node
-                if (node != nullptr) {
-                    // For every child edge
-                    for (auto edgesIterator = node->edges.begin(); edgesIterator != node->edges.end(); ++edgesIterator) {
-                        BigInt edgeLength = 1 + edgesIterator->second->getRealEndIndex() - edgesIterator->second->beginIndex;
-
-                        string edgeString = sourceString.substr(
-                            edgesIterator->second->beginIndex
-                            ,edgeLength
-                        );
-
-                        // Find if there is a non-letter charecter on this edge
-                        BigInt firstNonLetterOffset = -1; // initially end of current substring
-                        for (size_t index = 0; index <= edgeString.length() ; ++index) {
-                            if ( isspace(edgeString[ index ]) || (edgeString[ index ] == '$') ) {
-                                // Bot first non-letter
-                                firstNonLetterOffset = index;
-                                break;
-                            }
-                        }
-
-                        if (firstNonLetterOffset == -1) { // No non-letter characters on this edge
-                            freqToEdgeMap[edgesIterator->second->occurrenceNumber].emplace_back(depth, prefix, firstNonLetterOffset, edgesIterator->second);
-                        } else if (firstNonLetterOffset > 0) { // Have a non-letter character in the middle of this edge
-                            freqToEdgeMap[edgesIterator->second->occurrenceNumber].emplace_back(depth, prefix, firstNonLetterOffset, edgesIterator->second);
-                        }
-                    }
-                }
+        // Children start below the whole edge, if it has no non-letters
+        const NodeId node = endNode(candidate.edge);
+        if (node == NONE || edgeLetters(candidate.node, candidate.edge) != edgeLength(candidate.node, candidate.edge)) {
+            continue;
+        }
+
+        // For every child edge, edges starting with a non-letter have no substrings
+        for (CChildIterator child(arena, node); child.valid(); child.next()) {
+            const EdgeId edge = *child;
+            const BigInt letters = prefixLength(node, edge, edgeLetters(node, edge));
+            if (letters > 0) {
+                candidates.emplace_back(query.byDocuments ? edgeDocuments(edge) : occurrenceNumber(edge), nextOrder++, node, edge, letters);
+                std::push_heap(candidates.begin(), candidates.end());
             }
         }
-        // If we got here, freqTopIt->second has no entries left nad is ready to be removed
-        freqToEdgeMap.erase(freqTopIt);
     }
     return topN;
 }
 
-// Auxiliary debug print function
-void CSuffixTree::printCurrentTopEdges ( CFrequencyToEdgeMap &freqToEdgeMap ) {
-    for (auto &freqPair : freqToEdgeMap) {
-        for (auto &prefixedEdge : freqPair.second) {
-            string edgeSubstring = sourceString.substr(
-                        prefixedEdge.edgePtr->beginIndex
-                        ,prefixedEdge.edgePtr->getRealEndIndex() - prefixedEdge.edgePtr->beginIndex + 1
-                    );
-
-            if (prefixedEdge.firstNonLetterOffset != -1) {
-                    edgeSubstring = edgeSubstring.substr(0, prefixedEdge.firstNonLetterOffset);
-            }
+// Number of occurrences of a non-empty pattern in the string
+BigInt CSuffixTree::count(const string &pattern) {
+    return countMany({pattern})[0];
+}
 
-            std::cout
-                    << freqPair.first << " : '"
-                    << prefixedEdge.prefixString
-                    << edgeSubstring
-                    << "'"
-                    << std::endl;
-        }
+// Numbers of occurrences of patterns, in their order
+vector<BigInt> CSuffixTree::countMany(const vector<string> &patterns) {
+    refreshOccurrences();
+    vector<BigInt> counts;
+    for (const EdgeId edge: findPatternEdges(patterns)) {
+        counts.push_back((edge == NONE) ? 0 : occurrenceNumber(edge));
     }
+    return counts;
 }
 
-// For memory recaimation on tree destruction
-CEdge* CSuffixTree::newCEdge() {
-    edgesKeeper.emplace_back(new CEdge(this)); // TODO: Use make_unique
-    return edgesKeeper.back().get();
+// Numbers of documents the patterns occur in, in their order
+vector<BigInt> CSuffixTree::countDocuments(const vector<string> &patterns) {
+    if (documentStart.empty()) {
+        throw std::runtime_error("Suffix tree is not a tree of documents!");
+    }
+    refreshOccurrences();
+    vector<BigInt> counts;
+    for (const EdgeId edge: findPatternEdges(patterns)) {
+        counts.push_back((edge == NONE) ? 0 : edgeDocuments(edge));
+    }
+    return counts;
 }
 
-// For memory recaimation on tree destruction
-CNode* CSuffixTree::newCNode() {
-    nodesKeeper.emplace_back(new CNode(this)); // TODO: Use make_unique
-    return nodesKeeper.back().get();
+// Edges the patterns end on, in their order, NONE for patterns not in the string.
+// Patterns are taken sorted, so a pattern shares its descent with the previous one
+// up to their common prefix, and the rest of it goes from the last node passed there.
+vector<EdgeId> CSuffixTree::findPatternEdges(const vector<string> &patterns) const {
+    CStatsPhase phase("count_patterns");
+    vector<size_t> order(patterns.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&patterns](size_t first, size_t second) {
+        return patterns[first] < patterns[second];
+    });
+
+    vector<EdgeId> edges(patterns.size(), NONE);
+    // Nodes passed by the previous pattern with numbers of its letters matched above them
+    vector<pair<NodeId, BigInt>> path = { {ROOT, 0} };
+    const string *previous = nullptr;
+    EdgeId previousEdge = NONE;
+    // Letters of the previous pattern found in the tree, the next one is not there
+    BigInt found = 0;
+
+    for (const size_t index: order) {
+        const string &pattern = patterns[index];
+        if (pattern.empty()) {
+            continue;
+        }
+        BigInt common = 0;
+        if (previous != nullptr) {
+            const BigInt shorter = std::min(previous->size(), pattern.size());
+            common = std::mismatch(pattern.begin(), pattern.begin() + shorter, previous->begin()).first - pattern.begin();
+        }
+        // Same patterns and patterns going on after a part not in the tree
+        if (previous != nullptr && (common == (BigInt)pattern.size() || common > found)) {
+            edges[index] = (common > found) ? NONE : previousEdge;
+            previous = &pattern;
+            previousEdge = edges[index];
+            continue;
+        }
+        previous = &pattern;
+        previousEdge = NONE;
+
+        // Sorted patterns go on after their common prefix, nodes deeper than it are left
+        while (path.back().second > common) {
+            path.pop_back();
+        }
+        NodeId node = path.back().first;
+        BigInt matched = path.back().second;
+        found = matched;
+        while (true) {
+            // Symbols out of the dictionary have no codes to look children up with
+            const EdgeId edge = (symbolCode[ (unsigned char)pattern[matched] ] == CTreeArena::NO_SYMBOL)
+                                ? NONE : edgeFromLetter(node, pattern[matched]);
+            if (edge == NONE) {
+                break;
+            }
+            // Labels are compared in place, memcmp-like over the mapped or owned text
+            const BigInt length = std::min(edgeLength(node, edge), (BigInt)pattern.size() - matched);
+            const char *label = sourceString.data() + edgeBeginIndex(node, edge);
+            const BigInt same = std::mismatch(label, label + length, pattern.begin() + matched).first - label;
+            found = matched + same;
+            if (same < length) {
+                break;
+            }
+            matched += length;
+            if (matched == (BigInt)pattern.size()) {
+                previousEdge = edge;
+                break;
+            }
+            node = endNode(edge);
+            if (node == NONE) {
+                break;
+            }
+            path.emplace_back(node, matched);
+        }
+        edges[index] = previousEdge;
+    }
+    return edges;
+}
+
+// Auxiliary debug print function
+void CSuffixTree::printCandidates ( const vector<CEdgeCandidate> &candidates ) {
+    for (auto &candidate : candidates) {
+        std::cout
+                << candidate.count << " : '"
+                << edgeSubstring(candidate.node, candidate.edge, candidate.letters)
+                << "'"
+                << std::endl;
+    }
 }
@@ -1,23 +1,35 @@
 #pragma once
 
 #include "print.h"
+#include "distinct_words.h"
+#include "text.h"
+#include "work_stealing_pool.h"
+#include "letter_index.h"
+#include "storage.h"
+#include "dictionary.h"
+#include "build_counters.h"
 
 #include <map>
-#include <vector>
-#include <utility>
-#include <unordered_set>
 #include <deque>
 #include <memory>
+#include <vector>
+#include <utility>
 #include <string>
 #include <iostream>
+#include <cstdint>
+#include <unordered_map>
+#include <algorithm>
 
-class CEdge;
-class CVirtualEdge;
-class CNode;
 class CPoint;
 class CSuffixTree;
+class CMappedFile;
 
-typedef ssize_t BigInt;
+// Index of an internal node in CTreeArena
+typedef uint32_t NodeId;
+// Edge of the tree, identified by its lower end:
+// either an internal node index or a leaf number marked with LEAF_FLAG.
+// Leaf number is the position in the source string where its suffix starts.
+typedef uint32_t EdgeId;
 
 // Point in a suffix tree, used in splitting
 class CPoint {
@@ -25,72 +37,246 @@ public:
     // Owning tree
     CSuffixTree *tree;
     BigInt relativeIndex;
-    // Current edge for processing
-    CEdge *edge;
+    // Node the current edge starts from
+    NodeId node;
+    // Current edge for processing, NONE when the point is at the node itself
+    EdgeId edge;
 
     // It either increases current point position or splits an edge/adds new edge
     // returns 1 if increase succeeded
     //         0 if split/add happened
-    // If split happens the point doesn't change.
-    BigInt increaseOrSplit(char letter, CNode ** return_node);
+    // If split happens the point stays at the same place of the text,
+    // but its edge is now the upper part of the split edge.
+    BigInt increaseOrSplit(char letter, NodeId *returnNode);
     CPoint(CSuffixTree*);
 };
 
-// Prefixed edge keeps a prefix string for this edge
-// that is a concatenation of all edges from root to this edge
-// Also keeps sum of strings on those edges, whish is equal to prefix string length
-// Also keeps location of the first non-letter symbol on this edge, if any.
-// And a pointer to the edge itself
+// Children of a node with a small fan-out are kept inline:
+// codes of the first letters of up to INLINE_CHILDREN edges are packed
+// into `letters` in ascending order, unused bytes are NO_SYMBOL.
+// A node with more children keeps a mark in `letters`:
+//   BLOCK_MARK - edge[0] is an offset of its block in CTreeArena::blockPool
+//                and edge[1] is the capacity of the block
+//   TABLE_MARK - edge[0] is a number of its table in CTreeArena::tables
+// No inline set can look like a mark because its letters are distinct.
+struct CChildSet {
+    uint32_t letters;
+    EdgeId edge[4];
+};
+
+// Contiguous structure-of-arrays storage of the suffix tree.
 //
-// Used only for getting top frequent substrings by number of occurrences
-struct CPrefixedEdge {
-    // Number of letters from beginning of the tree root
-     BigInt prefixLength = 0;
-     // Accumulated strings on edges from tree root
-     std::string prefixString;
-     // First occurrence of non letter on this edge, -1 for never
-     BigInt firstNonLetterOffset = -1;
-     // The edge we are talking about
-     CEdge *edgePtr;
-
-     CPrefixedEdge(BigInt prefixLength_, std::string s, BigInt firstNonLetterOffset_, CEdge *e)
-        : prefixLength(prefixLength_), prefixString(s), firstNonLetterOffset(firstNonLetterOffset_), edgePtr(e)
-     {}
-     CPrefixedEdge() {}
+// Internal node keeps the edge leading into it: the edge label is
+//     sourceString[ position + depth(parent) .. position + depth )
+// where position is a start of any occurrence of the node string.
+// Leaves are implicit: a leaf number is the start of its suffix, so it
+// serves as a position and the depth is known from the current text length.
+// Nothing is stored per leaf.
+//
+// Children are addressed by the compact code of the first letter of the edge
+// and their representation grows with the fan-out of the node:
+//   - up to INLINE_CHILDREN edges inline in CChildSet
+//   - up to MAX_BLOCK_CHILDREN edges in a block of 8, 16 or 32 sorted letters
+//     followed by the edges, several letters are compared at once
+//   - a full table of alphabetSize edges indexed by the letter code
+class CTreeArena {
+public:
+    // Per internal node data
+    CStorage<uint32_t> position;
+    CStorage<uint32_t> depth;
+    std::vector<NodeId> suffixLink;
+    std::vector<NodeId> parent;
+    CStorage<CChildSet> children;
+    // Used only for substring frequency of occurrences counting
+    CStorage<uint32_t> occurrenceNumber;
+
+    // Child storage of nodes with bigger fan-out
+    CStorage<uint32_t> blockPool;
+    std::vector<uint32_t> freeBlocks[3];
+    CStorage<EdgeId> tables;
+    std::vector<uint32_t> freeTables;
+    // Nodes removed from the tree, reused by addNode()
+    std::vector<NodeId> freeNodes;
+
+    // Number of distinct letter codes, size of a child table
+    uint32_t alphabetSize = 0;
+
+    NodeId addNode(uint32_t position_, uint32_t depth_);
+    // Releases the node and its child storage for reuse
+    void freeNode(NodeId node);
+
+    // Child edge of the node by the code of its first letter, NONE if there is no such edge
+    EdgeId child(NodeId node, uint8_t code) const {
+        const CChildSet &set = children[node];
+        if (set.letters == TABLE_MARK) {
+            return tables[ (size_t)set.edge[0] * alphabetSize + code ];
+        }
+        if (set.letters == BLOCK_MARK) {
+            const uint32_t *block = &blockPool[ set.edge[0] ];
+            const uint32_t letterWords = set.edge[1] / 4;
+            for (uint32_t word = 0; word < letterWords; word += 2) {
+                const int slot = findLetter(block[word] | ((uint64_t)block[word + 1] << 32), code);
+                if (slot >= 0)
+                    return block[ letterWords + 4 * word + slot ];
+            }
+            return NONE;
+        }
+        const int slot = findLetter(set.letters | 0xFFFFFFFF00000000ull, code);
+        return (slot < 0) ? NONE : set.edge[slot];
+    }
+
+    // Adds a child edge or replaces an existing one with the same first letter
+    void setChild(NodeId node, uint8_t code, EdgeId edge);
+    // Removes the child edge with the first letter of the code, if there is one
+    void removeChild(NodeId node, uint8_t code);
+    // Moves leaf numbers of the children of the node back by delta
+    void shiftLeaves(NodeId node, uint32_t delta);
+
+    // Index of the byte equal to the code in packed letters, -1 if there is none.
+    // Checks all eight bytes at once, only the lowest match is exact, but letters are distinct.
+    static int findLetter(uint64_t letters, uint8_t code) {
+        const uint64_t difference = letters ^ (code * 0x0101010101010101ull);
+        const uint64_t zeroBytes = (difference - 0x0101010101010101ull) & ~difference & 0x8080808080808080ull;
+        return (zeroBytes == 0) ? -1 : (__builtin_ctzll(zeroBytes) >> 3);
+    }
+
+    // Number of internal nodes, freed ones included
+    size_t size() const { return position.size(); }
+
+    // Memory allocated for the tree structure
+    size_t bytesUsed() const;
+
+    static const uint32_t LEAF_FLAG = 0x80000000u;
+    static const uint32_t NONE = 0xFFFFFFFFu;
+    static const uint8_t NO_SYMBOL = 0xFF;
+    static const uint32_t INLINE_CHILDREN = 4;
+    static const uint32_t MAX_BLOCK_CHILDREN = 32;
+    static const uint32_t BLOCK_MARK = 0xFEFEFEFEu;
+    static const uint32_t TABLE_MARK = 0xFDFDFDFDu;
+
+private:
+    // Allocates a block for the given number of children
+    uint32_t allocateBlock(uint32_t capacity);
+    void freeBlock(uint32_t offset, uint32_t capacity);
 };
 
-// Data structure used in computation of top frequently occurring substrings
-// number of occurrences => vector of prefixed edges with this occurrence
-typedef std::map<BigInt, std::vector<CPrefixedEdge>, std::greater<int> > CFrequencyToEdgeMap;
+// Iterates over children of a node in the order of their first letters
+class CChildIterator {
+public:
+    // Starts from the first child, or goes on after the child a cursor was taken at
+    CChildIterator(const CTreeArena &arena_, NodeId node, uint32_t cursor_ = 0);
+
+    bool valid() const { return edge != CTreeArena::NONE; }
+    EdgeId operator*() const { return edge; }
+    void next();
+
+    // Position after the current child, to resume iteration from later
+    uint32_t resumeCursor() const { return cursor; }
+
+private:
+    const CTreeArena &arena;
+    const CChildSet &set;
+    // Slot for inline sets and blocks, letter code for tables
+    uint32_t cursor;
+    EdgeId edge;
+};
+
+// Edge that is a candidate for top frequent substrings.
+// Its substrings are not kept, they are taken from the source string for the winners only:
+// the string from the root to the edge starts at the position of the edge.
+//
+// Used only for getting top frequent substrings by number of occurrences
+struct CEdgeCandidate {
+    // Number of occurrences of the edge
+    BigInt count;
+    // Candidates with equal counts go from the latest one, like the stack they used to be in
+    uint64_t order;
+    // The edge we are talking about and the node it starts from
+    NodeId node;
+    EdgeId edge;
+    // Letters of the edge before the first non-letter, all of them if there is none
+    uint32_t letters;
+
+    CEdgeCandidate(BigInt count_, uint64_t order_, NodeId node_, EdgeId edge_, uint32_t letters_)
+        : count(count_), order(order_), node(node_), edge(edge_), letters(letters_)
+    {}
+
+    // Order of a max-heap, the best candidate is the greatest
+    bool operator<(const CEdgeCandidate &other) const {
+        return count < other.count || (count == other.count && order < other.order);
+    }
+    bool operator>(const CEdgeCandidate &other) const {
+        return other < *this;
+    }
+};
 
 //---------------------------------------------------
 // The Ukkonnen's suffix tree
 class CSuffixTree {
 public:
-    // Value for free end of the edge
-    static const BigInt FREE = -10;
+    // Marks absence of a node or an edge
+    static const uint32_t NONE = CTreeArena::NONE;
+    // Root of the suffix tree
+    static const NodeId ROOT = 0;
 
     //-------
     // Suffix tree data
 
-    // Auxiliry point with virtual edges for every symbol in the dicationary
-    CNode *preRoot;
-    // Root of the suffix tree
-    CNode *root;
+    // Nodes and edges
+    CTreeArena arena;
     // Current processing point
     CPoint activePoint;
     // Previous processing point
     CPoint previousPoint;
-    // The string under consideration
-    std::string sourceString;
+    // The string under consideration, owned or viewed until something is appended
+    CText sourceString;
     BigInt currentIndex;
-
-    // Simple ad-hoc way to ensure clearing of memory after all pointers used here
-    std::deque<std::unique_ptr<CEdge>> edgesKeeper;
-    std::deque<std::unique_ptr<CNode>> nodesKeeper;
-    std::deque<std::unique_ptr<CVirtualEdge>> virtualEdgesKeeper;
-    CEdge* newCEdge();
-    CNode* newCNode();
+    // Compact code of every symbol of the dictionary, used to address children
+    uint8_t symbolCode[256];
+    // Weights of leaves when the string is made of distinct words
+    CLeafWeights leafWeights;
+
+    // Node created by the last split, it gets a suffix link when the next node is known
+    NodeId oldNode = NONE;
+    // Nodes whose occurrence numbers are out of date, together with all their ancestors.
+    // Every node is out of date until the first count.
+    std::vector<bool> isChanged;
+    bool allChanged = true;
+    // Suffixes of the string not having leaves end at these nodes, while nothing is appended.
+    // Weight of the suffix of the node depth adds to its occurrence number.
+    std::vector<bool> isTerminal;
+    std::vector<NodeId> terminalNodes;
+    bool terminalsMarked = false;
+    // Nodes made for terminal marks, they are merged back when the marks are cleared
+    std::vector<NodeId> markNodes;
+
+    // Number of the last letters kept in the tree, 0 keeps the whole string
+    BigInt windowSize = 0;
+    // Index of the oldest letter of the window in sourceString
+    BigInt windowStart = 0;
+    // Node every leaf hangs from, by leaf number, kept only with a window
+    std::vector<NodeId> leafParent;
+
+    // Non-letters of sourceString, brought up to date before queries
+    CLetterIndex letterIndex;
+    // The string has UTF-8 code points of several bytes, lengths of substrings are in code points
+    bool codePoints = false;
+    // Code points from root to every node, only for a string of them, counted by refreshOccurrences()
+    std::vector<uint32_t> codePointDepth;
+
+    // Start of every document when the string is a corpus of them, ascending, empty otherwise
+    std::vector<uint32_t> documentStart;
+    // Number of documents the string of every node occurs in, counted with occurrences
+    std::vector<uint32_t> documentNumber;
+
+    // Loaded from an index file, arrays view the file
+    bool readOnly = false;
+
+    // Workers of the walks after building, none with one thread
+    std::unique_ptr<CWorkStealingPool> pool;
+
+    // Events of building, counted only when compiled with TREE_COUNTERS
+    CBuildCounters buildCounters;
 
     //---------
     // Suffix tree related functions:
@@ -98,127 +284,292 @@ public:
     // Finds a place in a tree to which leads a current string without the first letter
     CPoint getNextPoint(CPoint point);
     // Print tree into console in human readable form
-    void print(CNode*, std::string);
+    void print(NodeId, std::string);
     // Initilaize suffix tree data to prepare for a buildTree() call
-    CSuffixTree(std::string);
+    // Leaves weigh 1 unless weights of distinct words are given
+    CSuffixTree(CText, CLeafWeights leafWeights_ = CLeafWeights());
+
+    // Tree saved by save(), read in place from the mapped file, which has to outlive it.
+    // It answers queries without building, but it can't be changed.
+    // Throws std::runtime_error if the file is not a valid index.
+    explicit CSuffixTree(const CMappedFile &indexFile);
 
     // Actually creates a suffix tree out of data prepared in CSuffixTree(...)
     void buildTree();
 
-    //-----------
-    //Code below is needed only for counting of substring frequences:
+    // Writes the tree with up to date occurrence numbers into an index file, see tree_index.h.
+    // The file is replaced at once, readers mapping the old one keep it.
+    void save(const std::string &fileName);
 
-    // Get top N substrings by occurrence frequency
-    CFrequencyInfo getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength);
+    // Appends a chunk to the string and extends the tree in place.
+    // Occurrence numbers are brought up to date by the next query.
+    void append(const std::string &chunk);
 
-    // Get number of substrings longer than given minimalLength
-    BigInt getNumbetOfSubstringsLongerThan(BigInt minimalLength, CNode *node = nullptr, BigInt depth = 0);
+    // Keeps only suffixes of the last windowSize_ letters, older ones are deleted while letters come.
+    // Must be set before building, occurrences are counted over the window only.
+    void setWindowSize(BigInt windowSize_);
 
-    // Debug print function
-    void printCurrentTopEdges(CFrequencyToEdgeMap &);
+    // The string is a corpus of documents starting at these positions, numbers of documents
+    // every substring occurs in are counted with occurrences. Must be set before building.
+    void setDocuments(std::vector<uint32_t> documentStart_);
+    size_t documentsNumber() const { return documentStart.size(); }
 
-private:
-    // Auxiliary function for counting frequences of substrings
-    // It fiils in the number of occurrences for each edge
-    // Info is stored in CEdge::occurrenceNumber of every edge
-    BigInt countOccurrences(CNode *node);
+    // Occurrences are counted and top substrings are collected over subtrees in parallel.
+    // Results are the same with any number of threads.
+    void setThreadsNumber(size_t threadsNumber);
 
-    // Auxiliary function for counting frequences of substrings
-    // Initializes CFrequencyToEdgeMap for use in getTopSuitableSubstrings(...)
-    void initializeFreqToEdgeMap(CNode *node, CFrequencyToEdgeMap &freqToEdgeMap, BigInt minimalLength, BigInt depth = 0, std::string prefix = "");
-};
+    // Memory used by the tree and the source string per input character
+    double bytesPerCharacter() const;
+    // Internal nodes with the root and leaves of the tree, counted by a walk
+    std::pair<size_t, size_t> nodesAndLeaves();
+    // Sets counters of building with histograms of fan-out and depth in edges of internal nodes
+    // into runStats(), when compiled with TREE_COUNTERS
+    void recordBuildCounters();
 
-// Auxiliary classes for CSuffixTree
+    //---------
+    // Accessors of the arena, leaves are handled here
 
-// Node for a suffix tree, holds charecter to edge map
-class CNode {
-public:
-    CSuffixTree *tree;
-    std::map<char, CEdge*> edges;
-    CEdge *inEdge;
-    CNode *suffixLink;
+    static bool isLeaf(EdgeId edge) {
+        return (edge & CTreeArena::LEAF_FLAG) != 0;
+    }
 
-    BigInt number;
+    // Node at the lower end of the edge, NONE for leaves
+    NodeId endNode(EdgeId edge) const {
+        return isLeaf(edge) ? NONE : edge;
+    }
 
-    CEdge* edgeFromLetter(char letter) {
-        CEdge * edge_pointer = NULL;
-        if (edges.count( letter ) > 0) {
-            edge_pointer = edges[letter];
-        }
-        return edge_pointer;
+    // Length of the string from root to the node
+    BigInt nodeDepth(NodeId node) const {
+        return arena.depth[node];
     }
 
-    CNode (CSuffixTree *tree_)
-        : tree(tree_)
-        , inEdge(nullptr)
-        , suffixLink(nullptr)
-    {
+    // Length of the string from root to the point
+    BigInt pointDepth(const CPoint &point) const {
+        return nodeDepth(point.node) + ((point.edge == NONE) ? 0 : (point.relativeIndex + 1));
     }
 
-    BigInt getSuffixLinkNumber() {
-        BigInt retval = -1;
-        if (suffixLink != nullptr)
-            retval = suffixLink->number;
-        return retval;
+    // Length of the string from root to the lower end of the edge
+    BigInt edgeDepth(EdgeId edge) const {
+        return isLeaf(edge) ? (currentIndex + 1 - (edge & ~CTreeArena::LEAF_FLAG)) : arena.depth[edge];
     }
-};
 
-// Edge for a suffix tree, connects nodes in suffix tree
-class CEdge {
-public:
-    CNode *beginNode
-         ,*endNode;
+    // Start of the edge label in sourceString
+    BigInt edgeBeginIndex(NodeId node, EdgeId edge) const {
+        const BigInt position = isLeaf(edge) ? (edge & ~CTreeArena::LEAF_FLAG) : arena.position[edge];
+        return position + nodeDepth(node);
+    }
 
-    BigInt beginIndex;
-    BigInt endIndex;
+    BigInt edgeLength(NodeId node, EdgeId edge) const {
+        return edgeDepth(edge) - nodeDepth(node);
+    }
 
-    // Used only for substring frequency of occurrences counting
-    BigInt occurrenceNumber = 0;
+    char letterFromRelativeIndex(NodeId node, EdgeId edge, BigInt relativeIndex) const {
+        return sourceString[ edgeBeginIndex(node, edge) + relativeIndex ];
+    }
 
-    // Parent tree
-    CSuffixTree *tree;
+    // Letters of the edge before its first non-letter, all of them if there is none
+    BigInt edgeLetters(NodeId node, EdgeId edge) const {
+        return std::min(edgeLength(node, edge), (BigInt)letterIndex.lettersFrom(edgeBeginIndex(node, edge)));
+    }
+
+    // Lengths of substrings are in code points for a text of them, in bytes otherwise.
+    // A code point ends where the next byte is not a continuation, the path to a node
+    // starting at a code point tells by itself whether it ends at one.
+
+    // Length of the string from root to the node, code points of it are counted by countCodePointDepths()
+    BigInt nodeLength(NodeId node) const {
+        return codePoints ? codePointDepth[node] : nodeDepth(node);
+    }
 
-    BigInt length() {
-        BigInt length;
-        length = 1 + ( ( endIndex != CSuffixTree::FREE ) ? endIndex : tree->currentIndex ) - beginIndex;
+    // Length of the first bytes of the edge, the code points ending on them
+    BigInt prefixLength(NodeId node, EdgeId edge, BigInt bytes) const {
+        if (!codePoints) {
+            return bytes;
+        }
+        const BigInt begin = edgeBeginIndex(node, edge);
+        BigInt length = 0;
+        for (BigInt index = begin + 1; index <= begin + bytes; ++index) {
+            length += (index == (BigInt)sourceString.size() || !isUtf8Continuation(sourceString[index]));
+        }
         return length;
     }
 
-    virtual char letterFromRelativeIndex( BigInt relativeIndex ) {
-        return tree->sourceString[ beginIndex + relativeIndex ];
+    // Bytes of the edge making its first length code points
+    BigInt edgeBytes(NodeId node, EdgeId edge, BigInt length) const {
+        if (!codePoints) {
+            return length;
+        }
+        const BigInt begin = edgeBeginIndex(node, edge);
+        BigInt index = begin;
+        for (BigInt ended = 0; ended < length; ) {
+            ++index;
+            ended += (index == (BigInt)sourceString.size() || !isUtf8Continuation(sourceString[index]));
+        }
+        return index - begin;
     }
 
-    CEdge(CSuffixTree *tree_)
-        : beginNode(nullptr), endNode(nullptr), tree(tree_)
-    {
+    // Suffixes starting in the middle of a code point are not counted, their edges are skipped
+    bool startsInCodePoint(NodeId node, EdgeId edge) const {
+        return codePoints && node == ROOT && isUtf8Continuation(letterFromRelativeIndex(node, edge, 0));
     }
 
-    CEdge(CSuffixTree *tree_, CNode *beginNode_, CNode *endNode_)
-        : beginNode(beginNode_), endNode(endNode_), tree(tree_)
-    {
+    BigInt occurrenceNumber(EdgeId edge) const {
+        return isLeaf(edge) ? leafWeights.at(edge & ~CTreeArena::LEAF_FLAG) : arena.occurrenceNumber[edge];
     }
 
-    BigInt getRealEndIndex() {
-        return ( endIndex == CSuffixTree::FREE ) ? tree->currentIndex : endIndex;
+    // Number of documents the string of the edge occurs in, a leaf is a single occurrence
+    BigInt edgeDocuments(EdgeId edge) const {
+        return isLeaf(edge) ? 1 : documentNumber[edge];
     }
-};
 
-// Edge to connect pre_root and root in suffix tree
-// For every charecter in vocabulary there is a virtual edge from pre_root to root in suffix tree
-class CVirtualEdge : public CEdge {
-public:
-    char character;
+    // Child edge of the node starting with the letter, NONE if there is no such edge
+    EdgeId edgeFromLetter(NodeId node, char letter) const {
+        return arena.child(node, symbolCode[ (unsigned char)letter ]);
+    }
 
-    virtual char letterFromRelativeIndex(BigInt relativeIndex) {
-        return tree->sourceString[ beginIndex + relativeIndex ];
+    // Inserts a child edge or replaces the one starting with the same letter
+    void setEdge(NodeId node, EdgeId edge) {
+        arena.setChild(node, symbolCode[ (unsigned char)letterFromRelativeIndex(node, edge, 0) ], edge);
+        if (!isLeaf(edge)) {
+            arena.parent[edge] = node;
+        } else if (windowSize > 0) {
+            leafParent[edge & ~CTreeArena::LEAF_FLAG] = node;
+        }
     }
 
-    CVirtualEdge(CSuffixTree *tree_, char character_, CNode *beginNode, CNode *endNode)
-        : CEdge (tree_, beginNode, endNode)
-        , character(character_)
-    {
-        beginIndex = -1;
-        endIndex = -1;
+    void removeEdge(NodeId node, EdgeId edge) {
+        arena.removeChild(node, symbolCode[ (unsigned char)letterFromRelativeIndex(node, edge, 0) ]);
     }
-};
 
+    // Marks occurrence numbers of the node and its ancestors out of date.
+    // Stops at a marked ancestor, so every node is walked once between counts.
+    void markChanged(NodeId node) {
+        if (allChanged) {
+            return;
+        }
+        if (isChanged.size() < arena.size()) {
+            isChanged.resize(arena.size());
+        }
+        while (node != NONE && !isChanged[node]) {
+            isChanged[node] = true;
+            node = arena.parent[node];
+        }
+    }
+
+    //-----------
+    //Code below is needed only for counting of substring frequences:
+
+    // Get top N substrings by occurrence frequency
+    CFrequencyInfo getTopSuitableSubstrings(const size_t takeTopN, ssize_t minimalLength);
+
+    // Answers of several top queries with their numbers of long substrings, all found in one walk
+    std::vector<CTopAnswer> getTopSuitableSubstringsMany(const std::vector<CTopQuery> &queries);
+
+    // Get number of substrings longer than given minimalLength
+    BigInt getNumbetOfSubstringsLongerThan(BigInt minimalLength);
+
+    // Number of occurrences of a non-empty pattern in the string, found in O(|pattern|)
+    BigInt count(const std::string &pattern);
+
+    // Numbers of occurrences of patterns in their order, descents to common prefixes are shared
+    std::vector<BigInt> countMany(const std::vector<std::string> &patterns);
+
+    // Numbers of documents the patterns occur in, for trees of documents
+    std::vector<BigInt> countDocuments(const std::vector<std::string> &patterns);
+
+    // Brings occurrence numbers up to date after building or appending, every query calls it.
+    // After it queries only read the tree, so they may run in parallel until the tree is changed.
+    void refreshOccurrences();
+
+    // Debug print function
+    void printCandidates(const std::vector<CEdgeCandidate> &);
+
+private:
+    // Runs Ukkonen's phases for the letters of the string not in the tree yet
+    void extendTree();
+
+    // Suffixes shorter than the active point occur earlier in the string and have no leaves.
+    // Their ends are made nodes and marked terminal, so they count as occurrences.
+    void markImplicitSuffixes();
+    void clearTerminalMarks();
+
+    // Splits the edge at the point unless the point is at its end, returns the node at the point.
+    // New nodes are kept in markNodes.
+    NodeId makeExplicit(CPoint &point);
+
+    // Replaces a node having a single child by its child edge and frees the node
+    void mergeUnaryNode(NodeId node);
+
+    // Deletes the leaf of the longest suffix, whose first letter leaves the window
+    void deleteOldestSuffix();
+
+    // Drops the letters before the window and moves leaf numbers and positions back
+    void compactWindow();
+
+    // Walks the subtree of the top node depth first, children in the order of letters.
+    // visitEdge(node, edge) returns true to walk below the edge, leaveNode(node) is called after
+    // the walk below the node. The stack is on the heap, a tree as deep as the string costs memory only.
+    template <typename TVisitEdge, typename TLeaveNode>
+    void walkTree(NodeId top, TVisitEdge visitEdge, TLeaveNode leaveNode);
+    // Same, but splitEdge(node, edge, level) is asked before walking below an internal edge,
+    // the level of the node under the top. It returns true if the edge is walked elsewhere.
+    template <typename TVisitEdge, typename TLeaveNode, typename TSplitEdge>
+    void walkTree(NodeId top, TVisitEdge visitEdge, TLeaveNode leaveNode, TSplitEdge splitEdge);
+
+    // Walks the whole tree in tasks on the pool, every task walks a subtree with walkTree().
+    // While the pool wants tasks, edges in the first MAX_SPLIT_LEVEL levels are split off to new tasks,
+    // so a big subtree of a common letter is shared by several workers.
+    // Every task keeps its partial results in its own state, callbacks get it as the first argument:
+    //   visitEdge(state, node, edge) as in walkTree(),
+    //   leaveNode(state, node) for nodes below the top of the task only,
+    //   splitEdge(state, node, edge, task) when the walk below the edge goes to the task of the number.
+    // States are numbered by tasks, the first task walks from the root.
+    // Without a pool the single task walks the whole tree.
+    template <typename TState, typename TVisitEdge, typename TLeaveNode, typename TSplitEdge>
+    void walkTreeInTasks(std::deque<TState> &states, TVisitEdge visitEdge, TLeaveNode leaveNode, TSplitEdge splitEdge);
+
+    // Deepest level of nodes whose edges are split off, it bounds the merging of split counts
+    static const size_t MAX_SPLIT_LEVEL = 64;
+
+    // Substrings of minimalLength letters at least: their number and candidates for top substrings
+    struct CLongSubstrings {
+        BigInt minimalLength;
+        size_t takeTopN;
+        bool byDocuments;
+        bool collectCandidates;
+        BigInt count;
+        std::vector<CEdgeCandidate> candidates;
+    };
+
+    // Walks edges of letters from the root once for all minimal lengths,
+    // those with a non-letter are not walked below.
+    // Counts substrings of every length and, if candidates are wanted, collects the first edges
+    // long enough for getTopSuitableSubstrings(...) in the order of the walk.
+    // With takeTopN > 0 only the takeTopN best of them are kept, every candidate gives a substring at least.
+    void walkLongSubstrings(std::vector<CLongSubstrings> &lengths);
+
+    // Top substrings of a query out of its candidates, the candidates are used up.
+    // Percentages are of the denominator.
+    CFrequencyInfo takeTopSubstrings(std::vector<CEdgeCandidate> &candidates, const CTopQuery &query, double denominator);
+
+    // Edges the patterns end on in their order, NONE for patterns not in the string
+    std::vector<EdgeId> findPatternEdges(const std::vector<std::string> &patterns) const;
+
+    // Counts occurrences with numbers of documents in one walk
+    void countOccurrencesOfDocuments();
+    size_t documentOf(BigInt position) const;
+
+    // Auxiliary function for counting frequences of substrings
+    // It fiils in the number of occurrences for each edge
+    // Info is stored in CTreeArena::occurrenceNumber of every internal node
+    // Unless all nodes are changed, only changed nodes are recounted
+    void countOccurrences();
+
+    // Fills in codePointDepth of nodes under edges of letters, for a string of code points
+    void countCodePointDepths();
+
+    // String from the root to the letter of the edge at the length
+    std::string edgeSubstring(NodeId node, EdgeId edge, BigInt length) const {
+        return sourceString.substr(edgeBeginIndex(node, edge) - nodeDepth(node), nodeDepth(node) + edgeBytes(node, edge, length));
+    }
+};
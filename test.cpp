@@ -1,17 +1,28 @@
 #include "suffix_tree.h"
-
-#include <sys/resource.h>
+#include "suffix_array.h"
+#include "sharded_counter.h"
+#include "partitioned_counter.h"
+#include "approximate_counter.h"
+#include "mapped_file.h"
+#include "query_server.h"
+#include "corpus.h"
+#include "dictionary.h"
+#include "stats.h"
+
+#include <unistd.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <fstream>
-#include <climits>
+#include <map>
 #include <set>
 #include <string>
 #include <random>
 #include <algorithm>
+#include <memory>
+#include <thread>
 
 const std::string AllLetters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
@@ -52,7 +63,7 @@ typedef std::pair<double, std::string> ResultEntry;
 typedef std::vector<ResultEntry> FreqResults;
 
 // Function that counts substring frequences in a slower, but more simple way
-// Works only for words of alphabet letters and space symbols
+// Works only for words of letters of symbolClasses() and space symbols
 ssize_t countFrequences(const std::string &text, FreqResults &results) {
     ssize_t numberOfSubstrings = 0;
     std::map<std::string, ssize_t> substringToOccurrenceNumber;
@@ -63,7 +74,7 @@ ssize_t countFrequences(const std::string &text, FreqResults &results) {
     std::vector<std::string> words;
     std::string word = "";
     for (auto c: text) {
-        if (::isalpha(c)) {
+        if (symbolClasses().isLetter(c)) {
             word += c;
         } else {
             if (word.length() >= minWordLength) {
@@ -99,45 +110,213 @@ ssize_t countFrequences(const std::string &text, FreqResults &results) {
     return numberOfSubstrings;
 }
 
-// Test one string whether results of suffix tree implementation and anive on coinside
-void runSingleTest(std::string testStr) {
-    FreqResults res;
-    countFrequences(testStr, res);
+// Compare top substrings of one of the engines with the naive results.
+// Engines order equal counts differently, so substrings tied at the cut of top N may differ,
+// the rest of them have to be the same.
+template <typename TEngine>
+void checkEngine(const std::string &testStr, const FreqResults &res, ssize_t numberOfSubstrings, TEngine &engine, const std::string &engineName) {
+    std::map<std::string, double> percentageOf;
+    for (const auto &entry: res) {
+        percentageOf[entry.second] = entry.first;
+    }
+    const double epsilon = 1e-12;
 
-    CSuffixTree tree( testStr );
-    tree.buildTree( );
+    for (size_t takeTopN: {2, 10}) {
+        auto topN = engine.getTopSuitableSubstrings(takeTopN, 4);
 
-    auto topN = tree.getTopSuitableSubstrings(10, 4);
+        if (std::min(res.size(), takeTopN) != topN.size()) {
+            std::cout << testStr << std::endl;
 
-    if (res.size() < topN.size()) {
-        std::cout << testStr << std::endl;
+            std::cout << "res" << std::endl;
+            for (auto p: res) {
+                std::cout << p.first << " " << p.second << std::endl;
+            }
+
+            std::cout << engineName << " topN" << std::endl;
+            for (auto p: topN) {
+                std::cout << p.first << " " << p.second << std::endl;
+            }
 
-        std::cout << "res" << std::endl;
-        for (auto p: res) {
-            std::cout << p.first << " " << p.second << std::endl;
+            throw std::runtime_error("Sizes differ in " + engineName);
         }
 
-        std::cout << "topN" << std::endl;
-        for (auto p: topN) {
-            std::cout << p.first << " " << p.second << std::endl;
+        // Percentages of top N are the best ones, and every substring has its own percentage,
+        // so every substring above the cut is there
+        std::set<std::string> substrings;
+        for (size_t index = 0; index < topN.size(); ++index) {
+            const double diff = fabs(res[index].first - topN[index].second);
+            if (diff > epsilon) {
+                throw std::runtime_error("Percentages differ in " + engineName);
+            }
+            const auto found = percentageOf.find(topN[index].first);
+            if (found == percentageOf.end() || fabs(found->second - topN[index].second) > epsilon
+                    || !substrings.insert(topN[index].first).second) {
+                throw std::runtime_error("Substring '" + topN[index].first + "' is not in the top in " + engineName);
+            }
         }
+    }
 
-        throw std::runtime_error("Sizes differ");
+    if (engine.getNumbetOfSubstringsLongerThan(4) != numberOfSubstrings) {
+        throw std::runtime_error("Numbers of substrings differ in " + engineName);
     }
+}
 
+// Check that pattern counts of an engine agree with its top substrings
+template <typename TEngine>
+void checkCounts(TEngine &engine, const std::string &engineName) {
+    const double numberOfSubstrings = engine.getNumbetOfSubstringsLongerThan(4);
     const double epsilon = 1e-12;
 
-    for (size_t index = 0; index < topN.size(); ++index) {
-        const double diff = fabs(res[index].first - topN[index].second);
+    for (auto p: engine.getTopSuitableSubstrings(10, 4)) {
+        const double diff = fabs(100 * engine.count(p.first) / numberOfSubstrings - p.second);
         if (diff > epsilon) {
-            throw std::runtime_error("Percentages differ");
+            throw std::runtime_error("Pattern count differs in " + engineName);
+        }
+    }
+}
+
+// Batched counts of a tree agree with occurrences found by search, shared prefixes and misses included
+void checkCountMany(const std::string &testStr, CSuffixTree &tree) {
+    std::vector<std::string> patterns = { "", "#", testStr, testStr + "a" };
+    const size_t step = testStr.size() / 50 + 1;
+    for (size_t begin = 0; begin < testStr.size(); begin += step) {
+        for (size_t length = 1; length <= 9 && begin + length <= testStr.size(); ++length) {
+            patterns.push_back(testStr.substr(begin, length));
+            patterns.push_back(testStr.substr(begin, length) + "#");
+        }
+    }
+
+    const auto counts = tree.countMany(patterns);
+    for (size_t index = 0; index < patterns.size(); ++index) {
+        ssize_t occurrences = 0;
+        for (size_t position = testStr.find(patterns[index]); !patterns[index].empty() && position != std::string::npos;
+             position = testStr.find(patterns[index], position + 1)) {
+            ++occurrences;
+        }
+        if (counts[index] != occurrences || tree.count(patterns[index]) != occurrences) {
+            throw std::runtime_error("Batched pattern count differs for '" + patterns[index] + "'");
         }
     }
 }
 
+// Test one string whether results of suffix tree, suffix array and sharded implementations and anive one coinside
+void runSingleTest(std::string testStr) {
+    FreqResults res;
+    const ssize_t numberOfSubstrings = countFrequences(testStr, res);
+
+    CSuffixTree tree( testStr );
+    tree.buildTree( );
+    checkEngine(testStr, res, numberOfSubstrings, tree, "suffix tree");
+    checkCounts(tree, "suffix tree");
+    checkCountMany(testStr, tree);
+
+    // Occurrences counted over subtrees by several workers
+    CSuffixTree parallelTree( testStr );
+    parallelTree.setThreadsNumber( 3 );
+    parallelTree.buildTree( );
+    checkEngine(testStr, res, numberOfSubstrings, parallelTree, "suffix tree walked in parallel");
+    const auto allSubstrings = tree.getTopSuitableSubstrings(0, 4);
+    if (parallelTree.getTopSuitableSubstrings(0, 4) != allSubstrings) {
+        throw std::runtime_error("Suffix tree walked in parallel differs from a single thread");
+    }
+    // Candidates are cut to the best N, top N has to start the list of all substrings
+    for (size_t takeTopN: {1, 3, 25}) {
+        const auto topN = parallelTree.getTopSuitableSubstrings(takeTopN, 4);
+        if (topN.size() != std::min(takeTopN, allSubstrings.size()) || !std::equal(topN.begin(), topN.end(), allSubstrings.begin())) {
+            throw std::runtime_error("Top substrings of the suffix tree differ from the beginning of all substrings");
+        }
+    }
+
+    // Queries answered in one walk are the same as answered one by one, lengths repeat with other N
+    std::vector<CTopQuery> queries;
+    for (BigInt minimalLength = 2; minimalLength <= 7; ++minimalLength) {
+        for (size_t takeTopN: {3, 10, 0}) {
+            queries.push_back({ takeTopN, minimalLength });
+        }
+    }
+    const auto answers = parallelTree.getTopSuitableSubstringsMany(queries);
+    for (size_t index = 0; index < queries.size(); ++index) {
+        if (answers[index].topN != tree.getTopSuitableSubstrings(queries[index].takeTopN, queries[index].minimalLength)
+                || answers[index].numberOfLongSubstrings != tree.getNumbetOfSubstringsLongerThan(queries[index].minimalLength)) {
+            throw std::runtime_error("Top queries of the suffix tree answered together differ from single ones");
+        }
+    }
+
+    CSuffixArray suffixArray( testStr );
+    suffixArray.buildArray( );
+    checkEngine(testStr, res, numberOfSubstrings, suffixArray, "suffix array");
+    checkCounts(suffixArray, "suffix array");
+
+    // Engines over a view of letters owned by the caller
+    CSuffixTree viewedTree( CText(testStr.data(), testStr.size()) );
+    viewedTree.buildTree( );
+    checkEngine(testStr, res, numberOfSubstrings, viewedTree, "suffix tree of a view");
+
+    CSuffixArray viewedArray( CText(testStr.data(), testStr.size()) );
+    viewedArray.buildArray( );
+    checkEngine(testStr, res, numberOfSubstrings, viewedArray, "suffix array of a view");
+
+    // Appending copies the viewed letters
+    const std::string doubledStr = testStr + " " + testStr;
+    viewedTree.append( " " + testStr );
+    FreqResults doubledRes;
+    const ssize_t doubledNumberOfSubstrings = countFrequences(doubledStr, doubledRes);
+    checkEngine(doubledStr, doubledRes, doubledNumberOfSubstrings, viewedTree, "appended suffix tree of a view");
+
+    CShardedCounter shardedCounter( testStr, 3 );
+    shardedCounter.buildShards( );
+    checkEngine(testStr, res, numberOfSubstrings, shardedCounter, "sharded suffix arrays");
+
+    // Tree grown by chunks, queried after every chunk
+    CSuffixTree appendedTree( "" );
+    appendedTree.buildTree( );
+    const size_t chunkSize = testStr.size() / 3 + 1;
+    for (size_t begin = 0; begin < testStr.size(); begin += chunkSize) {
+        appendedTree.append( testStr.substr(begin, chunkSize) );
+
+        const std::string prefix = testStr.substr(0, begin + chunkSize);
+        FreqResults prefixRes;
+        const ssize_t prefixNumberOfSubstrings = countFrequences(prefix, prefixRes);
+        checkEngine(prefix, prefixRes, prefixNumberOfSubstrings, appendedTree, "appended suffix tree");
+        checkCounts(appendedTree, "appended suffix tree");
+    }
+
+    // Tree of a window over the last half of the string, slid by chunks
+    CSuffixTree windowTree( "" );
+    const size_t windowSize = testStr.size() / 2 + 1;
+    windowTree.setWindowSize( windowSize );
+    windowTree.buildTree( );
+    const size_t windowChunkSize = testStr.size() / 5 + 1;
+    for (size_t begin = 0; begin < testStr.size(); begin += windowChunkSize) {
+        windowTree.append( testStr.substr(begin, windowChunkSize) );
+
+        const size_t end = std::min(testStr.size(), begin + windowChunkSize);
+        const std::string window = testStr.substr(end - std::min(end, windowSize), std::min(end, windowSize));
+        FreqResults windowRes;
+        const ssize_t windowNumberOfSubstrings = countFrequences(window, windowRes);
+        checkEngine(window, windowRes, windowNumberOfSubstrings, windowTree, "suffix tree of a window");
+        checkCounts(windowTree, "suffix tree of a window");
+    }
+
+    CDistinctWords words( testStr );
+
+    CSuffixTree wordsTree( words.text, words.weights );
+    wordsTree.buildTree( );
+    checkEngine(testStr, res, numberOfSubstrings, wordsTree, "suffix tree of distinct words");
+
+    CSuffixArray wordsArray( words.text, words.weights );
+    wordsArray.buildArray( );
+    checkEngine(testStr, res, numberOfSubstrings, wordsArray, "suffix array of distinct words");
+
+    CShardedCounter shardedWordsCounter( testStr, 3, true );
+    shardedWordsCounter.buildShards( );
+    checkEngine(testStr, res, numberOfSubstrings, shardedWordsCounter, "sharded suffix arrays of distinct words");
+}
+
 void runTests() {
     std::cout << "Test on predetermined strings..." << std::endl;
-    for (auto s: {"hall feels heels", "aaaa", "aaaaa", "aaaaaa", "abab", "ababa", "abababa"}) {
+    for (auto s: {"hall feels heels", "hellox hellox helloy helloy helloy hello hello hello hello hello hello", "aaaa", "aaaaa", "aaaaaa", "abab", "ababa", "abababa", "abcd,x abcd1y abcd.z",
+                   "hello,world hello,world hello,there"}) {
         std::string testStr = s;
         for (int repeat = 0; repeat < 7; ++repeat) {
             runSingleTest(testStr);
@@ -146,6 +325,516 @@ void runTests() {
     }
     std::cout << "Test on predetermined strings passed." << std::endl;
 
+    std::cout << "Test on a mapped file..." << std::endl;
+    {
+        char fileName[] = "/tmp/substrings_counter_test_XXXXXX";
+        const int file = mkstemp(fileName);
+        if (file < 0) {
+            throw std::runtime_error("Couldn't create a temporary file");
+        }
+        const std::string testStr = "hellox hellox helloy helloy helloy hello hello hello hello hello hello";
+        const bool written = write(file, testStr.data(), testStr.size()) == (ssize_t)testStr.size();
+        close(file);
+
+        CMappedFile mappedFile(fileName);
+        unlink(fileName);
+        if (!written || std::string(mappedFile.data(), mappedFile.size()) != testStr) {
+            throw std::runtime_error("Mapped file differs from the written one");
+        }
+
+        FreqResults res;
+        const ssize_t numberOfSubstrings = countFrequences(testStr, res);
+        CSuffixTree mappedTree( mappedFile.view() );
+        mappedFile.adviseNormal();
+        mappedTree.buildTree( );
+        checkEngine(testStr, res, numberOfSubstrings, mappedTree, "suffix tree of a mapped file");
+
+        CShardedCounter mappedCounter( mappedFile.view(), 3 );
+        mappedCounter.buildShards( );
+        checkEngine(testStr, res, numberOfSubstrings, mappedCounter, "sharded suffix arrays of a mapped file");
+    }
+    std::cout << "Test on a mapped file passed." << std::endl;
+
+    std::cout << "Test on an index file..." << std::endl;
+    for (bool deduplicateWords: {false, true}) {
+        const std::string testStr = generateRandomString("abc");
+        char fileName[] = "/tmp/substrings_counter_index_XXXXXX";
+        const int file = mkstemp(fileName);
+        if (file < 0) {
+            throw std::runtime_error("Couldn't create a temporary file");
+        }
+        close(file);
+
+        CDistinctWords words( testStr );
+        std::unique_ptr<CSuffixTree> tree( deduplicateWords ? new CSuffixTree( words.text, words.weights ) : new CSuffixTree( testStr ) );
+        tree->buildTree( );
+        tree->save( fileName );
+
+        CMappedFile indexFile(fileName);
+        unlink(fileName);
+        CSuffixTree loadedTree( indexFile );
+        FreqResults res;
+        const ssize_t numberOfSubstrings = countFrequences(testStr, res);
+        checkEngine(testStr, res, numberOfSubstrings, loadedTree, "suffix tree of an index file");
+        checkCounts(loadedTree, "suffix tree of an index file");
+        if (loadedTree.getTopSuitableSubstrings(0, 4) != tree->getTopSuitableSubstrings(0, 4)) {
+            throw std::runtime_error("Suffix tree of an index file differs from the saved one");
+        }
+
+        // Every changed byte is found by the checksum
+        std::string damaged(indexFile.data(), indexFile.size());
+        damaged[damaged.size() / 2] ^= 1;
+        char damagedName[] = "/tmp/substrings_counter_index_XXXXXX";
+        const int damagedFile = mkstemp(damagedName);
+        const bool written = write(damagedFile, damaged.data(), damaged.size()) == (ssize_t)damaged.size();
+        close(damagedFile);
+        bool refused = false;
+        try {
+            CMappedFile damagedIndexFile(damagedName);
+            CSuffixTree damagedTree( damagedIndexFile );
+        } catch (std::runtime_error &) {
+            refused = true;
+        }
+        unlink(damagedName);
+        if (!written || !refused) {
+            throw std::runtime_error("Damaged index file is not refused");
+        }
+    }
+    std::cout << "Test on an index file passed." << std::endl;
+
+    std::cout << "Test on counting in partitions..." << std::endl;
+    for (int i = 0; i < 12; ++i) {
+        // One word as long as the text can't be split below the budget
+        std::string testStr = (i == 0) ? "aaaaaaaaaa abab" : generateRandomString((i % 2 == 0) ? "abc" : "ab");
+        if (i == 1) {
+            testStr.erase(std::remove_if(testStr.begin(), testStr.end(), [](char c) { return c == ' ' || c == '\t'; }), testStr.end());
+        }
+        char fileName[] = "/tmp/substrings_counter_test_XXXXXX";
+        const int file = mkstemp(fileName);
+        if (file < 0) {
+            throw std::runtime_error("Couldn't create a temporary file");
+        }
+        const bool written = write(file, testStr.data(), testStr.size()) == (ssize_t)testStr.size();
+        close(file);
+        if (!written) {
+            unlink(fileName);
+            throw std::runtime_error("Couldn't write a temporary file");
+        }
+
+        CSuffixTree tree( testStr );
+        tree.buildTree( );
+        // Substrings of equal counts in lexicographical order
+        auto expectedTop = [&tree](const CTopQuery &query) {
+            CFrequencyInfo all = tree.getTopSuitableSubstrings(0, query.minimalLength);
+            std::sort(all.begin(), all.end(), [](const std::pair<std::string, double> &a, const std::pair<std::string, double> &b) {
+                return a.second > b.second || (a.second == b.second && a.first < b.first);
+            });
+            if (query.takeTopN > 0 && all.size() > query.takeTopN) {
+                all.resize(query.takeTopN);
+            }
+            return all;
+        };
+
+        // Minimal length 1 makes partitions of single letters, 4 splits prefixes up to 4 letters
+        std::vector<CTopQuery> queries;
+        for (BigInt minimalLength = 1; minimalLength <= 6; ++minimalLength) {
+            queries.push_back({ 10, minimalLength });
+        }
+        queries.push_back({ 0, 3 });
+        const std::vector<CTopQuery> longQueries = { {10, 4}, {3, 5}, {0, 6} };
+
+        // A small budget makes a partition of every prefix, a big one a single partition
+        for (const auto &someQueries: {queries, longQueries}) {
+            for (size_t memoryBudget: {2000, 1 << 24}) {
+                CPartitionedCounter counter(fileName, memoryBudget, "/tmp");
+                const auto answers = counter.getTopSuitableSubstringsMany(someQueries);
+                bool same = (memoryBudget == 2000) ? counter.partitionsNumber() > 1 : counter.partitionsNumber() == 1;
+                same = same && (i != 1 || (counter.oversizedPartitions() > 0) == (memoryBudget == 2000));
+                for (size_t index = 0; index < someQueries.size(); ++index) {
+                    const CFrequencyInfo expected = expectedTop(someQueries[index]);
+                    same = same && answers[index].numberOfLongSubstrings == tree.getNumbetOfSubstringsLongerThan(someQueries[index].minimalLength)
+                           && answers[index].topN.size() == expected.size();
+                    for (size_t entry = 0; same && entry < expected.size(); ++entry) {
+                        same = answers[index].topN[entry].first == expected[entry].first
+                               && fabs(answers[index].topN[entry].second - expected[entry].second) < 1e-12;
+                    }
+                }
+                if (!same) {
+                    unlink(fileName);
+                    throw std::runtime_error("Partitions of '" + testStr + "' count differently from the suffix tree");
+                }
+            }
+        }
+        unlink(fileName);
+    }
+    std::cout << "Test on counting in partitions passed." << std::endl;
+
+    std::cout << "Test on approximate counting..." << std::endl;
+    for (int i = 0; i < 12; ++i) {
+        const std::string testStr = (i == 0) ? "aaaaaaaaaa abab" : generateRandomString((i % 2 == 0) ? "abc" : "ab");
+        CSuffixTree tree( testStr );
+        tree.buildTree( );
+        for (BigInt minimalLength: {1, 3, 5}) {
+            // Substrings longer than MAX_LETTERS have no counters
+            CFrequencyInfo treeTop = tree.getTopSuitableSubstrings(0, minimalLength);
+            treeTop.erase(std::remove_if(treeTop.begin(), treeTop.end(), [](const std::pair<std::string, double> &substring) {
+                return substring.first.size() > CApproximateCounter::MAX_LETTERS;
+            }), treeTop.end());
+            const BigInt total = tree.getNumbetOfSubstringsLongerThan(minimalLength);
+
+            // Counters for every substring count exactly, few of them count within their errors.
+            // Chunks of 7 letters cut words.
+            for (size_t countersNumber: {(size_t)1 << 20, (size_t)(4 + i)}) {
+                CApproximateCounter counter(countersNumber, minimalLength);
+                for (size_t begin = 0; begin < testStr.size(); begin += 7) {
+                    counter.append(testStr.data() + begin, std::min((size_t)7, testStr.size() - begin));
+                }
+                counter.finish();
+                bool right = counter.getNumbetOfSubstringsLongerThan(minimalLength) == total
+                             && counter.maximalError() * (BigInt)countersNumber <= total;
+
+                std::set<std::string> counted;
+                for (const auto &entry: counter.getTopEntries(0)) {
+                    const BigInt count = tree.count(entry.substring);
+                    right = right && entry.error <= counter.maximalError() && entry.count - entry.error <= count && count <= entry.count;
+                    counted.insert(entry.substring);
+                }
+                // Substrings occurring more than the maximal error have counters
+                for (const auto &substring: treeTop) {
+                    right = right && (tree.count(substring.first) <= counter.maximalError() || counted.count(substring.first) > 0);
+                }
+
+                if (countersNumber > (size_t)total) {
+                    const CFrequencyInfo top = counter.getTopSuitableSubstrings(0, minimalLength);
+                    right = right && counter.maximalError() == 0 && top.size() == treeTop.size();
+                    for (size_t entry = 0; right && entry < top.size(); ++entry) {
+                        right = fabs(top[entry].second - treeTop[entry].second) < 1e-12;
+                    }
+                }
+                if (!right) {
+                    throw std::runtime_error("Approximate counters of '" + testStr + "' are out of their bounds");
+                }
+            }
+        }
+    }
+    // A word as long as the stream is counted in the memory of the counters
+    {
+        const size_t memoryBudget = 1 << 16;
+        CApproximateCounter counter(CApproximateCounter::countersFor(memoryBudget), 4);
+        std::string chunk;
+        for (int i = 0; i < 20; ++i) {
+            chunk = generateRandomString("abc");
+            chunk.erase(std::remove_if(chunk.begin(), chunk.end(), [](char c) { return c == ' ' || c == '\t'; }), chunk.end());
+            counter.append(chunk.data(), chunk.size());
+            if (counter.bytesUsed() > memoryBudget) {
+                throw std::runtime_error("Approximate counters take more memory than given");
+            }
+        }
+        counter.finish();
+        if (counter.getTopEntries(1).empty() || counter.getTopEntries(1)[0].count <= counter.maximalError()) {
+            throw std::runtime_error("Approximate counters of a long word found nothing frequent");
+        }
+    }
+    std::cout << "Test on approximate counting passed." << std::endl;
+
+    std::cout << "Test on documents..." << std::endl;
+    for (int test = 0; test < 5; ++test) {
+        // Files read into a corpus are its documents
+        char directory[] = "/tmp/substrings_counter_corpus_XXXXXX";
+        if (mkdtemp(directory) == nullptr) {
+            throw std::runtime_error("Couldn't create a temporary directory");
+        }
+        std::vector<std::string> documents;
+        for (int document = 0; document < 6; ++document) {
+            documents.push_back(generateRandomString("abc").substr(0, 300));
+            std::ofstream(std::string(directory) + "/" + std::to_string(document)) << documents.back();
+        }
+        CCorpus corpus({ directory }, 3);
+        for (const auto &fileName: corpus.fileNames) {
+            unlink(fileName.c_str());
+        }
+        rmdir(directory);
+
+        std::string text;
+        for (const auto &document: documents) {
+            text += document + CCorpus::SEPARATOR;
+        }
+        if (corpus.text != text || corpus.documentStart.size() != documents.size()) {
+            throw std::runtime_error("Corpus differs from the files read");
+        }
+
+        CSuffixTree tree( corpus.text );
+        tree.setDocuments( corpus.documentStart );
+        tree.setThreadsNumber( 3 );
+        tree.buildTree( );
+        CSuffixTree plainTree( corpus.text );
+        plainTree.buildTree( );
+        if (tree.getTopSuitableSubstrings(0, 4) != plainTree.getTopSuitableSubstrings(0, 4)) {
+            throw std::runtime_error("Occurrences of a tree of documents differ from a plain tree");
+        }
+
+        // Every substring of documents ranked is in as many documents as found by search
+        const auto topN = tree.getTopSuitableSubstringsMany({ {0, 3, true} })[0].topN;
+        std::vector<std::string> substrings;
+        for (const auto &entry: topN) {
+            substrings.push_back(entry.first);
+        }
+        const auto documentCounts = tree.countDocuments(substrings);
+        for (size_t index = 0; index < topN.size(); ++index) {
+            ssize_t containing = 0;
+            for (const auto &document: documents) {
+                containing += document.find(substrings[index]) != std::string::npos;
+            }
+            if (documentCounts[index] != containing || fabs(topN[index].second - 100.0 * containing / documents.size()) > 1e-9
+                    || (index > 0 && topN[index].second > topN[index - 1].second)) {
+                throw std::runtime_error("Number of documents differs for '" + substrings[index] + "'");
+            }
+        }
+    }
+    std::cout << "Test on documents passed." << std::endl;
+
+    std::cout << "Test on a query server..." << std::endl;
+    {
+        const std::string testStr = "hellox hellox helloy helloy helloy hello hello hello hello hello hello";
+        CSuffixTree tree( testStr );
+        tree.buildTree( );
+        const BigInt total = tree.getNumbetOfSubstringsLongerThan(5);
+        const auto topN = tree.getTopSuitableSubstrings(3, 5);
+
+        char directory[] = "/tmp/substrings_counter_socket_XXXXXX";
+        if (mkdtemp(directory) == nullptr) {
+            throw std::runtime_error("Couldn't create a temporary directory");
+        }
+        const std::string socketPath = std::string(directory) + "/socket";
+        CQueryServer server(tree, socketPath, 2);
+        std::thread serving([&server]() { server.run(); });
+
+        // Clients connected at the same time are answered in parallel
+        std::vector<std::string> responses[2];
+        std::thread secondClient([&]() {
+            responses[1] = sendRequests(socketPath, {"{\"query\": \"count\", \"substring\": \"hello\"}"});
+        });
+        responses[0] = sendRequests(socketPath, {
+            "{\"query\": \"total\", \"min_length\": 5}",
+            "{\"query\": \"top\", \"n\": 3, \"min_length\": 5}",
+            "{\"query\": \"count\", \"substring\": \"hello\\ty\"}",
+            "{\"query\": \"top\", \"n\": 0}",
+            "not a request",
+        });
+        secondClient.join();
+        const auto stats = sendRequests(socketPath, {"{\"query\": \"stats\"}", "{\"query\": \"shutdown\"}"});
+        serving.join();
+        rmdir(directory);
+
+        bool correct = responses[0][0] == "{\"ok\": true, \"total\": " + std::to_string(total) + "}"
+                       && responses[0][2] == "{\"ok\": true, \"count\": 0}"
+                       && responses[0][3].find("{\"ok\": false") == 0
+                       && responses[0][4].find("{\"ok\": false") == 0
+                       && responses[1][0] == "{\"ok\": true, \"count\": " + std::to_string(tree.count("hello")) + "}"
+                       && stats[0].find("{\"ok\": true, \"requests\": ") == 0
+                       && stats[1] == "{\"ok\": true}"
+                       && server.requestsNumber() == 8 && server.latencyPercentile(0.99) >= server.latencyPercentile(0.5);
+        for (const auto &entry: topN) {
+            const std::string substring = "{\"substring\": \"" + entry.first + "\", \"count\": " + std::to_string(tree.count(entry.first));
+            correct = correct && responses[0][1].find(substring) != std::string::npos;
+        }
+        if (!correct) {
+            throw std::runtime_error("Query server answers differ from the suffix tree");
+        }
+    }
+    std::cout << "Test on a query server passed." << std::endl;
+
+    std::cout << "Test on run statistics..." << std::endl;
+    {
+        runStats().enable();
+        CSuffixTree tree( generateRandomString("abc") );
+        tree.buildTree( );
+        tree.getTopSuitableSubstrings(10, 4);
+        runStats().setValue("nodes", tree.nodesAndLeaves().first);
+        // A phase keeping 64 MB grows RSS by them, whatever the phases before it took.
+        // They are above any mmap threshold of malloc, so no page freed before is reused.
+        std::vector<char> kept;
+        {
+            CStatsPhase phase("keep_memory");
+            kept.assign(64 << 20, 1);
+        }
+        const std::string json = runStats().toJson();
+        const std::vector<std::string> names = { "\"validate\"", "\"build\"", "\"count_occurrences\"", "\"long_substrings\"",
+                                                 "\"top_selection\"", "\"nodes\": ", "\"rss_growth_kb\": ",
+                                                 "\"process_peak_rss_kb\": ", "\"peak_rss_kb\": " };
+        for (const auto &name: names) {
+            if (json.find(name) == std::string::npos || json.front() != '{' || json.find("}\n", json.size() - 2) == std::string::npos) {
+                throw std::runtime_error("Run statistics have no " + name);
+            }
+        }
+        const size_t growth = json.find("\"rss_growth_kb\": ", json.find("\"keep_memory\""));
+        if (growth == std::string::npos || atol(json.c_str() + growth + strlen("\"rss_growth_kb\": ")) < (32 << 10)) {
+            throw std::runtime_error("Run statistics miss memory taken by a phase");
+        }
+    }
+    std::cout << "Test on run statistics passed." << std::endl;
+
+    std::cout << "Test on build counters..." << std::endl;
+    for (int i = 0; i < 20; ++i) {
+        // Every leaf is made once and every internal node by a split or a terminal mark
+        const std::string testStr = generateRandomString("ab ");
+        CSuffixTree tree(testStr);
+        tree.buildTree();
+        const auto nodesAndLeaves = tree.nodesAndLeaves();
+        const CBuildCounters &counters = tree.buildCounters;
+        uint64_t phases = 0;
+        for (const auto count: counters.hopsPerPhase.counts()) {
+            phases += count;
+        }
+        const bool counted = treeCountersEnabled
+            ? counters.phases == testStr.size() && phases == counters.phases && counters.leafCreations == nodesAndLeaves.second
+              && counters.edgeSplits + tree.markNodes.size() + 1 == nodesAndLeaves.first
+            : counters.phases == 0 && counters.leafCreations == 0 && counters.hopsPerPhase.counts().empty();
+        if (!counted) {
+            throw std::runtime_error("Build counters are wrong for '" + testStr + "'");
+        }
+    }
+    std::cout << "Test on build counters passed." << std::endl;
+
+    std::cout << "Test on symbol classes..." << std::endl;
+    {
+        // Blocks and the table find the same first symbol out of the dictionary
+        const std::string refusedSymbols = "+~\\$\x80\xff\x01\x7f";
+        std::mt19937 rng(7);
+        for (int i = 0; i < 200; ++i) {
+            std::string testStr = generateRandomString("ab1{");
+            const size_t position = rng() % (testStr.size() + 1);
+            const char refused = refusedSymbols[rng() % refusedSymbols.size()];
+            testStr.insert(position, 1, refused);
+            std::string error;
+            try {
+                checkDictionary(testStr);
+            } catch (std::runtime_error &e) {
+                error = e.what();
+            }
+            const bool named = refused == '$' ? error.find("'$'") != std::string::npos
+                                              : error.find(std::string("'") + refused + "' which") != std::string::npos;
+            if (!named) {
+                throw std::runtime_error("Symbol out of the dictionary is not found at " + std::to_string(position));
+            }
+            checkDictionary(testStr.substr(0, position));
+        }
+
+        // Digits and custom letters are counted as letters of substrings
+        const std::vector<std::pair<std::string, std::string>> classesAndLetters = { {"alnum", "a1"}, {"custom:ab+", "ab+"} };
+        for (const auto &classesAndLetter: classesAndLetters) {
+            setSymbolClasses(CSymbolClasses::parse(classesAndLetter.first));
+            for (int i = 0; i < 3; ++i) {
+                runSingleTest(generateRandomString(classesAndLetter.second));
+            }
+        }
+        setSymbolClasses(CSymbolClasses::asciiLetters());
+        bool refused = false;
+        try {
+            CSymbolClasses::parse("custom:a b");
+        } catch (std::runtime_error &) {
+            refused = true;
+        }
+        if (!refused) {
+            throw std::runtime_error("Space is taken as a letter");
+        }
+    }
+    std::cout << "Test on symbol classes passed." << std::endl;
+
+    std::cout << "Test on UTF-8 texts..." << std::endl;
+    setSymbolClasses(CSymbolClasses::utf8Letters());
+    for (int i = 0; i < 5; ++i) {
+        // Code points of 1 to 4 bytes in the order of their ASCII stand-ins, so substrings
+        // of the UTF-8 text are the ones of the ASCII text with every letter replaced
+        const std::string asciiLetters = "abcd,";
+        const std::vector<std::string> codePoints = { "a", "\xC3\xA9", "\xE4\xB8\xAD", "\xF0\x90\x90\x80", "\xE2\x82\xAC" };
+        auto toUtf8 = [&](const std::string &text) {
+            std::string result;
+            for (const char c: text) {
+                const size_t letter = asciiLetters.find(c);
+                result += (letter == std::string::npos) ? std::string(1, c) : codePoints[letter];
+            }
+            return result;
+        };
+
+        const std::string asciiStr = generateRandomString(asciiLetters);
+        const std::string utf8Str = toUtf8(asciiStr);
+        CSuffixTree asciiTree( asciiStr );
+        asciiTree.buildTree( );
+        CSuffixTree utf8Tree( utf8Str );
+        utf8Tree.setThreadsNumber( 3 );
+        utf8Tree.buildTree( );
+
+        CFrequencyInfo expected;
+        for (const auto &substring: asciiTree.getTopSuitableSubstrings(0, 4)) {
+            expected.emplace_back(toUtf8(substring.first), substring.second);
+        }
+        CFrequencyInfo found = utf8Tree.getTopSuitableSubstrings(0, 4);
+        std::sort(expected.begin(), expected.end());
+        std::sort(found.begin(), found.end());
+        if (found != expected || utf8Tree.getNumbetOfSubstringsLongerThan(1) != asciiTree.getNumbetOfSubstringsLongerThan(1)) {
+            throw std::runtime_error("Substrings of a UTF-8 text differ from the ones of its ASCII stand-in");
+        }
+        const std::vector<std::string> patterns = { "abc", "b", "dd", "a,b" };
+        for (const auto &pattern: patterns) {
+            if (utf8Tree.count(toUtf8(pattern)) != asciiTree.count(pattern)) {
+                throw std::runtime_error("Count of a UTF-8 pattern differs for '" + pattern + "'");
+            }
+        }
+
+        // A refreshed tree is only read by queries, so they run in parallel like requests of a server
+        utf8Tree.setThreadsNumber( 1 );
+        utf8Tree.refreshOccurrences( );
+        std::vector<CFrequencyInfo> parallelFound(3);
+        std::vector<std::thread> queries;
+        for (auto &top: parallelFound) {
+            queries.emplace_back([&utf8Tree, &top]() { top = utf8Tree.getTopSuitableSubstrings(0, 4); });
+        }
+        for (auto &query: queries) {
+            query.join();
+        }
+        for (auto &top: parallelFound) {
+            std::sort(top.begin(), top.end());
+            if (top != expected) {
+                throw std::runtime_error("Parallel queries of a UTF-8 text differ from a single one");
+            }
+        }
+
+        // Lengths in code points are kept by index files
+        char fileName[] = "/tmp/substrings_counter_index_XXXXXX";
+        const int file = mkstemp(fileName);
+        if (file < 0) {
+            throw std::runtime_error("Couldn't create a temporary file");
+        }
+        close(file);
+        utf8Tree.save( fileName );
+        CMappedFile indexFile(fileName);
+        unlink(fileName);
+        setSymbolClasses(CSymbolClasses::asciiLetters());
+        CSuffixTree loadedTree( indexFile );
+        CFrequencyInfo loaded = loadedTree.getTopSuitableSubstrings(0, 4);
+        std::sort(loaded.begin(), loaded.end());
+        setSymbolClasses(CSymbolClasses::utf8Letters());
+        if (loaded != expected) {
+            throw std::runtime_error("Suffix tree of a UTF-8 index file differs from the saved one");
+        }
+    }
+    // Overlong, cut, lone continuation and surrogate sequences
+    const std::vector<std::string> invalidStrings = { "ab \xC0\x80", "ab \xE4\xB8", "\x80" "ab", "ab \xED\xA0\x80 cd" };
+    for (const auto &invalidStr: invalidStrings) {
+        bool refused = false;
+        try {
+            checkDictionary(invalidStr);
+        } catch (std::runtime_error &) {
+            refused = true;
+        }
+        if (!refused) {
+            throw std::runtime_error("Invalid UTF-8 is not refused");
+        }
+    }
+    setSymbolClasses(CSymbolClasses::asciiLetters());
+    std::cout << "Test on UTF-8 texts passed." << std::endl;
+
     std::vector<std::string> dictionaries = { AllLetters, "abc", "ab", "a" };
     int dictionaryNumber = 1;
     for (auto dictionary: dictionaries) {
@@ -162,13 +851,92 @@ void runTests() {
     std::cout << "All tests successfully passed." << std::endl;
 }
 
+// Closed form results for a string of one letter repeated:
+// every substring of length L occurs length - L + 1 times
+ssize_t countRepeatedLetterFrequences(size_t length, char letter, FreqResults &results) {
+    const size_t minWordLength = 4;
+    if (length < minWordLength) {
+        return 0;
+    }
+
+    const ssize_t numberOfSubstrings = (ssize_t)(length - minWordLength + 1) * (ssize_t)(length - minWordLength + 2) / 2;
+    for (size_t substringLength = minWordLength; substringLength <= std::min(length, minWordLength + 9); ++substringLength) {
+        results.emplace_back(100 * (ssize_t)(length - substringLength + 1) / (double)numberOfSubstrings, std::string(substringLength, letter));
+    }
+    return numberOfSubstrings;
+}
+
+// Engines on texts making trees as deep as the text is long,
+// traversals have to go without recursion here
+void runStressTests(size_t length) {
+    std::cout << "Stress test on " << length << " letters 'a'..." << std::endl;
+    const std::string testStr(length, 'a');
+    FreqResults res;
+    const ssize_t numberOfSubstrings = countRepeatedLetterFrequences(length, 'a', res);
+    {
+        CSuffixTree tree( testStr );
+        tree.buildTree( );
+        checkEngine("<" + std::to_string(length) + " letters 'a'>", res, numberOfSubstrings, tree, "suffix tree");
+    }
+    {
+        CSuffixArray suffixArray( testStr );
+        suffixArray.buildArray( );
+        checkEngine("<" + std::to_string(length) + " letters 'a'>", res, numberOfSubstrings, suffixArray, "suffix array");
+    }
+    std::cout << "Stress test on " << length << " letters 'a' passed." << std::endl;
+
+    // Two letters repeated have no closed form that short, engines are checked against each other
+    std::cout << "Stress test on " << length << " letters 'abab...'..." << std::endl;
+    std::string alternatingStr(length, 'a');
+    for (size_t index = 1; index < length; index += 2) {
+        alternatingStr[index] = 'b';
+    }
+    FreqResults alternatingRes;
+    ssize_t alternatingNumberOfSubstrings = 0;
+    {
+        CSuffixArray suffixArray( alternatingStr );
+        suffixArray.buildArray( );
+        for (auto p: suffixArray.getTopSuitableSubstrings(10, 4)) {
+            alternatingRes.emplace_back(p.second, p.first);
+        }
+        alternatingNumberOfSubstrings = suffixArray.getNumbetOfSubstringsLongerThan(4);
+    }
+    {
+        CSuffixTree tree( alternatingStr );
+        tree.buildTree( );
+        checkEngine("<" + std::to_string(length) + " letters 'abab...'>", alternatingRes, alternatingNumberOfSubstrings, tree, "suffix tree");
+    }
+    std::cout << "Stress test on " << length << " letters 'abab...' passed." << std::endl;
+}
+
+// Default length of stress texts and memory the tree takes on them
+const long long DEFAULT_STRESS_LENGTH = 50000000;
+const long long STRESS_BYTES_PER_LETTER = 65;
+
 void printUsage() {
     std::cerr << "Usage:" << std::endl
-              << "./counter <file to read>" << std::endl;
+              << "./test [--stress [length]]" << std::endl
+              << "  --stress  runs engines on 'aaaa...' and 'abab...' of the length given, 50000000 by default;" << std::endl
+              << "            the suffix tree takes about " << STRESS_BYTES_PER_LETTER << " bytes per letter there, "
+              << STRESS_BYTES_PER_LETTER * DEFAULT_STRESS_LENGTH / 1000000000.0 << " GB by default" << std::endl;
 }
 
 int main(int argc, char *argv[]) {
     try {
+        if (argc > 1) {
+            if (strcmp(argv[1], "--stress") != 0 || argc > 3) {
+                printUsage();
+                return 1;
+            }
+            const long long length = (argc > 2) ? atoll(argv[2]) : DEFAULT_STRESS_LENGTH;
+            if (length <= 0) {
+                printUsage();
+                return 1;
+            }
+            runStressTests(length);
+            return 0;
+        }
+
         runTests();
         return 0;
     } catch(std::exception &e) {
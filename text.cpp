@@ -0,0 +1,93 @@
+#include "text.h"
+
+#include <cstring>
+#include <algorithm>
+
+CText::CText(std::string owned_)
+    : owned(std::move(owned_)), letters(owned.data()), length(owned.size()), viewed(false)
+{}
+
+CText::CText(const char *owned_)
+    : CText(std::string(owned_))
+{}
+
+CText::CText(const char *data_, size_t size_)
+    : letters(data_), length(size_), viewed(true)
+{}
+
+CText::CText(const CText &other)
+    : owned(other.owned), letters(other.viewed ? other.letters : owned.data()), length(other.length), viewed(other.viewed)
+{}
+
+// Short owned strings live inside std::string, so letters are pointed again after a move
+CText::CText(CText &&other)
+    : owned(std::move(other.owned)), letters(other.viewed ? other.letters : owned.data()), length(other.length), viewed(other.viewed)
+{
+    other.owned.clear();
+    other.letters = other.owned.data();
+    other.length = 0;
+    other.viewed = false;
+}
+
+CText &CText::operator=(const CText &other) {
+    if (this != &other) {
+        *this = CText(other);
+    }
+    return *this;
+}
+
+CText &CText::operator=(CText &&other) {
+    if (this != &other) {
+        owned = std::move(other.owned);
+        letters = other.viewed ? other.letters : owned.data();
+        length = other.length;
+        viewed = other.viewed;
+
+        other.owned.clear();
+        other.letters = other.owned.data();
+        other.length = 0;
+        other.viewed = false;
+    }
+    return *this;
+}
+
+std::string CText::substr(size_t position, size_t count) const {
+    return std::string(letters + position, std::min(count, length - position));
+}
+
+int CText::compare(size_t position, size_t count, const std::string &other) const {
+    return compare(position, count, other, 0, other.size());
+}
+
+// Letters are compared as unsigned, then the shorter string goes first
+int CText::compare(size_t position, size_t count, const std::string &other, size_t otherPosition, size_t otherCount) const {
+    count = std::min(count, length - position);
+    otherCount = std::min(otherCount, other.size() - otherPosition);
+    const int result = memcmp(letters + position, other.data() + otherPosition, std::min(count, otherCount));
+    if (result != 0) {
+        return result;
+    }
+    return (count < otherCount) ? -1 : ((count > otherCount) ? 1 : 0);
+}
+
+void CText::append(const std::string &chunk) {
+    own();
+    owned += chunk;
+    letters = owned.data();
+    length = owned.size();
+}
+
+void CText::erase(size_t position, size_t count) {
+    own();
+    owned.erase(position, count);
+    letters = owned.data();
+    length = owned.size();
+}
+
+void CText::own() {
+    if (viewed) {
+        owned.assign(letters, length);
+        letters = owned.data();
+        viewed = false;
+    }
+}
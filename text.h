@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+//---------------------------------------------------
+// Text indexed by an engine: either letters it owns
+// or a read-only view of a buffer owned by the caller, like a memory-mapped file.
+// Viewed letters are never copied, unless the text has to change:
+// appending or erasing makes an owned copy first.
+class CText {
+public:
+    // Owned letters
+    CText(std::string owned_ = std::string());
+    CText(const char *owned_);
+    // View of a buffer that outlives the text
+    CText(const char *data_, size_t size_);
+
+    CText(const CText &other);
+    CText(CText &&other);
+    CText &operator=(const CText &other);
+    CText &operator=(CText &&other);
+
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    const char *data() const { return letters; }
+    char operator[](size_t index) const { return letters[index]; }
+    const char *begin() const { return letters; }
+    const char *end() const { return letters + length; }
+
+    bool isView() const { return viewed; }
+
+    // Same as for std::string, count is cut at the end of the text
+    std::string substr(size_t position, size_t count = std::string::npos) const;
+    int compare(size_t position, size_t count, const std::string &other) const;
+    int compare(size_t position, size_t count, const std::string &other, size_t otherPosition, size_t otherCount) const;
+
+    void append(const std::string &chunk);
+    void erase(size_t position, size_t count);
+
+    // Bytes taken by the letters, a viewed buffer is counted as well
+    size_t bytesUsed() const { return viewed ? length : owned.capacity(); }
+
+private:
+    std::string owned;
+    const char *letters;
+    size_t length;
+    bool viewed;
+
+    // Copies viewed letters before they change
+    void own();
+};
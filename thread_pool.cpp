@@ -0,0 +1,77 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+CThreadPool::CThreadPool(size_t threadsNumber) {
+    threadsNumber = std::max((size_t)1, threadsNumber);
+    for (size_t index = 0; index < threadsNumber; ++index) {
+        workers.emplace_back(&CThreadPool::work, this);
+    }
+}
+
+CThreadPool::~CThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAdded.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+// Queues a task to be run by one of the workers
+void CThreadPool::run(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAdded.notify_one();
+}
+
+// Waits until all queued tasks are done, rethrows the first exception of a task
+void CThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    tasksDone.wait(lock, [this]() { return tasks.empty() && runningTasks == 0; });
+
+    if (firstError) {
+        std::exception_ptr error = firstError;
+        firstError = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+// Loop of a worker thread
+void CThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAdded.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            ++runningTasks;
+        }
+
+        std::exception_ptr error;
+        try {
+            task();
+        } catch(...) {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (error && !firstError) {
+                firstError = error;
+            }
+            --runningTasks;
+            if (tasks.empty() && runningTasks == 0) {
+                tasksDone.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <exception>
+
+// Fixed number of worker threads running queued tasks.
+// The first exception thrown by a task is kept and rethrown by wait().
+class CThreadPool {
+public:
+    explicit CThreadPool(size_t threadsNumber);
+    ~CThreadPool();
+
+    // Queues a task to be run by one of the workers
+    void run(std::function<void()> task);
+
+    // Waits until all queued tasks are done
+    void wait();
+
+    size_t size() const { return workers.size(); }
+
+private:
+    // Loop of a worker thread
+    void work();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAdded;
+    std::condition_variable tasksDone;
+    // Tasks taken by workers and not finished yet
+    size_t runningTasks = 0;
+    bool stopping = false;
+    std::exception_ptr firstError;
+};
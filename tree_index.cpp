@@ -0,0 +1,254 @@
+#include "tree_index.h"
+#include "suffix_tree.h"
+#include "mapped_file.h"
+#include "stats.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <stdexcept>
+
+const char IndexMagic[8] = { 'S', 'U', 'B', 'S', 'T', 'R', 'I', 'X' };
+const uint32_t CIndexHeader::VERSION;
+const uint64_t CIndexHeader::BYTE_ORDER_MARK;
+
+//---------------------------------------------------
+//--------  CIndexChecksum Implementation  ----------
+//---------------------------------------------------
+
+// FNV-1a over words instead of bytes, a word is a multiplication
+void CIndexChecksum::addWord(uint64_t word) {
+    hash = (hash ^ word) * 0x100000001b3ull;
+}
+
+void CIndexChecksum::add(const char *data, size_t size) {
+    // Bytes left of the previous call make a word first
+    while (size > 0 && pendingBytes > 0) {
+        pending |= (uint64_t)(unsigned char)*data << (8 * pendingBytes);
+        ++data;
+        --size;
+        if (++pendingBytes == 8) {
+            addWord(pending);
+            pending = 0;
+            pendingBytes = 0;
+        }
+    }
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        addWord(word);
+    }
+    for (; size > 0; ++data, --size) {
+        pending |= (uint64_t)(unsigned char)*data << (8 * pendingBytes++);
+    }
+}
+
+// High bits of words only reach high bits of the hash, so they are mixed down at the end
+uint64_t CIndexChecksum::value() const {
+    uint64_t result = hash;
+    if (pendingBytes > 0) {
+        result = (result ^ pending) * 0x100000001b3ull;
+    }
+    result ^= result >> 33;
+    result *= 0xff51afd7ed558ccdull;
+    result ^= result >> 33;
+    return result;
+}
+
+namespace {
+
+// Writes sections of an index file after the place of the header, the header goes last.
+// The file is removed unless it is finished.
+class CIndexWriter {
+public:
+    explicit CIndexWriter(const std::string &fileName_)
+        : fileName(fileName_), offset(sizeof(CIndexHeader))
+    {
+        file = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file < 0) {
+            throw std::runtime_error("Couldn't create index file '" + fileName + "'");
+        }
+        memset(&header, 0, sizeof(header));
+        if (lseek(file, offset, SEEK_SET) < 0) {
+            throw std::runtime_error("Couldn't write index file '" + fileName + "'");
+        }
+    }
+
+    ~CIndexWriter() {
+        if (file >= 0) {
+            close(file);
+            unlink(fileName.c_str());
+        }
+    }
+
+    template <typename T>
+    void writeSection(EIndexSection section, const T *items, size_t size) {
+        header.sections[section].offset = offset;
+        header.sections[section].size = size;
+        write(reinterpret_cast<const char *>(items), size * sizeof(T));
+
+        // Sections start at offsets aligned to 8 bytes
+        const char padding[8] = { 0 };
+        write(padding, (8 - offset % 8) % 8);
+    }
+
+    void finish() {
+        memcpy(header.magic, IndexMagic, sizeof(header.magic));
+        header.version = CIndexHeader::VERSION;
+        header.sectionsNumber = IS_COUNT;
+        header.byteOrder = CIndexHeader::BYTE_ORDER_MARK;
+        header.fileSize = offset;
+        header.checksum = checksum.value();
+        if (pwrite(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || close(file) != 0) {
+            file = -1;
+            unlink(fileName.c_str());
+            throw std::runtime_error("Couldn't write index file '" + fileName + "'");
+        }
+        file = -1;
+    }
+
+private:
+    std::string fileName;
+    int file;
+    uint64_t offset;
+    CIndexHeader header;
+    CIndexChecksum checksum;
+
+    void write(const char *data, size_t size) {
+        checksum.add(data, size);
+        offset += size;
+        while (size > 0) {
+            const ssize_t written = ::write(file, data, size);
+            if (written <= 0) {
+                throw std::runtime_error("Couldn't write index file '" + fileName + "'");
+            }
+            data += written;
+            size -= written;
+        }
+    }
+};
+
+// Items of a section, checked to be inside the file
+template <typename T>
+const T *sectionItems(const CMappedFile &indexFile, const CIndexHeader &header, EIndexSection section) {
+    const CIndexSection &place = header.sections[section];
+    if (place.offset % 8 != 0 || place.offset > indexFile.size() || place.size > (indexFile.size() - place.offset) / sizeof(T)) {
+        throw std::runtime_error("Index file is damaged!");
+    }
+    return reinterpret_cast<const T *>(indexFile.data() + place.offset);
+}
+
+}
+
+// Writes the tree with up to date occurrence numbers into an index file
+void CSuffixTree::save(const std::string &fileName) {
+    // Positions of a window may point before its letters
+    if (windowSize > 0) {
+        throw std::runtime_error("Can't save a suffix tree of a window!");
+    }
+    // The format has no place for documents yet
+    if (!documentStart.empty()) {
+        throw std::runtime_error("Can't save a suffix tree of documents!");
+    }
+    refreshOccurrences();
+    CStatsPhase phase("save_index");
+
+    CIndexScalars scalars;
+    memset(&scalars, 0, sizeof(scalars));
+    scalars.currentIndex = currentIndex;
+    scalars.alphabetSize = arena.alphabetSize;
+    scalars.flags = codePoints ? IF_CODE_POINTS : 0;
+    memcpy(scalars.symbolCode, symbolCode, sizeof(symbolCode));
+
+    // Written next to the index, so readers see either the old file or the new one
+    const std::string temporaryName = fileName + ".tmp";
+    CIndexWriter writer(temporaryName);
+    writer.writeSection(IS_SCALARS, &scalars, 1);
+    writer.writeSection(IS_TEXT, sourceString.data(), sourceString.size());
+    writer.writeSection(IS_POSITION, arena.position.data(), arena.position.size());
+    writer.writeSection(IS_DEPTH, arena.depth.data(), arena.depth.size());
+    writer.writeSection(IS_CHILDREN, arena.children.data(), arena.children.size());
+    writer.writeSection(IS_OCCURRENCES, arena.occurrenceNumber.data(), arena.occurrenceNumber.size());
+    writer.writeSection(IS_BLOCK_POOL, arena.blockPool.data(), arena.blockPool.size());
+    writer.writeSection(IS_TABLES, arena.tables.data(), arena.tables.size());
+    writer.writeSection(IS_NON_LETTERS, letterIndex.nonLetterBits().data(), letterIndex.nonLetterBits().size());
+    writer.writeSection(IS_NEXT_NON_LETTER, letterIndex.blockNextNonLetters().data(), letterIndex.blockNextNonLetters().size());
+    writer.writeSection(IS_WORD_START, leafWeights.wordStart.data(), leafWeights.wordStart.size());
+    writer.writeSection(IS_MULTIPLICITY, leafWeights.multiplicity.data(), leafWeights.multiplicity.size());
+    writer.finish();
+
+    if (rename(temporaryName.c_str(), fileName.c_str()) != 0) {
+        unlink(temporaryName.c_str());
+        throw std::runtime_error("Couldn't write index file '" + fileName + "'");
+    }
+}
+
+// Tree saved by save(), read in place from the mapped file
+CSuffixTree::CSuffixTree(const CMappedFile &indexFile)
+    : activePoint(this), previousPoint(this)
+{
+    CStatsPhase phase("load_index");
+    if (indexFile.size() < sizeof(CIndexHeader)) {
+        throw std::runtime_error("Index file is too short!");
+    }
+    CIndexHeader header;
+    memcpy(&header, indexFile.data(), sizeof(header));
+    if (memcmp(header.magic, IndexMagic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("File is not an index of a suffix tree!");
+    }
+    if (header.byteOrder != CIndexHeader::BYTE_ORDER_MARK) {
+        throw std::runtime_error("Index file was written on a machine with another byte order!");
+    }
+    if (header.version != CIndexHeader::VERSION) {
+        throw std::runtime_error("Index file version " + std::to_string(header.version) + " is not supported!");
+    }
+    if (header.sectionsNumber != IS_COUNT || header.fileSize != indexFile.size()) {
+        throw std::runtime_error("Index file is damaged!");
+    }
+
+    CIndexChecksum checksum;
+    checksum.add(indexFile.data() + sizeof(CIndexHeader), indexFile.size() - sizeof(CIndexHeader));
+    if (checksum.value() != header.checksum) {
+        throw std::runtime_error("Checksum of the index file doesn't match!");
+    }
+
+    const CIndexScalars &scalars = *sectionItems<CIndexScalars>(indexFile, header, IS_SCALARS);
+    const size_t textSize = header.sections[IS_TEXT].size;
+    const size_t nodesNumber = header.sections[IS_POSITION].size;
+    const size_t letterBlocks = (textSize + CLetterIndex::BLOCK_SIZE - 1) / CLetterIndex::BLOCK_SIZE;
+    if (header.sections[IS_SCALARS].size != 1 || scalars.currentIndex + 1 != (int64_t)textSize || nodesNumber == 0
+            || header.sections[IS_DEPTH].size != nodesNumber || header.sections[IS_CHILDREN].size != nodesNumber
+            || header.sections[IS_OCCURRENCES].size != nodesNumber
+            || header.sections[IS_NON_LETTERS].size != letterBlocks || header.sections[IS_NEXT_NON_LETTER].size != letterBlocks
+            || header.sections[IS_WORD_START].size != header.sections[IS_MULTIPLICITY].size) {
+        throw std::runtime_error("Index file is damaged!");
+    }
+
+    sourceString = CText(sectionItems<char>(indexFile, header, IS_TEXT), textSize);
+    currentIndex = scalars.currentIndex;
+    arena.alphabetSize = scalars.alphabetSize;
+    codePoints = (scalars.flags & IF_CODE_POINTS) != 0;
+    memcpy(symbolCode, scalars.symbolCode, sizeof(symbolCode));
+
+    arena.position.view(sectionItems<uint32_t>(indexFile, header, IS_POSITION), nodesNumber);
+    arena.depth.view(sectionItems<uint32_t>(indexFile, header, IS_DEPTH), nodesNumber);
+    arena.children.view(sectionItems<CChildSet>(indexFile, header, IS_CHILDREN), nodesNumber);
+    arena.occurrenceNumber.view(sectionItems<uint32_t>(indexFile, header, IS_OCCURRENCES), nodesNumber);
+    arena.blockPool.view(sectionItems<uint32_t>(indexFile, header, IS_BLOCK_POOL), header.sections[IS_BLOCK_POOL].size);
+    arena.tables.view(sectionItems<EdgeId>(indexFile, header, IS_TABLES), header.sections[IS_TABLES].size);
+    letterIndex.view(sectionItems<uint64_t>(indexFile, header, IS_NON_LETTERS),
+                     sectionItems<uint32_t>(indexFile, header, IS_NEXT_NON_LETTER), textSize);
+    leafWeights.wordStart.view(sectionItems<uint32_t>(indexFile, header, IS_WORD_START), header.sections[IS_WORD_START].size);
+    leafWeights.multiplicity.view(sectionItems<uint32_t>(indexFile, header, IS_MULTIPLICITY), header.sections[IS_MULTIPLICITY].size);
+
+    // Occurrence numbers and terminal marks are saved up to date, nothing is counted again
+    activePoint.node = ROOT;
+    activePoint.edge = NONE;
+    activePoint.relativeIndex = 0;
+    terminalsMarked = true;
+    allChanged = false;
+    readOnly = true;
+}
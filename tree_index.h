@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+//---------------------------------------------------
+// File of a finished suffix tree with its occurrence numbers,
+// written by CSuffixTree::save() and read in place by CSuffixTree(const CMappedFile &).
+//
+// The header is followed by sections, every one is an array of plain items of the tree
+// at an offset aligned to 8 bytes. Nodes, edges and blocks are numbers, not pointers,
+// so the file is used wherever it is mapped and processes share its pages through the page cache.
+// A checksum of everything after the header is checked on loading.
+// Numbers are in the byte order of the machine that wrote the file, another order is refused.
+
+// Sections in the order of the file
+enum EIndexSection {
+    IS_SCALARS,
+    IS_TEXT,
+    IS_POSITION,
+    IS_DEPTH,
+    IS_CHILDREN,
+    IS_OCCURRENCES,
+    IS_BLOCK_POOL,
+    IS_TABLES,
+    IS_NON_LETTERS,
+    IS_NEXT_NON_LETTER,
+    IS_WORD_START,
+    IS_MULTIPLICITY,
+    IS_COUNT
+};
+
+struct CIndexSection {
+    uint64_t offset;
+    // Number of items
+    uint64_t size;
+};
+
+struct CIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionsNumber;
+    uint64_t byteOrder;
+    uint64_t fileSize;
+    uint64_t checksum;
+    CIndexSection sections[IS_COUNT];
+
+    static const uint32_t VERSION = 1;
+    static const uint64_t BYTE_ORDER_MARK = 0x0102030405060708ull;
+};
+
+// The only item of IS_SCALARS
+struct CIndexScalars {
+    int64_t currentIndex;
+    uint32_t alphabetSize;
+    uint32_t flags;
+    uint8_t symbolCode[256];
+};
+
+// Bits of CIndexScalars::flags
+enum EIndexFlag {
+    // Lengths of substrings are in UTF-8 code points
+    IF_CODE_POINTS = 1
+};
+
+// Magic bytes the file starts with
+extern const char IndexMagic[8];
+
+// Checksum of 8 byte words, the last word is padded with zeros
+class CIndexChecksum {
+public:
+    void add(const char *data, size_t size);
+    uint64_t value() const;
+
+private:
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint64_t pending = 0;
+    size_t pendingBytes = 0;
+
+    void addWord(uint64_t word);
+};
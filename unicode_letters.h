@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Whether a code point above 0x7F is a Unicode letter or a mark, marks being
+// accents and vowel signs which go on inside words
+bool isUnicodeLetter(uint32_t codePoint);
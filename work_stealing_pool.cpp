@@ -0,0 +1,117 @@
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+
+namespace {
+    // Number of the worker running on this thread, its own deque
+    thread_local size_t currentWorker = 0;
+}
+
+CWorkStealingPool::CWorkStealingPool(size_t threadsNumber)
+    : queuedTasks(0), pendingTasks(0)
+{
+    threadsNumber = std::max((size_t)1, threadsNumber);
+    for (size_t index = 0; index < threadsNumber; ++index) {
+        deques.emplace_back(new CWorkerDeque());
+    }
+    for (size_t index = 0; index < threadsNumber; ++index) {
+        workers.emplace_back(&CWorkStealingPool::work, this, index);
+    }
+}
+
+CWorkStealingPool::~CWorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAdded.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+// Runs the task and all tasks spawned by it, rethrows the first exception of a task
+void CWorkStealingPool::run(CTask task) {
+    pendingTasks += 1;
+    queueTask(0, std::move(task));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    tasksDone.wait(lock, [this]() { return pendingTasks == 0; });
+
+    if (firstError) {
+        std::exception_ptr error = firstError;
+        firstError = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+// Queues a task on the deque of the worker calling it
+void CWorkStealingPool::spawn(CTask task) {
+    pendingTasks += 1;
+    queueTask(currentWorker, std::move(task));
+}
+
+void CWorkStealingPool::queueTask(size_t worker, CTask task) {
+    {
+        std::lock_guard<std::mutex> lock(deques[worker]->mutex);
+        deques[worker]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queuedTasks += 1;
+    }
+    taskAdded.notify_one();
+}
+
+// Own deque is used as a stack, others are stolen from in the order of queueing
+bool CWorkStealingPool::takeTask(size_t worker, CTask &task) {
+    for (size_t offset = 0; offset < deques.size(); ++offset) {
+        CWorkerDeque &deque = *deques[ (worker + offset) % deques.size() ];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (deque.tasks.empty()) {
+            continue;
+        }
+        if (offset == 0) {
+            task = std::move(deque.tasks.back());
+            deque.tasks.pop_back();
+        } else {
+            task = std::move(deque.tasks.front());
+            deque.tasks.pop_front();
+        }
+        queuedTasks -= 1;
+        return true;
+    }
+    return false;
+}
+
+// Loop of a worker thread
+void CWorkStealingPool::work(size_t worker) {
+    currentWorker = worker;
+    while (true) {
+        CTask task;
+        if (!takeTask(worker, task)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAdded.wait(lock, [this]() { return stopping || queuedTasks > 0; });
+            if (stopping) {
+                return;
+            }
+            continue;
+        }
+
+        std::exception_ptr error;
+        try {
+            task();
+        } catch(...) {
+            error = std::current_exception();
+        }
+        task = nullptr;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error && !firstError) {
+            firstError = error;
+        }
+        if (--pendingTasks == 0) {
+            tasksDone.notify_all();
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <exception>
+
+// Worker threads with a deque of tasks each.
+// A worker takes the newest task of its own deque and steals the oldest task of another one,
+// so big tasks queued first go to idle workers and small ones made later stay with their worker.
+// Tasks may spawn more tasks while they run.
+// The first exception thrown by a task is kept and rethrown by run().
+class CWorkStealingPool {
+public:
+    typedef std::function<void()> CTask;
+
+    explicit CWorkStealingPool(size_t threadsNumber);
+    ~CWorkStealingPool();
+
+    CWorkStealingPool(const CWorkStealingPool &) = delete;
+    CWorkStealingPool &operator=(const CWorkStealingPool &) = delete;
+
+    // Runs the task and all tasks spawned by it, returns when they are done
+    void run(CTask task);
+
+    // Queues a task on the deque of the worker calling it, called from running tasks only
+    void spawn(CTask task);
+
+    // There are fewer queued tasks than workers, so splitting work pays off
+    bool wantsTasks() const { return queuedTasks.load(std::memory_order_relaxed) < workers.size(); }
+
+    size_t size() const { return workers.size(); }
+
+private:
+    struct CWorkerDeque {
+        std::mutex mutex;
+        std::deque<CTask> tasks;
+    };
+
+    // Loop of a worker thread
+    void work(size_t worker);
+    // Takes a task of the worker's own deque or steals one, false if all deques are empty
+    bool takeTask(size_t worker, CTask &task);
+    void queueTask(size_t worker, CTask task);
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<CWorkerDeque>> deques;
+    std::mutex mutex;
+    std::condition_variable taskAdded;
+    std::condition_variable tasksDone;
+    // Tasks in deques, changed under the mutex when increased, so no worker misses a wake up
+    std::atomic<size_t> queuedTasks;
+    // Tasks queued or running
+    std::atomic<size_t> pendingTasks;
+    bool stopping = false;
+    std::exception_ptr firstError;
+};